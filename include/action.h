@@ -0,0 +1,141 @@
+#ifndef ACTION_H_
+#define ACTION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "usb_descriptors.h"
+
+// 16-bit tagged key actions, stored in the flash-resident action table.
+//
+//   [15:12] tag  [11:0] argument
+//   ACT_TAG_KEY       keyboard usage (0x00 is no action)
+//   ACT_TAG_MOD       modifier bitmask, same layout as the boot report byte
+//   ACT_TAG_MACRO     macro index, see store_macro()
+//   ACT_TAG_LAYER     [11:8] layer operation, [7:0] layer
+//   ACT_TAG_MOD_TAP   [11:8] left modifiers on hold, [7:0] usage on tap
+//   ACT_TAG_RMOD_TAP  [11:8] right modifiers on hold, [7:0] usage on tap
+//   ACT_TAG_LAYER_TAP [11:8] momentary layer on hold, [7:0] usage on tap
+//   ACT_TAG_SYSTEM    device operation, SYS_*
+//   ACT_TAG_CONSUMER  consumer page usage, CONSUMER_*
+//   ACT_TAG_MOUSE     mouse key, MS_*
+//   ACT_TAG_TRANS     transparent: use the next active layer below
+//
+// A plain usage is already a valid ACT_TAG_KEY action, so layouts can
+// use KEY_* directly; LAYOUT() turns modifier usages into ACT_TAG_MOD.
+typedef uint16_t action_t;
+
+#define ACT_TAG_KEY       0x0
+#define ACT_TAG_MOD       0x1
+#define ACT_TAG_MACRO     0x2
+#define ACT_TAG_LAYER     0x3
+#define ACT_TAG_MOD_TAP   0x4
+#define ACT_TAG_RMOD_TAP  0x5
+#define ACT_TAG_LAYER_TAP 0x6
+#define ACT_TAG_SYSTEM    0x7
+#define ACT_TAG_CONSUMER  0x8
+#define ACT_TAG_MOUSE     0x9
+#define ACT_TAG_TRANS     0xf
+
+#define LAYER_OP_MOMENTARY 0x0
+#define LAYER_OP_TOGGLE    0x1
+#define LAYER_OP_ONESHOT   0x2
+
+#define SYS_BOOTLOADER 0x0
+#define SYS_LEADER     0x1
+
+// Consumer page usages for CONSUMER()
+#define CONSUMER_SCAN_NEXT    0x0b5
+#define CONSUMER_SCAN_PREV    0x0b6
+#define CONSUMER_STOP         0x0b7
+#define CONSUMER_PLAY_PAUSE   0x0cd
+#define CONSUMER_MUTE         0x0e2
+#define CONSUMER_VOLUME_UP    0x0e9
+#define CONSUMER_VOLUME_DOWN  0x0ea
+#define CONSUMER_CALCULATOR   0x192
+#define CONSUMER_BROWSER_HOME 0x223
+
+// Mouse keys: pointer and wheel directions, then buttons
+#define MS_UP       0x0
+#define MS_DOWN     0x1
+#define MS_LEFT     0x2
+#define MS_RIGHT    0x3
+#define MS_WH_UP    0x4
+#define MS_WH_DOWN  0x5
+#define MS_WH_LEFT  0x6
+#define MS_WH_RIGHT 0x7
+#define MS_BTN1     0x8
+#define MS_BTN2     0x9
+#define MS_BTN3     0xa
+#define MS_BTN4     0xb
+#define MS_BTN5     0xc
+#define MS_COUNT    0xd
+
+#define ACTION(tag, arg)  ((action_t) (((tag) << 12) | (arg)))
+#define ACTION_TAG(action) ((action) >> 12)
+#define ACTION_ARG(action) ((action) & 0xfff)
+
+#define ACTION_LAYER_OP(action) (((action) >> 8) & 0xf)
+#define ACTION_LAYER(action)    ((action) & 0xff)
+
+// Evaluates to 0, or fails to compile when cond is false. Used inside
+// the action constructors so a bad layout entry is a build error.
+#define ACTION_CHECK(cond) (0 * sizeof(char[(cond) ? 1 : -1]))
+
+#define ACTION_IS_MOD_USAGE(usage) (((usage) & 0xf8) == 0xe0)
+
+#define MOD(mask)   ACTION(ACT_TAG_MOD, (mask) + ACTION_CHECK((mask) <= 0xff))
+#define MACRO(n)    ACTION(ACT_TAG_MACRO, (n) + ACTION_CHECK((n) < N_MACROS))
+#define LAYER_ACTION(op, layer) \
+    ACTION(ACT_TAG_LAYER, ((op) << 8) | ((layer) + ACTION_CHECK((layer) < N_LAYERS)))
+
+#define MO(layer)   LAYER_ACTION(LAYER_OP_MOMENTARY, layer)
+#define TG(layer)   LAYER_ACTION(LAYER_OP_TOGGLE, layer)
+#define OSL(layer)  LAYER_ACTION(LAYER_OP_ONESHOT, layer)
+#define TRNS        ACTION(ACT_TAG_TRANS, 0)
+#define BOOTLOADER  ACTION(ACT_TAG_SYSTEM, SYS_BOOTLOADER)
+#define LEADER      ACTION(ACT_TAG_SYSTEM, SYS_LEADER)
+#define CONSUMER(usage) \
+    ACTION(ACT_TAG_CONSUMER, (usage) + ACTION_CHECK((usage) != 0 && (usage) <= 0xfff))
+#define MOUSE(key)  ACTION(ACT_TAG_MOUSE, (key) + ACTION_CHECK((key) < MS_COUNT))
+
+// Tap-hold keys: the usage on tap, modifiers (all left or all right
+// hand, as KEY_MOD_* masks) or a momentary layer on hold
+#define TAP_USAGE(usage) \
+    ((usage) + ACTION_CHECK((usage) <= NKRO_USAGE_MAX && !ACTION_IS_MOD_USAGE(usage)))
+#define MT(mods, usage) ((action_t) (((mods) & 0xf0 ? \
+    ACTION(ACT_TAG_RMOD_TAP, ((mods) >> 4) << 8 | TAP_USAGE(usage)) : \
+    ACTION(ACT_TAG_MOD_TAP, (mods) << 8 | TAP_USAGE(usage))) + \
+    ACTION_CHECK((mods) != 0 && (((mods) & 0x0f) == 0 || ((mods) & 0xf0) == 0))))
+#define LT(layer, usage) \
+    ACTION(ACT_TAG_LAYER_TAP, ((layer) + ACTION_CHECK((layer) < N_LAYERS && (layer) < 16)) << 8 | \
+           TAP_USAGE(usage))
+
+#define ACTION_IS_TAP_HOLD(action) \
+    (ACTION_TAG(action) >= ACT_TAG_MOD_TAP && ACTION_TAG(action) <= ACT_TAG_LAYER_TAP)
+
+// Layout entries below 0x100 are keyboard usages; anything else must
+// already be a tagged action
+#define ACTION_AUTO(x) ((action_t) ( \
+    ((x) > 0xff ? (x) : ACTION_IS_MOD_USAGE(x) ? ACTION(ACT_TAG_MOD, 1 << ((x) & 7)) : (x)) + \
+    ACTION_CHECK((x) > 0xff || (x) <= NKRO_USAGE_MAX)))
+
+struct key_event;
+
+// Resolve a debounced key change (key, pressed and timestamps set) into
+// usage events on the event queue
+void action_process(const struct key_event *change);
+
+// Run a key press as a given action rather than the one the layers
+// resolve to; its release undoes the same action
+void action_press(const struct key_event *change, action_t action);
+
+// Press and release an action at once, without tying it to the key
+void action_tap(const struct key_event *change, action_t action);
+
+// Whether an action passes the same checks the constructors above make
+// at build time; for actions that come from the host rather than the
+// layout
+bool action_valid(action_t action);
+
+#endif /* ACTION_H_ */
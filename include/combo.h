@@ -0,0 +1,45 @@
+#ifndef COMBO_H_
+#define COMBO_H_
+
+#include <stdint.h>
+
+#include "action.h"
+
+// Combos: a set of matrix positions pressed together runs one action.
+//
+// By default a combo consumes its keys. A key that belongs to a combo
+// is held back until either the rest of the combo goes down within
+// COMBO_TERM_MS (the combo fires instead of the keys) or it becomes
+// clear it will not (the held keys are let through in order).
+//
+// COMBO_HELD combos fire whenever all their keys are down, however
+// slowly they were pressed, and do not hold back or consume the keys.
+#define COMBO_HELD 0x01
+
+#define COMBO_MAX_KEYS 4
+
+struct combo {
+    action_t action;
+    uint8_t flags;
+    uint8_t n_keys;
+    uint8_t keys[COMBO_MAX_KEYS];   // KEY_INDEX() positions
+};
+
+#define COMBO(action, flags, ...) { ACTION_AUTO(action), (flags), \
+    sizeof((uint8_t[]) { __VA_ARGS__ }) + ACTION_CHECK(sizeof((uint8_t[]) { __VA_ARGS__ }) >= 2 && \
+                                                       sizeof((uint8_t[]) { __VA_ARGS__ }) <= COMBO_MAX_KEYS), \
+    { __VA_ARGS__ } }
+
+#ifndef COMBO_TERM_MS
+#define COMBO_TERM_MS 40
+#endif
+
+struct key_event;
+
+void combo_init(void);
+void combo_process(const struct key_event *change);
+
+// Let held keys through once the combo term has run out
+void combo_task(uint32_t now_us);
+
+#endif /* COMBO_H_ */
@@ -1,57 +1,208 @@
-#define CFG_TUSB_OS OPT_OS_PICO
-#include "bsp/board.h"
-#include "pico/stdlib.h"
-#include "tusb.h"
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
 #include "usb_hid_keys.h"
 #include "macro.h"
+#include "action.h"
+#include "combo.h"
 
-#define REPORT_ID_KEYBOARD 1
 #define MAX_COINCIDENT_KEYS 6
 
 #define N_ROWS 5
 #define N_COLS 14
+#define N_KEYS (N_ROWS * N_COLS)
+
+// Matrix position of a key, column-major (see matrix.h)
+#define KEY_INDEX(col, row) ((col) * N_ROWS + (row))
+#define KEY_COL(key) ((key) / N_ROWS)
+#define KEY_ROW(key) ((key) % N_ROWS)
 
 #define FN1_ROW 4
 #define FN1_COL 2
 
-const uint32_t LED_PIN = PICO_DEFAULT_LED_PIN;
+// Low-latency mode scans the matrix every 1 ms on a microsecond timer
+// and asks the host to poll the HID endpoint every 1 ms. Otherwise the
+// original 10 ms scan and 5 ms endpoint interval are used.
+#ifndef LOW_LATENCY_MODE
+#define LOW_LATENCY_MODE 1
+#endif
+
+#if LOW_LATENCY_MODE
+#define SCAN_INTERVAL_US   1000
+#define HID_EP_INTERVAL_MS 1
+#else
+#define SCAN_INTERVAL_US   10000
+#define HID_EP_INTERVAL_MS 5
+#endif
+
+// Polling interval of the raw HID (configuration and telemetry)
+// endpoints, which have their own pipe and never hold up the keyboard
+#define RAW_HID_EP_INTERVAL_MS 4
+
+// Run scanning, debouncing and key resolution on core1 and leave
+// core0 to TinyUSB and the HID reports
+#ifndef DUAL_CORE
+#define DUAL_CORE 1
+#endif
+
+// Scan the matrix with a PIO state machine and DMA instead of the CPU
+#ifndef MATRIX_SCAN_PIO
+#define MATRIX_SCAN_PIO 0
+#endif
+
+// Hold back keys that could be ghosts, for a matrix without diodes or
+// with a failed one. With working diodes there are none, and blocking
+// would only cost rollover.
+#ifndef MATRIX_GHOST_FILTER
+#define MATRIX_GHOST_FILTER 0
+#endif
+
+// Stop scanning once no key has been down for this long and wait for a
+// row pin to rise instead; 0 scans all the time
+#ifndef IDLE_LINGER_MS
+#define IDLE_LINGER_MS 2000
+#endif
+
+#define LED_PIN PICO_DEFAULT_LED_PIN
 
 // Set to unused pin
-const uint32_t NUMLOCK_LED_PIN = 23;
+#define NUMLOCK_LED_PIN 23
 
 typedef uint8_t scancode_t;
 
-uint8_t keybuffer[MAX_COINCIDENT_KEYS] = {0};
-uint8_t modifiers = 0;
+// Matrix wiring, listed as X-macros so pin tables and masks can be
+// derived at compile time (see matrix.h)
+#define CONFIG_ROW_PINS(X)    X(18) X(17) X(16) X(14) X(15)
+#define CONFIG_COLUMN_PINS(X) X(4) X(5) X(6) X(7) X(8) X(9) X(10) X(11) X(12) X(13) X(22) X(21) X(20) X(19)
+
+#define CONFIG_PIN_ENTRY(pin) pin,
+static const int config_row_map[N_ROWS] = { CONFIG_ROW_PINS(CONFIG_PIN_ENTRY) };
+static const int config_column_map[N_COLS] = { CONFIG_COLUMN_PINS(CONFIG_PIN_ENTRY) };
 
-int config_row_map[N_ROWS] = {18, 17, 16, 14, 15};
-int config_column_map[N_COLS] = {4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 22, 21, 20, 19};
+// Physical layout in rows, as wired, to the column-major action table
+#define LAYOUT( \
+    k00, k01, k02, k03, k04, k05, k06, k07, k08, k09, k0a, k0b, k0c, k0d, \
+    k10, k11, k12, k13, k14, k15, k16, k17, k18, k19, k1a, k1b, k1c, k1d, \
+    k20, k21, k22, k23, k24, k25, k26, k27, k28, k29, k2a, k2b, k2c, k2d, \
+    k30, k31, k32, k33, k34, k35, k36, k37, k38, k39, k3a, k3b, k3c, k3d, \
+    k40, k41, k42, k43, k44, k45, k46, k47, k48, k49, k4a, k4b, k4c, k4d \
+) { \
+    ACTION_AUTO(k00), ACTION_AUTO(k10), ACTION_AUTO(k20), ACTION_AUTO(k30), ACTION_AUTO(k40), \
+    ACTION_AUTO(k01), ACTION_AUTO(k11), ACTION_AUTO(k21), ACTION_AUTO(k31), ACTION_AUTO(k41), \
+    ACTION_AUTO(k02), ACTION_AUTO(k12), ACTION_AUTO(k22), ACTION_AUTO(k32), ACTION_AUTO(k42), \
+    ACTION_AUTO(k03), ACTION_AUTO(k13), ACTION_AUTO(k23), ACTION_AUTO(k33), ACTION_AUTO(k43), \
+    ACTION_AUTO(k04), ACTION_AUTO(k14), ACTION_AUTO(k24), ACTION_AUTO(k34), ACTION_AUTO(k44), \
+    ACTION_AUTO(k05), ACTION_AUTO(k15), ACTION_AUTO(k25), ACTION_AUTO(k35), ACTION_AUTO(k45), \
+    ACTION_AUTO(k06), ACTION_AUTO(k16), ACTION_AUTO(k26), ACTION_AUTO(k36), ACTION_AUTO(k46), \
+    ACTION_AUTO(k07), ACTION_AUTO(k17), ACTION_AUTO(k27), ACTION_AUTO(k37), ACTION_AUTO(k47), \
+    ACTION_AUTO(k08), ACTION_AUTO(k18), ACTION_AUTO(k28), ACTION_AUTO(k38), ACTION_AUTO(k48), \
+    ACTION_AUTO(k09), ACTION_AUTO(k19), ACTION_AUTO(k29), ACTION_AUTO(k39), ACTION_AUTO(k49), \
+    ACTION_AUTO(k0a), ACTION_AUTO(k1a), ACTION_AUTO(k2a), ACTION_AUTO(k3a), ACTION_AUTO(k4a), \
+    ACTION_AUTO(k0b), ACTION_AUTO(k1b), ACTION_AUTO(k2b), ACTION_AUTO(k3b), ACTION_AUTO(k4b), \
+    ACTION_AUTO(k0c), ACTION_AUTO(k1c), ACTION_AUTO(k2c), ACTION_AUTO(k3c), ACTION_AUTO(k4c), \
+    ACTION_AUTO(k0d), ACTION_AUTO(k1d), ACTION_AUTO(k2d), ACTION_AUTO(k3d), ACTION_AUTO(k4d) \
+}
 
-struct macro macros[] = {
-    { .len = 2, .keycodes = { KEY_LEFTCTRL, KEY_C } }
+static const char *const macro_text[] = {
+    "The quick brown fox jumps over the lazy dog.\n",
 };
 
-static signed int macromap[N_ROWS][N_COLS] = {
-    { MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE },
-    { MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE },
-    { MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE },
-    { MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE },
-    { MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE, MACRO_NONE }
+// Most new characters a text macro presses in one report. Only runs of
+// ascending usages share a report; 1 types one character per report.
+#ifndef MACRO_TEXT_KEYS_PER_REPORT
+#define MACRO_TEXT_KEYS_PER_REPORT MAX_COINCIDENT_KEYS
+#endif
+
+#define N_MACRO_TEXT (sizeof(macro_text) / sizeof(macro_text[0]))
+
+static const uint8_t *const macros[] = {
+    MACRO_CODE(M_DOWN(KEY_LEFTCTRL), M_TAP(KEY_C), M_UP(KEY_LEFTCTRL)),
+    MACRO_CODE(M_TEXT(0)),
 };
 
-static unsigned char keymap[N_ROWS][N_COLS] = {
-    { KEY_1,         KEY_2,        KEY_3,    KEY_4,    KEY_5,       KEY_6,    KEY_7,    KEY_8,     KEY_9,    KEY_0,     KEY_MINUS,     KEY_EQUAL,      KEY_RIGHTCTRL,  KEY_BACKSPACE },
-    { KEY_GRAVE,     KEY_Q,        KEY_W,    KEY_E,    KEY_R,       KEY_T,    KEY_Y,    KEY_U,     KEY_I,    KEY_O,     KEY_P,         KEY_LEFTBRACE,  KEY_RIGHTBRACE, KEY_BACKSLASH },
-    { KEY_TAB,       KEY_A,        KEY_S,    KEY_D,    KEY_F,       KEY_G,    KEY_H,    KEY_J,     KEY_K,    KEY_L,     KEY_SEMICOLON, KEY_APOSTROPHE, KEY_NONE,       KEY_ENTER },
-    { KEY_ESC,       KEY_NONE,     KEY_Z,    KEY_X,    KEY_C,       KEY_V,    KEY_B,    KEY_N,     KEY_M,    KEY_COMMA, KEY_DOT,       KEY_SLASH,      KEY_RIGHTSHIFT, KEY_RIGHTMETA },
-    { KEY_LEFTSHIFT, KEY_LEFTCTRL, KEY_NONE, KEY_NONE, KEY_RIGHTALT, KEY_NONE, KEY_NONE, KEY_SPACE, KEY_NONE, KEY_NONE,  KEY_NONE,      KEY_LEFTALT,   KEY_RIGHTCTRL,  KEY_NONE }
-                                   /* fn key */
+#define N_MACROS (sizeof(macros) / sizeof(macros[0]))
+
+// The last layer is not reachable from the layout below. It holds
+// examples of the other kinds of action, for the host benches and to
+// copy from; MO(LAYER_EXAMPLES) or TG(LAYER_EXAMPLES) somewhere in the
+// layout turns it on.
+#define LAYER_EXAMPLES 2
+#define N_LAYERS 3
+
+// The example combos hold back every press of their keys for up to
+// COMBO_TERM_MS, which home-row typing should not pay for; they are
+// left out of the firmware and built into the host benches
+#ifndef EXAMPLE_COMBOS
+#define EXAMPLE_COMBOS 0
+#endif
+
+// Sorted by first key at startup, so the order here does not matter
+static const struct combo combos[] = {
+#if EXAMPLE_COMBOS
+    // J+K
+    COMBO(KEY_ESC, 0, KEY_INDEX(7, 2), KEY_INDEX(8, 2)),
+#endif
+    // Fn + backtick + backspace, held; holds nothing back
+    COMBO(BOOTLOADER, COMBO_HELD, KEY_INDEX(FN1_COL, FN1_ROW), KEY_INDEX(0, 1), KEY_INDEX(13, 0)),
 };
 
-static unsigned char layer1[N_ROWS][N_COLS] = {
-    { KEY_F1,        KEY_F2,              KEY_F3,   KEY_F4,       KEY_F5,       KEY_F6,   KEY_F7,   KEY_F8,     KEY_F9,   KEY_F10,   KEY_F11,       KEY_F12,        KEY_DELETE,     KEY_HOME },
-    { KEY_GRAVE,     KEY_Q,               KEY_W,    KEY_E,        KEY_R,        KEY_T,    KEY_Y,    KEY_PAGEUP, KEY_I,    KEY_O,     KEY_P,         KEY_LEFTBRACE,  KEY_RIGHTBRACE, KEY_END },
-    { KEY_TAB,       KEY_A,               KEY_S,    KEY_PAGEDOWN, KEY_F,        KEY_G,    KEY_LEFT, KEY_DOWN,   KEY_UP,   KEY_RIGHT, KEY_SEMICOLON, KEY_APOSTROPHE, KEY_NONE,       KEY_ENTER },
-    { KEY_ESC,       KEY_NONE,            KEY_Z,    KEY_X,        KEY_C,        KEY_V,    KEY_B,    KEY_N,      KEY_M,    KEY_COMMA, KEY_DOT,       KEY_SLASH,      KEY_RIGHTSHIFT, KEY_LEFTMETA },
-    { KEY_LEFTSHIFT, KEY_LEFTCTRL, /*fn*/ KEY_NONE, KEY_NONE,     KEY_RIGHTALT, KEY_NONE, KEY_NONE, KEY_SPACE,  KEY_NONE, KEY_NONE,  KEY_NONE,      KEY_LEFTALT,    KEY_RIGHTCTRL,  KEY_NONE }
+// Leader-key sequences: X(action, usages...). Compiled into a trie by
+// tools/leader_trie.py at build time; no sequence may be a prefix of
+// another.
+#define CONFIG_LEADER_SEQUENCES(X) \
+    X(BOOTLOADER, KEY_B, KEY_O, KEY_O, KEY_T) \
+    X(MACRO(0), KEY_C) \
+    X(MACRO(1), KEY_Q, KEY_B)
+
+// Example mod-tap: Esc on tap, left Ctrl on hold
+#define CTL_ESC MT(KEY_MOD_LCTRL, KEY_ESC)
+
+// Example media keys and mouse keys; the pointer moves on Z X C V the
+// way the arrows do on H J K L
+#define MD_MUTE CONSUMER(CONSUMER_MUTE)
+#define VOL_DN  CONSUMER(CONSUMER_VOLUME_DOWN)
+#define VOL_UP  CONSUMER(CONSUMER_VOLUME_UP)
+#define MD_PREV CONSUMER(CONSUMER_SCAN_PREV)
+#define MD_PLAY CONSUMER(CONSUMER_PLAY_PAUSE)
+#define MD_NEXT CONSUMER(CONSUMER_SCAN_NEXT)
+#define MS_L    MOUSE(MS_LEFT)
+#define MS_D    MOUSE(MS_DOWN)
+#define MS_U    MOUSE(MS_UP)
+#define MS_R    MOUSE(MS_RIGHT)
+#define MS_B1   MOUSE(MS_BTN1)
+#define MS_B2   MOUSE(MS_BTN2)
+#define MS_B3   MOUSE(MS_BTN3)
+#define MS_WD   MOUSE(MS_WH_DOWN)
+#define MS_WU   MOUSE(MS_WH_UP)
+
+// Compiled into one const, flash-resident table of 16-bit actions
+// indexed by [layer][key]. A wrong number of entries, an out-of-range
+// macro or layer, or a usage past NKRO_USAGE_MAX fails the build.
+static const action_t action_table[N_LAYERS][N_KEYS] = {
+    [0] = LAYOUT(
+        KEY_1,         KEY_2,        KEY_3,    KEY_4,    KEY_5,       KEY_6,    KEY_7,    KEY_8,     KEY_9,    KEY_0,     KEY_MINUS,     KEY_EQUAL,      KEY_RIGHTCTRL,  KEY_BACKSPACE,
+        KEY_GRAVE,     KEY_Q,        KEY_W,    KEY_E,    KEY_R,       KEY_T,    KEY_Y,    KEY_U,     KEY_I,    KEY_O,     KEY_P,         KEY_LEFTBRACE,  KEY_RIGHTBRACE, KEY_BACKSLASH,
+        KEY_TAB,       KEY_A,        KEY_S,    KEY_D,    KEY_F,       KEY_G,    KEY_H,    KEY_J,     KEY_K,    KEY_L,     KEY_SEMICOLON, KEY_APOSTROPHE, KEY_NONE,       KEY_ENTER,
+        KEY_ESC,       KEY_NONE,     KEY_Z,    KEY_X,    KEY_C,       KEY_V,    KEY_B,    KEY_N,     KEY_M,    KEY_COMMA, KEY_DOT,       KEY_SLASH,      KEY_RIGHTSHIFT, KEY_RIGHTMETA,
+        KEY_LEFTSHIFT, KEY_LEFTCTRL, MO(1),    KEY_NONE, KEY_RIGHTALT, KEY_NONE, KEY_NONE, KEY_SPACE, KEY_NONE, KEY_NONE,  KEY_NONE,      KEY_LEFTALT,    KEY_RIGHTCTRL,  KEY_NONE
+                                  /* fn key */
+    ),
+    [1] = LAYOUT(
+        KEY_F1,  KEY_F2,    KEY_F3,  KEY_F4,        KEY_F5,  KEY_F6,    KEY_F7,    KEY_F8,      KEY_F9,    KEY_F10,    KEY_F11,   KEY_F12,  KEY_DELETE,  KEY_HOME,
+        TRNS,    TRNS,      TRNS,    TRNS,          TRNS,    TRNS,      TRNS,      KEY_PAGEUP,  TRNS,      TRNS,       TRNS,      TRNS,     TRNS,        KEY_END,
+        TRNS,    TRNS,      TRNS,    KEY_PAGEDOWN,  TRNS,    TRNS,      KEY_LEFT,  KEY_DOWN,    KEY_UP,    KEY_RIGHT,  TRNS,      TRNS,     KEY_NONE,    TRNS,
+        TRNS,    KEY_NONE,  TRNS,    TRNS,          TRNS,    TRNS,      TRNS,      TRNS,        TRNS,      TRNS,       TRNS,      TRNS,     TRNS,        KEY_LEFTMETA,
+        TRNS,    TRNS,      TRNS,    KEY_NONE,      TRNS,    KEY_NONE,  KEY_NONE,  TRNS,        KEY_NONE,  KEY_NONE,   KEY_NONE,  TRNS,     TRNS,        KEY_NONE
+    ),
+    [LAYER_EXAMPLES] = LAYOUT(
+        TRNS,    TRNS,      TRNS,    TRNS,          TRNS,    TRNS,      TRNS,      TRNS,        TRNS,      TRNS,       TRNS,      TRNS,     TRNS,        TRNS,
+        TRNS,    TRNS,      MD_MUTE, VOL_DN,        VOL_UP,  MD_PREV,   MD_PLAY,   TRNS,        MD_NEXT,   TRNS,       TRNS,      TRNS,     TRNS,        TRNS,
+        LEADER,  TRNS,      TRNS,    TRNS,          TRNS,    TRNS,      TRNS,      TRNS,        TRNS,      TRNS,       TRNS,      TRNS,     TRNS,        TRNS,
+        CTL_ESC, TRNS,      MS_L,    MS_D,          MS_U,    MS_R,      MS_B1,     MS_B2,       MS_B3,     MS_WD,      MS_WU,     TRNS,     TRNS,        TRNS,
+        TRNS,    TRNS,      TRNS,    TRNS,          TRNS,    TRNS,      TRNS,      TRNS,        TRNS,      TRNS,       TRNS,      TRNS,     TRNS,        TRNS
+    ),
 };
+
+#endif /* CONFIG_H_ */
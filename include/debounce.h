@@ -0,0 +1,33 @@
+#ifndef DEBOUNCE_H_
+#define DEBOUNCE_H_
+
+#include "matrix.h"
+
+// Debounce algorithms. All of them keep a 2-bit vertical counter per key
+// (two bit-planes shaped like the matrix) plus the debounced state, and
+// update every key of a word at once with plain bitwise logic.
+//
+// DEBOUNCE_DEFER      a change is accepted after 4 consecutive differing
+//                     samples, in both directions
+// DEBOUNCE_EAGER      presses are accepted on the first sample, releases
+//                     after 4 consecutive released samples
+// DEBOUNCE_INTEGRATOR a saturating 0..3 counter follows the raw input;
+//                     the key goes down at 3 and up again at 0
+typedef enum {
+    DEBOUNCE_NONE,
+    DEBOUNCE_DEFER,
+    DEBOUNCE_EAGER,
+    DEBOUNCE_INTEGRATOR,
+    DEBOUNCE_COUNT
+} debounce_algorithm_t;
+
+#ifndef DEBOUNCE_ALGORITHM
+#define DEBOUNCE_ALGORITHM DEBOUNCE_EAGER
+#endif
+
+void debounce_init(debounce_algorithm_t algorithm);
+void debounce_update(const matrix_t *raw, matrix_t *stable);
+
+const char *debounce_algorithm_name(debounce_algorithm_t algorithm);
+
+#endif /* DEBOUNCE_H_ */
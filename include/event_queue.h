@@ -0,0 +1,40 @@
+#ifndef EVENT_QUEUE_H_
+#define EVENT_QUEUE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Single-producer/single-consumer ring carrying resolved key events
+// from the scan side (core1) to the report side (core0). Push and pop
+// never block: a full queue drops the event and counts it.
+
+#define EVENT_QUEUE_SIZE 64
+
+// What an event asks the report side to do
+#define KEY_EVENT_USAGE    0    // press or release usage
+#define KEY_EVENT_MACRO    1    // start macro number usage when pressed
+#define KEY_EVENT_CONSUMER 2    // press or release consumer page usage
+#define KEY_EVENT_MOUSE    3    // press or release mouse key MS_*
+
+struct key_event {
+    uint32_t sample_us; // first raw sample showing the change
+    uint32_t time_us;   // scan in which debounce accepted the change
+    uint16_t usage;
+    uint8_t key;        // matrix index
+    uint8_t pressed;
+    uint8_t kind;
+};
+
+struct event_queue_stats {
+    uint32_t pushed;
+    uint32_t dropped;
+    uint32_t depth_max;
+};
+
+bool event_queue_push(const struct key_event *event);
+bool event_queue_pop(struct key_event *event);
+bool event_queue_peek(struct key_event *event);
+uint32_t event_queue_depth(void);
+const struct event_queue_stats *event_queue_stats(void);
+
+#endif /* EVENT_QUEUE_H_ */
@@ -0,0 +1,92 @@
+#ifndef HAL_H_
+#define HAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Thin hardware layer used by the scan/report pipeline. The RP2040
+// backend lives in src/rp2040/hal.c, the simulated host backend in
+// src/host/hal.c.
+
+//--------------------------------------------------------------------+
+// Matrix I/O
+//--------------------------------------------------------------------+
+void hal_matrix_init(const int *columns, int n_cols, const int *rows, int n_rows);
+void hal_gpio_put(int pin, bool value);
+bool hal_gpio_get(int pin);
+void hal_gpio_set_mask(uint32_t mask);
+void hal_gpio_clr_mask(uint32_t mask);
+uint32_t hal_gpio_get_all(void);
+
+// Latch a rising edge on any of the given pins (the rows, while every
+// column is driven) until disarmed; a pin already high when armed
+// counts as fired
+void hal_row_wake_arm(uint32_t mask);
+void hal_row_wake_disarm(void);
+bool hal_row_wake_fired(void);
+
+//--------------------------------------------------------------------+
+// Clock
+//--------------------------------------------------------------------+
+uint64_t hal_time_us(void);
+void hal_sleep_us(uint32_t us);
+
+// Core the caller runs on, 0 or 1
+int hal_core_num(void);
+
+// Sleep until time_us (UINT64_MAX: no limit), an interrupt, or the
+// other core calling hal_wake_other_core(). An interrupt or wake that
+// came after the caller last looked makes it return at once.
+void hal_wait_until(uint64_t time_us);
+void hal_wake_other_core(void);
+
+//--------------------------------------------------------------------+
+// HID sink
+//--------------------------------------------------------------------+
+bool hal_hid_ready(void);
+bool hal_hid_boot_protocol(void);
+bool hal_hid_report(uint8_t report_id, const void *report, uint16_t len);
+bool hal_hid_keyboard_report(uint8_t report_id, uint8_t modifiers, const uint8_t keycodes[6]);
+
+void hal_reset_bootloader(void);
+
+//--------------------------------------------------------------------+
+// Trace output
+//--------------------------------------------------------------------+
+// Queue up to len bytes on the debug UART without waiting; returns how
+// many were taken
+int hal_trace_write(const uint8_t *data, int len);
+
+//--------------------------------------------------------------------+
+// Raw HID sink
+//--------------------------------------------------------------------+
+// IN endpoint of the vendor interface, separate from the keyboard's
+bool hal_raw_hid_ready(void);
+bool hal_raw_hid_report(const void *report, uint16_t len);
+
+//--------------------------------------------------------------------+
+// Indicator LEDs
+//--------------------------------------------------------------------+
+// One PWM output per pin. A level holds until changed; a waveform is
+// played in a loop, one duty value every LED_STEP_MS, and must stay in
+// place until the next call for that LED.
+void hal_led_init(const int *pins, int n);
+void hal_led_level(int led, uint16_t duty);
+void hal_led_waveform(int led, const uint16_t *duty, int len);
+
+//--------------------------------------------------------------------+
+// Persistent storage
+//--------------------------------------------------------------------+
+// A reserved flash region, readable in place through the returned
+// pointer. Erase works on whole sectors and sets bytes to 0xff;
+// programming works on whole pages and can only clear bits.
+#define HAL_FLASH_SECTOR_SIZE 4096
+#define HAL_FLASH_PAGE_SIZE   256
+#define HAL_FLASH_SECTORS     8
+#define HAL_FLASH_REGION_SIZE (HAL_FLASH_SECTORS * HAL_FLASH_SECTOR_SIZE)
+
+const uint8_t *hal_flash_region(void);
+void hal_flash_erase(uint32_t offset);
+void hal_flash_program(uint32_t offset, const void *data, uint32_t len);
+
+#endif /* HAL_H_ */
@@ -0,0 +1,35 @@
+#ifndef KEYBOARD_H_
+#define KEYBOARD_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "matrix.h"
+
+// Time taken by scan + debounce + key resolution, against the
+// SCAN_INTERVAL_US budget
+struct scan_stats {
+    uint32_t scans;
+    uint32_t last_us;
+    uint32_t max_us;
+    uint32_t overruns;
+    uint32_t wakes;     // idle periods ended by a row edge
+    uint32_t ghosted;   // scans that held back possible ghosts
+    uint32_t done_us;   // when the latest scan finished
+};
+
+int poll_columns(void);
+
+void keypins_init(void);
+// Returns when it next needs to run, for the scheduler
+uint64_t scan_task(void);
+const struct scan_stats *keyboard_scan_stats(void);
+
+// True while scanning is stopped waiting for a key (IDLE_LINGER_MS)
+bool keyboard_idle(void);
+
+// Consistent copy of the debounced matrix, safe to take from the other
+// core while scan_task() runs
+void keyboard_matrix(matrix_t *keys);
+
+#endif /* KEYBOARD_H_ */
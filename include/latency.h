@@ -0,0 +1,55 @@
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include <stdint.h>
+
+// Input latency histograms, kept on core0 and served as a HID feature
+// report. Each stage is a fixed set of log2 buckets: bucket 0 counts
+// 0..1 us, bucket i counts [2^i, 2^(i+1)) us and the last bucket also
+// takes everything above.
+//
+//   LATENCY_DEBOUNCE  first raw sample of the change -> debounce accepted it
+//   LATENCY_QUEUE     debounce accepted -> report handed to the endpoint
+//   LATENCY_USB       report handed to the endpoint -> report complete
+//   LATENCY_TOTAL     first raw sample -> report complete
+enum latency_stage {
+    LATENCY_DEBOUNCE,
+    LATENCY_QUEUE,
+    LATENCY_USB,
+    LATENCY_TOTAL,
+    LATENCY_STAGES
+};
+
+#define LATENCY_BUCKETS 16
+
+// Feature report REPORT_ID_LATENCY on the keyboard interface, both ways
+// LATENCY_REPORT_LEN bytes after the report ID (little-endian):
+//
+//   SET_REPORT  [report ID] [stage] [command] [zero padding]
+//               selects the stage the next GET_REPORT returns; command
+//               LATENCY_CMD_RESET also clears every histogram
+//   GET_REPORT  [report ID] struct latency_report
+//
+// The report ID is taken off before latency_set_report() sees the
+// data, and latency_get_report() fills in the payload only.
+struct latency_report {
+    uint8_t stage;
+    uint8_t n_stages;
+    uint8_t n_buckets;
+    uint8_t reserved;
+    uint32_t samples;
+    uint32_t max_us;
+    uint16_t buckets[LATENCY_BUCKETS];
+} __attribute__((packed));
+
+#define LATENCY_REPORT_LEN sizeof(struct latency_report)
+#define LATENCY_CMD_RESET  1
+
+void latency_record(enum latency_stage stage, uint32_t us);
+void latency_reset(void);
+void latency_summary(enum latency_stage stage, uint32_t *samples, uint32_t *max_us);
+
+uint16_t latency_get_report(uint8_t *buffer, uint16_t reqlen);
+void latency_set_report(const uint8_t *buffer, uint16_t bufsize);
+
+#endif /* LATENCY_H_ */
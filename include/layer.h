@@ -0,0 +1,30 @@
+#ifndef LAYER_H_
+#define LAYER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+// Layer stack. Active layers are a bitmask with layer 0 always on; the
+// highest active non-transparent layer is cached per key and refreshed
+// only when the mask changes, so a lookup is one load however many
+// layers are defined.
+
+_Static_assert(N_LAYERS >= 1 && N_LAYERS <= 32, "N_LAYERS must be 1..32");
+
+void layer_init(void);
+
+action_t layer_action(int key);
+
+void layer_on(int layer);
+void layer_off(int layer);
+void layer_toggle(int layer);
+uint32_t layer_state(void);
+
+// A one-shot layer stays on until the next non-layer key press has
+// been resolved through it
+void layer_oneshot(int layer);
+void layer_oneshot_consume(void);
+
+#endif /* LAYER_H_ */
@@ -0,0 +1,26 @@
+#ifndef LEADER_H_
+#define LEADER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "action.h"
+
+// Leader-key sequences. After a LEADER action, key presses are matched
+// one usage at a time against a trie generated from
+// CONFIG_LEADER_SEQUENCES; the action of a complete sequence runs as a
+// tap. A key that does not continue any sequence, or a pause longer
+// than LEADER_TIMEOUT_MS, ends the sequence with nothing sent.
+
+#ifndef LEADER_TIMEOUT_MS
+#define LEADER_TIMEOUT_MS 1000
+#endif
+
+struct key_event;
+
+void leader_start(const struct key_event *change);
+bool leader_active(void);
+void leader_feed(const struct key_event *change, uint8_t usage);
+void leader_task(uint32_t now_us);
+
+#endif /* LEADER_H_ */
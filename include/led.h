@@ -0,0 +1,46 @@
+#ifndef LED_H_
+#define LED_H_
+
+#include <stdint.h>
+
+// Indicator LEDs on hardware PWM. A steady level is one compare
+// register write; blink and breathe patterns are rendered once into a
+// waveform table that the hardware plays on a loop, one entry every
+// LED_STEP_MS, so no LED work happens in the main loop at all.
+
+enum led {
+    LED_STATUS,
+    LED_NUMLOCK,
+    LED_COUNT
+};
+
+enum led_pattern {
+    LED_OFF,
+    LED_ON,
+    LED_BLINK,      // on for half the period, off for the other half
+    LED_BREATHE,    // fade up and back down once per period
+};
+
+#define LED_STEP_MS 10
+
+// Longest period a pattern can have
+#define LED_WAVEFORM_MAX 512
+#define LED_PERIOD_MAX_MS (LED_WAVEFORM_MAX * LED_STEP_MS)
+
+// Brightness is perceptual, 0..255, and mapped to duty through a
+// square-law gamma curve
+#ifndef LED_NUMLOCK_BRIGHTNESS
+#define LED_NUMLOCK_BRIGHTNESS 80
+#endif
+
+// Pins in enum led order
+void led_init(const int pins[LED_COUNT]);
+
+// Patterns restart from their beginning; setting the pattern already
+// showing changes nothing, so callers need not track it
+void led_set(enum led led, enum led_pattern pattern, uint8_t brightness, uint32_t period_ms);
+
+// Duty cycle for a brightness, 0..0xffff
+uint16_t led_duty(uint8_t brightness);
+
+#endif /* LED_H_ */
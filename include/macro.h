@@ -1,11 +1,60 @@
-struct macro {
-    int len;
-    unsigned char keycodes[6];
-};
-
-enum MACRO {
-    MACRO_NONE = -1,
-    MACRO_SLOT0 = 0,
-    MACRO_SLOT1,
-    MACRO_SLOT2
-};
+#ifndef MACRO_H_
+#define MACRO_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "action.h"
+
+// Macros are byte-code step sequences kept in flash. Each step is an
+// opcode followed by its argument bytes:
+//
+//   MACRO_OP_END             end of macro; anything still held is released
+//   MACRO_OP_DOWN  usage     press a usage and hold it
+//   MACRO_OP_UP    usage     release a usage pressed with DOWN
+//   MACRO_OP_TAP   usage     press, then release in the next report
+//   MACRO_OP_DELAY lo hi     wait for a 16-bit number of milliseconds
+//   MACRO_OP_TEXT  n         type macro_text[n] on a US layout, several
+//                            characters per report where order allows
+//   MACRO_OP_STR   chars 0   type the inline NUL-terminated string the
+//                            same way (for macros stored at runtime)
+//
+// The sequencer runs on the report side and changes the report by at
+// most one step per report sent, so every step reaches the host.
+#define MACRO_OP_END   0x00
+#define MACRO_OP_DOWN  0x01
+#define MACRO_OP_UP    0x02
+#define MACRO_OP_TAP   0x03
+#define MACRO_OP_DELAY 0x04
+#define MACRO_OP_TEXT  0x05
+#define MACRO_OP_STR   0x06
+
+#define MACRO_USAGE(usage) ((usage) + ACTION_CHECK((usage) <= NKRO_USAGE_MAX))
+
+#define M_DOWN(usage) MACRO_OP_DOWN, MACRO_USAGE(usage)
+#define M_UP(usage)   MACRO_OP_UP, MACRO_USAGE(usage)
+#define M_TAP(usage)  MACRO_OP_TAP, MACRO_USAGE(usage)
+#define M_DELAY(ms)   MACRO_OP_DELAY, ((ms) & 0xff), (((ms) >> 8) + ACTION_CHECK((ms) <= 0xffff))
+#define M_TEXT(n)     MACRO_OP_TEXT, ((n) + ACTION_CHECK((n) < N_MACRO_TEXT))
+
+// A macro is a static, flash-resident byte array ending in MACRO_OP_END
+#define MACRO_CODE(...) ((const uint8_t[]) { __VA_ARGS__, MACRO_OP_END })
+
+// Start macro index (see store_macro()) once the running macro, if
+// any, has finished
+void macro_start(int index);
+
+// Advance the running macro by one report-visible step, or not at all
+// while it waits on a delay. Returns true if the report changed.
+bool macro_task(uint32_t now_us);
+
+bool macro_busy(void);
+
+// Time left in the delay the running macro is in, 0 if none
+uint32_t macro_wait_us(uint32_t now_us);
+
+// Size in bytes of a macro's byte code, including MACRO_OP_END, or -1
+// if it does not end within max bytes
+int macro_code_length(const uint8_t *code, int max);
+
+#endif /* MACRO_H_ */
@@ -0,0 +1,150 @@
+#ifndef MATRIX_H_
+#define MATRIX_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+// Packed key matrix: one bit per switch, column-major so that a column
+// strobe lands as a contiguous N_ROWS-bit field.
+#define MATRIX_WORDS ((N_KEYS + 31) / 32)
+
+#define ROW_FIELD_MASK ((1u << N_ROWS) - 1)
+
+typedef struct {
+    uint32_t w[MATRIX_WORDS];
+} matrix_t;
+
+// Compile-time pin masks
+#define MATRIX_PIN_BIT(pin) (1u << (pin)) |
+#define MATRIX_ROW_MASK    (CONFIG_ROW_PINS(MATRIX_PIN_BIT) 0u)
+#define MATRIX_COLUMN_MASK (CONFIG_COLUMN_PINS(MATRIX_PIN_BIT) 0u)
+
+// Drive bit for each column, in column order
+extern const uint32_t matrix_column_bits[N_COLS];
+
+// Gather the row pins out of a full GPIO sample into an N_ROWS-bit
+// field. The shift amounts come from a const table, so with the loop
+// unrolled this is a fixed sequence of shift/and/or with no branches.
+static inline uint32_t
+matrix_rows_gather(uint32_t gpio)
+{
+    uint32_t rows = 0;
+    for (int row = 0; row < N_ROWS; ++row)
+        rows |= ((gpio >> config_row_map[row]) & 1u) << row;
+    return rows;
+}
+
+static inline bool
+matrix_key(const matrix_t *m, int key)
+{
+    return (m->w[key >> 5] >> (key & 31)) & 1;
+}
+
+static inline void
+matrix_set_key(matrix_t *m, int key)
+{
+    m->w[key >> 5] |= 1u << (key & 31);
+}
+
+static inline void
+matrix_clear_key(matrix_t *m, int key)
+{
+    m->w[key >> 5] &= ~(1u << (key & 31));
+}
+
+// True if every key set in a is also set in b
+static inline bool
+matrix_subset(const matrix_t *a, const matrix_t *b)
+{
+    uint32_t outside = 0;
+    for (int i = 0; i < MATRIX_WORDS; ++i)
+        outside |= a->w[i] & ~b->w[i];
+    return outside == 0;
+}
+
+// OR an N_ROWS-bit row field into the given column; the field may
+// straddle a word boundary
+static inline void
+matrix_set_column(matrix_t *m, int col, uint32_t rows)
+{
+    int bit = col * N_ROWS;
+    int word = bit >> 5;
+    int shift = bit & 31;
+
+    m->w[word] |= rows << shift;
+    if (shift + N_ROWS > 32)
+        m->w[word + 1] |= rows >> (32 - shift);
+}
+
+// XOR an N_ROWS-bit row field into the given column
+static inline void
+matrix_flip_column(matrix_t *m, int col, uint32_t rows)
+{
+    int bit = col * N_ROWS;
+    int word = bit >> 5;
+    int shift = bit & 31;
+
+    m->w[word] ^= rows << shift;
+    if (shift + N_ROWS > 32)
+        m->w[word + 1] ^= rows >> (32 - shift);
+}
+
+static inline uint32_t
+matrix_column(const matrix_t *m, int col)
+{
+    int bit = col * N_ROWS;
+    int word = bit >> 5;
+    int shift = bit & 31;
+    uint32_t rows = m->w[word] >> shift;
+
+    if (shift + N_ROWS > 32)
+        rows |= m->w[word + 1] << (32 - shift);
+    return rows & ROW_FIELD_MASK;
+}
+
+static inline bool
+matrix_empty(const matrix_t *m)
+{
+    uint32_t any = 0;
+    for (int i = 0; i < MATRIX_WORDS; ++i)
+        any |= m->w[i];
+    return any == 0;
+}
+
+void matrix_init(void);
+void matrix_scan(matrix_t *m);
+
+// Settle delays after driving and after releasing each column. They
+// start at the safe default and are calibrated at boot and from time to
+// time during scans, on columns with a key down, and only ever rise
+// from the first measurement. Stored delays count as a measurement; 0
+// means none. Not used by the PIO scanner.
+struct matrix_settle {
+    uint8_t drive_us[N_COLS];
+    uint8_t release_us[N_COLS];
+    uint32_t calibrated;        // bit per column
+    uint32_t calibrations;      // scans that sampled instead of waiting
+    uint32_t default_scan_us;   // one scan with the default delays, at boot
+    uint32_t scan_us;           // latest scan that did not calibrate
+};
+
+void matrix_settle_load(const uint8_t drive_us[N_COLS], const uint8_t release_us[N_COLS]);
+const struct matrix_settle *matrix_settle(void);
+
+// Ghost blocking for a matrix without working diodes, where closed
+// switches on three corners of a rectangle make the fourth read closed
+// too. Keys on the corners of a rectangle in m cannot be told from
+// phantoms, so they keep their state from prev; every other key reads
+// as scanned. Returns the number of keys held back.
+int matrix_ghost_filter(matrix_t *m, const matrix_t *prev);
+
+// Idle mode: every column driven at once so that any closed switch
+// pulls its row high, with the row pins armed to latch that edge.
+// matrix_idle_woken() is true once a row has risen or is high.
+void matrix_idle_enter(void);
+void matrix_idle_exit(void);
+bool matrix_idle_woken(void);
+
+#endif /* MATRIX_H_ */
@@ -0,0 +1,35 @@
+#ifndef MATRIX_PIO_H_
+#define MATRIX_PIO_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "matrix.h"
+
+// Snapshot format produced by the PIO scanner (src/rp2040/matrix_scan.pio).
+// A snapshot is one raw 32-bit GPIO sample per column slot. Slots past
+// N_COLS drive no column and are ignored by the decoder; they pad the
+// snapshot to a power of two so the DMA ring can wrap on it.
+#define PIO_SCAN_SLOTS 16
+#define PIO_SCAN_RING  4
+
+_Static_assert(N_COLS <= PIO_SCAN_SLOTS, "too many columns for a PIO scan snapshot");
+
+// Column drive table the DMA feeds to the state machine, one word per slot
+void pio_scan_patterns(uint32_t patterns[PIO_SCAN_SLOTS]);
+
+// Decode a raw snapshot into the packed matrix
+void pio_scan_decode(const uint32_t snapshot[PIO_SCAN_SLOTS], matrix_t *m);
+
+// Backend: on the RP2040 a PIO state machine plus two DMA channels, on
+// the host a reference model of the same program. matrix_pio_latest()
+// points at the most recent complete snapshot and returns its sequence
+// number, which only changes when a new snapshot has landed.
+bool matrix_pio_init(uint32_t settle_us);
+uint32_t matrix_pio_latest(const uint32_t **snapshot);
+
+// Stop the scanner with every column driven, or release the columns
+// and start it again
+void matrix_pio_idle(bool idle);
+
+#endif /* MATRIX_PIO_H_ */
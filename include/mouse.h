@@ -0,0 +1,60 @@
+#ifndef MOUSE_H_
+#define MOUSE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Mouse keys. Held direction keys move the pointer or the wheel once
+// every 1 ms USB frame, at a speed that ramps up on a quadratic curve
+// the longer they are held. Speeds are in 1/256 pixel (or wheel notch)
+// per frame and all of it is integer arithmetic; motion builds up
+// until a report takes it, so frames the endpoint was busy for are not
+// lost.
+
+#ifndef MOUSE_SPEED_MIN
+#define MOUSE_SPEED_MIN 64      // 250 px/s
+#endif
+#ifndef MOUSE_SPEED_MAX
+#define MOUSE_SPEED_MAX 768     // 3000 px/s
+#endif
+#ifndef MOUSE_ACCEL_MS
+#define MOUSE_ACCEL_MS 1000
+#endif
+
+#ifndef MOUSE_WHEEL_MIN
+#define MOUSE_WHEEL_MIN 3       // about 12 notches/s
+#endif
+#ifndef MOUSE_WHEEL_MAX
+#define MOUSE_WHEEL_MAX 10      // about 40 notches/s
+#endif
+#ifndef MOUSE_WHEEL_ACCEL_MS
+#define MOUSE_WHEEL_ACCEL_MS 1000
+#endif
+
+#define MOUSE_FRAME_US 1000
+
+// Same layout as TUD_HID_REPORT_DESC_MOUSE
+struct mouse_report {
+    uint8_t buttons;
+    int8_t x;
+    int8_t y;
+    int8_t wheel;
+    int8_t pan;
+} __attribute__((packed));
+
+// A direction press moves by at least one unit straight away, so a tap
+// always shows
+void mouse_key(uint8_t key, bool pressed, uint64_t now_us);
+
+// True while a button press has not been reported; its release has to
+// wait for that
+bool mouse_button_unsent(uint8_t key);
+
+// Take the motion up to now and the buttons into a report; false if
+// there is nothing new to tell the host
+bool mouse_report(struct mouse_report *report, uint64_t now_us);
+
+// Start of the next frame while anything is moving, else SCHED_IDLE
+uint64_t mouse_next_us(void);
+
+#endif /* MOUSE_H_ */
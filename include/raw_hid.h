@@ -0,0 +1,201 @@
+#ifndef RAW_HID_H_
+#define RAW_HID_H_
+
+#include <stdint.h>
+
+#include "action.h"
+#include "trace.h"
+
+// Vendor raw HID protocol on the second HID interface. Every packet in
+// either direction is one 64-byte report without a report ID: a header
+// and a command-specific payload, all little-endian. The device answers
+// each request with one packet echoing its command and tag; the only
+// unsolicited packets are RAW_EVT_MATRIX while matrix streaming is on.
+//
+//   RAW_CMD_HELLO          -> raw_hid_hello
+//   RAW_CMD_KEYMAP_READ    raw_hid_keymap (no actions) -> raw_hid_keymap
+//   RAW_CMD_KEYMAP_WRITE   raw_hid_keymap -> raw_hid_keymap (no actions)
+//   RAW_CMD_KEYMAP_COMMIT  -> raw_hid_commit
+//   RAW_CMD_KEYMAP_RESET   -> raw_hid_commit
+//   RAW_CMD_MATRIX         raw_hid_matrix_request -> raw_hid_matrix
+//   RAW_CMD_COUNTERS       -> raw_hid_counters
+//   RAW_CMD_TRACE          -> raw_hid_trace, the oldest trace records
+//   RAW_CMD_TASKS          raw_hid_tasks_request -> raw_hid_tasks
+//   RAW_CMD_SETTLE         raw_hid_settle_request -> raw_hid_settle
+//
+// Writes go to a pending copy of the stored image, which reads return
+// while it exists; COMMIT writes it to flash and RESET drops every
+// stored image in favour of the compiled defaults.
+
+#define RAW_HID_REPORT_LEN  64
+#define RAW_HID_PAYLOAD_LEN (RAW_HID_REPORT_LEN - sizeof(struct raw_hid_header))
+#define RAW_HID_VERSION     1
+
+enum raw_hid_command {
+    RAW_CMD_HELLO = 1,
+    RAW_CMD_KEYMAP_READ,
+    RAW_CMD_KEYMAP_WRITE,
+    RAW_CMD_KEYMAP_COMMIT,
+    RAW_CMD_KEYMAP_RESET,
+    RAW_CMD_MATRIX,
+    RAW_CMD_COUNTERS,
+    RAW_CMD_TRACE,
+    RAW_CMD_TASKS,
+    RAW_CMD_SETTLE,
+};
+
+#define RAW_EVT_MATRIX 0x80
+
+enum raw_hid_status {
+    RAW_OK,
+    RAW_ERR_COMMAND,    // unknown command
+    RAW_ERR_RANGE,      // layer, key, count or core out of range
+    RAW_ERR_FLASH,      // commit did not verify
+};
+
+struct raw_hid_header {
+    uint8_t command;
+    uint8_t status;     // 0 in requests
+    uint8_t tag;        // copied from request to response
+    uint8_t reserved;
+} __attribute__((packed));
+
+struct raw_hid_hello {
+    uint8_t version;
+    uint8_t n_layers;
+    uint8_t n_cols;
+    uint8_t n_rows;
+    uint16_t n_keys;
+    uint16_t keymap_max;    // most actions per keymap packet
+    uint32_t store_sequence;
+} __attribute__((packed));
+
+#define RAW_HID_KEYMAP_MAX ((RAW_HID_PAYLOAD_LEN - 4) / sizeof(action_t))
+
+struct raw_hid_keymap {
+    uint8_t layer;
+    uint8_t first;      // matrix index of actions[0]
+    uint8_t count;
+    uint8_t reserved;
+    action_t actions[RAW_HID_KEYMAP_MAX];
+} __attribute__((packed));
+
+struct raw_hid_commit {
+    uint32_t sequence;
+} __attribute__((packed));
+
+// Snapshot the debounced matrix now; with a non-zero interval also
+// stream RAW_EVT_MATRIX whenever it changes, at most once per interval
+struct raw_hid_matrix_request {
+    uint16_t interval_ms;
+} __attribute__((packed));
+
+#define RAW_HID_MATRIX_WORDS ((RAW_HID_PAYLOAD_LEN - 12) / sizeof(uint32_t))
+
+struct raw_hid_matrix {
+    uint32_t time_us;
+    uint32_t scans;
+    uint8_t n_words;
+    uint8_t reserved[3];
+    uint32_t w[RAW_HID_MATRIX_WORDS];   // same layout as matrix_t
+} __attribute__((packed));
+
+struct raw_hid_counters {
+    uint32_t scans;
+    uint32_t scan_max_us;
+    uint32_t scan_overruns;
+    uint32_t events;
+    uint32_t events_dropped;
+    uint32_t queue_depth_max;
+    uint32_t latency_samples;   // LATENCY_TOTAL
+    uint32_t latency_max_us;
+    uint32_t scans_ghosted;     // MATRIX_GHOST_FILTER held keys back
+} __attribute__((packed));
+
+#define RAW_HID_TRACE_MAX ((RAW_HID_PAYLOAD_LEN - 4) / sizeof(struct trace_record))
+
+struct raw_hid_trace {
+    uint8_t count;      // fewer than RAW_HID_TRACE_MAX once the rings are empty
+    uint8_t reserved[3];
+    struct trace_record records[RAW_HID_TRACE_MAX];
+} __attribute__((packed));
+
+// Scheduler counters of one core, a page of tasks at a time in
+// priority order. Read while the core runs, so not one snapshot.
+struct raw_hid_tasks_request {
+    uint8_t core;
+    uint8_t first;
+} __attribute__((packed));
+
+#define RAW_HID_TASK_NAME_LEN 8
+
+struct raw_hid_task {
+    char name[RAW_HID_TASK_NAME_LEN];   // NUL-padded, not terminated if full
+    uint32_t runs;
+    uint32_t late;
+    uint32_t max_us;
+    uint32_t busy_ms;
+} __attribute__((packed));
+
+#define RAW_HID_TASKS_MAX ((RAW_HID_PAYLOAD_LEN - 12) / sizeof(struct raw_hid_task))
+
+struct raw_hid_tasks {
+    uint8_t core;
+    uint8_t first;
+    uint8_t count;
+    uint8_t n_tasks;
+    uint32_t wakes;
+    uint32_t busy_ms;
+    struct raw_hid_task tasks[RAW_HID_TASKS_MAX];
+} __attribute__((packed));
+
+// Matrix settle calibration and the scan time before and after it.
+// With save set the current delays go into the pending image and it is
+// committed, along with any keymap writes still pending.
+struct raw_hid_settle_request {
+    uint8_t save;
+} __attribute__((packed));
+
+#define RAW_HID_SETTLE_COLS ((RAW_HID_PAYLOAD_LEN - 24) / 2)
+
+struct raw_hid_settle {
+    uint32_t default_scan_us;   // with the uncalibrated delays, at boot
+    uint32_t scan_us;           // latest
+    uint32_t calibrated;        // bit per column
+    uint32_t calibrations;
+    uint32_t sequence;          // store sequence, after saving if asked
+    uint8_t n_cols;
+    uint8_t reserved[3];
+    uint8_t drive_us[RAW_HID_SETTLE_COLS];
+    uint8_t release_us[RAW_HID_SETTLE_COLS];
+} __attribute__((packed));
+
+struct raw_hid_packet {
+    struct raw_hid_header header;
+    union {
+        uint8_t bytes[RAW_HID_PAYLOAD_LEN];
+        struct raw_hid_hello hello;
+        struct raw_hid_keymap keymap;
+        struct raw_hid_commit commit;
+        struct raw_hid_matrix_request matrix_request;
+        struct raw_hid_matrix matrix;
+        struct raw_hid_counters counters;
+        struct raw_hid_trace trace;
+        struct raw_hid_tasks_request tasks_request;
+        struct raw_hid_tasks tasks;
+        struct raw_hid_settle_request settle_request;
+        struct raw_hid_settle settle;
+    };
+} __attribute__((packed));
+
+_Static_assert(sizeof(struct raw_hid_packet) == RAW_HID_REPORT_LEN, "raw HID packet must fill one report");
+
+// Device side: take a request from the OUT endpoint (copied, so the
+// buffer can be reused at once) and answer it from raw_hid_task(),
+// which also sends the matrix stream. Runs on the report side, after
+// the keyboard report, never waits for the raw endpoint, and returns
+// when it next needs to run.
+void raw_hid_receive(const uint8_t *report, uint16_t len);
+uint64_t raw_hid_task(void);
+
+#endif /* RAW_HID_H_ */
@@ -0,0 +1,19 @@
+#ifndef REPORT_H_
+#define REPORT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Report side of the pipeline: drains key events from the scan side and
+// keeps the HID keyboard, consumer control and mouse reports up to
+// date, all on one endpoint. Runs on core0 next to tud_task().
+// report_task() returns when it next needs to run.
+uint64_t report_task(void);
+void hid_report_complete(void);
+void hid_set_idle(uint8_t idle_rate);
+
+// Hold or release one usage in the report; key events and macros each
+// count as a separate source
+void report_usage(uint8_t usage, bool pressed);
+
+#endif /* REPORT_H_ */
@@ -0,0 +1,55 @@
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Cooperative scheduler, one per core, over a static table of tasks in
+// priority order. Every wake-up runs each task once, highest priority
+// first; a task returns the time it next needs to run, and the core
+// then sleeps until the earliest of those times or until an interrupt
+// or the other core wakes it. Tasks check their own state, so running
+// one early costs no more than that check.
+//
+// A task is late when it starts more than its deadline after the time
+// it asked for.
+
+// Nothing to do until an interrupt or the other core says otherwise
+#define SCHED_IDLE UINT64_MAX
+
+struct sched_stats {
+    uint32_t runs;
+    uint32_t late;
+    uint32_t max_late_us;
+    uint32_t max_us;        // longest single run
+    uint64_t total_us;
+};
+
+struct sched_task {
+    const char *name;
+    uint64_t (*run)(void);
+    uint32_t deadline_us;
+    uint64_t next_us;
+    struct sched_stats stats;
+};
+
+struct sched {
+    struct sched_task *tasks;
+    int n_tasks;
+    uint32_t wakes;
+    uint64_t busy_us;       // time spent in tasks
+};
+
+// Set up a scheduler for the calling core; sched_core() finds it again
+void sched_init(struct sched *s, struct sched_task *tasks, int n_tasks);
+
+// Run every task once and return when the next one is due
+uint64_t sched_pass(struct sched *s);
+
+// Pass and sleep, forever
+void sched_run(struct sched *s) __attribute__((noreturn));
+
+// Scheduler of a core, NULL if it has none
+const struct sched *sched_core(int core);
+
+#endif /* SCHED_H_ */
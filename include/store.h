@@ -0,0 +1,84 @@
+#ifndef STORE_H_
+#define STORE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+#include "hal.h"
+
+// Keymap, macros and settings kept in the reserved flash region, so
+// bindings can change at runtime without a rebuild.
+//
+// Each commit writes a complete image into the sector after the newest
+// one, round-robin over the region, so erases are spread evenly across
+// all sectors and the previous image stays intact until the new one is
+// complete. The payload pages are programmed first and the header page
+// last; the header carries a sequence number and a CRC over the whole
+// image, so a commit cut short by power loss is simply not found at
+// boot and the previous image is used.
+//
+// Images are used in place through the memory-mapped region; at boot
+// only the macros are walked, to check each one ends inside the image.
+// Without a valid image, or after the format or the matrix shape
+// changed, the compiled defaults from config.h are used.
+
+#define STORE_MAGIC   0x59454b50   // "PKEY"
+#define STORE_VERSION 2
+
+#define STORE_MACROS      16
+#define STORE_MACRO_BYTES 1024
+
+struct store_settings {
+    uint8_t debounce_algorithm;
+    uint8_t tap_hold_mode;
+    uint16_t tapping_term_ms;
+    uint8_t settle_drive_us[N_COLS];    // calibrated matrix delays, 0 if not
+    uint8_t settle_release_us[N_COLS];
+};
+
+struct store_header {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t n_layers;
+    uint8_t n_keys;
+    uint32_t sequence;
+    uint32_t crc;           // over the image with this field zero
+};
+
+// Header on the first page, payload from the second
+struct store_image {
+    struct store_header header;
+    uint8_t pad[HAL_FLASH_PAGE_SIZE - sizeof(struct store_header)];
+
+    action_t actions[N_LAYERS][N_KEYS];
+    uint16_t macro_offset[STORE_MACROS];    // into macro_code; 0xffff unused
+    uint8_t macro_code[STORE_MACRO_BYTES];
+    struct store_settings settings;
+};
+
+_Static_assert(sizeof(struct store_image) <= HAL_FLASH_SECTOR_SIZE, "store image must fit one sector");
+
+void store_init(void);
+
+// The active keymap, macro and settings: from flash, or the defaults
+const action_t (*store_keymap(void))[N_KEYS];
+const uint8_t *store_macro(int index);
+const struct store_settings *store_settings(void);
+
+// Sequence number of the active image, 0 for the defaults
+uint32_t store_sequence(void);
+
+// Changes whenever a different image becomes active, so the scan side
+// knows to reload what it derived from the keymap and settings
+uint32_t store_generation(void);
+
+// Edit a RAM copy of the active image and commit it as a new one.
+// store_edit() starts from the active image each time.
+struct store_image *store_edit(void);
+bool store_commit(void);
+
+// Forget every image and fall back to the compiled defaults
+void store_reset(void);
+
+#endif /* STORE_H_ */
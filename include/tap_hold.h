@@ -0,0 +1,47 @@
+#ifndef TAP_HOLD_H_
+#define TAP_HOLD_H_
+
+#include <stdint.h>
+
+struct key_event;
+
+// Tap-hold resolver, between the debounced key events and the action
+// table. A press of an MT()/LT() key stays undecided until it is
+// released (tap) or held past the tapping term (hold); key events that
+// arrive meanwhile wait in a fixed pool and are replayed in order once
+// it is decided. Other keys go straight through while nothing is
+// undecided.
+//
+// TAP_HOLD_TERM         only the time held decides
+// TAP_HOLD_PERMISSIVE   another key pressed and released while the
+//                       tap-hold key is down selects hold
+// TAP_HOLD_ON_OTHER_KEY any other key press selects hold
+typedef enum {
+    TAP_HOLD_TERM,
+    TAP_HOLD_PERMISSIVE,
+    TAP_HOLD_ON_OTHER_KEY,
+    TAP_HOLD_MODE_COUNT
+} tap_hold_mode_t;
+
+#ifndef TAP_HOLD_MODE
+#define TAP_HOLD_MODE TAP_HOLD_PERMISSIVE
+#endif
+
+#ifndef TAPPING_TERM_MS
+#define TAPPING_TERM_MS 200
+#endif
+
+// Events held back while a tap-hold key is undecided; one more forces
+// the decision to hold
+#define TAP_HOLD_POOL_SIZE 16
+
+void tap_hold_init(tap_hold_mode_t mode);
+void tap_hold_set_term_ms(uint16_t term_ms);
+void tap_hold_process(const struct key_event *change);
+
+// Decide a tap-hold key whose tapping term ran out with no other event
+void tap_hold_task(uint32_t now_us);
+
+const char *tap_hold_mode_name(tap_hold_mode_t mode);
+
+#endif /* TAP_HOLD_H_ */
@@ -0,0 +1,101 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Binary event trace. trace() stores a fixed-size record in a RAM ring
+// owned by the calling core: no locks, no allocation, no formatting, a
+// constant handful of stores. A full ring drops the record and counts
+// it. Records leave the rings only from core0 when the keyboard is
+// idle, either over the UART (trace_task()) or through the raw HID
+// interface, and tools/trace_decode.py turns them into a timeline.
+//
+// Not for interrupt handlers: each ring has exactly one writer, the
+// thread-mode code of its core.
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+// Records per core; a power of two
+#define TRACE_RING_SIZE 256
+#define TRACE_CORES     2
+
+// Event ids with the meaning of their two arguments, "" if unused.
+// tools/trace_decode.py reads the names from here.
+#define TRACE_EVENTS(X) \
+    X(BOOT,            "stage",     "")             \
+    X(DROPPED,         "",          "records")      \
+    X(KEY,             "key",       "pressed")      \
+    X(SCAN_OVERRUN,    "",          "elapsed_us")   \
+    X(QUEUE_FULL,      "key",       "usage")        \
+    X(REPORT,          "report_id", "events")       \
+    X(MACRO,           "macro",     "")             \
+    X(LAYER,           "",          "layers")       \
+    X(STORE_COMMIT,    "ok",        "sequence")     \
+    X(RAW_HID,         "command",   "status")       \
+    X(PIO_FALLBACK,    "",          "")             \
+    X(IDLE,            "",          "scans")        \
+    X(WAKE,            "",          "idle_us")      \
+    X(GHOST,           "",          "held")
+
+#define TRACE_ENUM(name, a, b) TRACE_##name,
+enum trace_event {
+    TRACE_EVENTS(TRACE_ENUM)
+    TRACE_EVENT_COUNT
+};
+#undef TRACE_ENUM
+
+// Boot stages for TRACE_BOOT
+#define TRACE_BOOT_BOARD 0
+#define TRACE_BOOT_KEYS  1
+#define TRACE_BOOT_USB   2
+
+struct trace_record {
+    uint32_t time_us;
+    uint8_t id;
+    uint8_t core;
+    uint16_t a;
+    uint32_t b;
+};
+
+// On the UART every record goes out as a frame: TRACE_SYNC, the record
+// bytes (little-endian), then the XOR of those bytes, so a decoder can
+// pick up the stream anywhere
+#define TRACE_SYNC      0xa5
+#define TRACE_FRAME_LEN (sizeof(struct trace_record) + 2)
+
+static inline void
+trace_frame_encode(const struct trace_record *record, uint8_t frame[TRACE_FRAME_LEN])
+{
+    const uint8_t *bytes = (const uint8_t *) record;
+    uint8_t check = 0;
+
+    frame[0] = TRACE_SYNC;
+    for (unsigned i = 0; i < sizeof(*record); ++i) {
+        frame[1 + i] = bytes[i];
+        check ^= bytes[i];
+    }
+    frame[TRACE_FRAME_LEN - 1] = check;
+}
+
+#if TRACE_ENABLED
+void trace(enum trace_event id, uint16_t a, uint32_t b);
+#else
+static inline void trace(enum trace_event id, uint16_t a, uint32_t b) { (void) id; (void) a; (void) b; }
+#endif
+
+// Oldest record of either core, in time order; core0 only. Records
+// a full ring dropped come out as one TRACE_DROPPED once everything
+// before them is out.
+bool trace_pop(struct trace_record *record);
+
+// Feed the UART with whatever it accepts without waiting, while the
+// report side has nothing to do. With the FIFO full it asks to run
+// again once a frame has had time to drain.
+#define TRACE_UART_RETRY_US 1000
+
+uint64_t trace_task(void);
+
+#endif /* TRACE_H_ */
@@ -31,7 +31,22 @@ enum
   REPORT_ID_MOUSE,
   REPORT_ID_CONSUMER_CONTROL,
   REPORT_ID_GAMEPAD,
+  REPORT_ID_KEYBOARD_NKRO,
+  REPORT_ID_LATENCY,
   REPORT_ID_COUNT
 };
 
+// HID interfaces in descriptor order, as TinyUSB numbers its instances
+enum
+{
+  HID_INSTANCE_KEYBOARD,
+  HID_INSTANCE_RAW,
+  HID_INSTANCE_COUNT
+};
+
+// NKRO report: one bit per keyboard usage 0x00..NKRO_USAGE_MAX, which
+// includes the modifiers at 0xE0..0xE7
+#define NKRO_USAGE_MAX    0xE7
+#define NKRO_REPORT_BYTES ((NKRO_USAGE_MAX + 1) / 8)
+
 #endif /* USB_DESCRIPTORS_H_ */
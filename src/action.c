@@ -0,0 +1,183 @@
+#include "action.h"
+#include "config.h"
+#include "event_queue.h"
+#include "hal.h"
+#include "layer.h"
+#include "leader.h"
+
+// Action each key resolved to when it went down, so that its release
+// undoes the same thing whatever the layer state is by then
+static action_t pressed_action[N_KEYS];
+
+static void
+emit_usage(const struct key_event *change, uint8_t usage, bool pressed)
+{
+    if (usage == KEY_NONE)
+        return;
+
+    struct key_event event = *change;
+    event.usage = usage;
+    event.pressed = pressed;
+    event.kind = KEY_EVENT_USAGE;
+    event_queue_push(&event);
+}
+
+// Consumer usages and mouse keys are held and released like usages,
+// in their own reports
+static void
+emit_other(const struct key_event *change, uint8_t kind, uint16_t usage)
+{
+    struct key_event event = *change;
+    event.usage = usage;
+    event.kind = kind;
+    event_queue_push(&event);
+}
+
+// Macros run on the report side, which paces them to the reports sent
+static void
+emit_macro(const struct key_event *change, int index)
+{
+    struct key_event event = *change;
+    event.usage = index;
+    event.kind = KEY_EVENT_MACRO;
+    event_queue_push(&event);
+}
+
+static void
+layer_action_process(action_t action, bool pressed)
+{
+    int layer = ACTION_LAYER(action);
+
+    switch (ACTION_LAYER_OP(action)) {
+    case LAYER_OP_MOMENTARY:
+        if (pressed)
+            layer_on(layer);
+        else
+            layer_off(layer);
+        break;
+    case LAYER_OP_TOGGLE:
+        if (pressed)
+            layer_toggle(layer);
+        break;
+    case LAYER_OP_ONESHOT:
+        if (pressed)
+            layer_oneshot(layer);
+        break;
+    }
+}
+
+// Modifier masks expand into one usage event per usage
+static void
+action_run(const struct key_event *change, action_t action)
+{
+    bool pressed = change->pressed;
+    uint32_t arg = ACTION_ARG(action);
+
+    switch (ACTION_TAG(action)) {
+    case ACT_TAG_KEY:
+        emit_usage(change, arg, pressed);
+        break;
+    case ACT_TAG_MOD:
+        while (arg) {
+            emit_usage(change, 0xe0 + __builtin_ctz(arg), pressed);
+            arg &= arg - 1;
+        }
+        break;
+    case ACT_TAG_MACRO:
+        if (pressed)
+            emit_macro(change, arg);
+        break;
+    case ACT_TAG_CONSUMER:
+        emit_other(change, KEY_EVENT_CONSUMER, arg);
+        break;
+    case ACT_TAG_MOUSE:
+        emit_other(change, KEY_EVENT_MOUSE, arg);
+        break;
+    case ACT_TAG_LAYER:
+        layer_action_process(action, pressed);
+        return;
+    case ACT_TAG_SYSTEM:
+        if (pressed && arg == SYS_BOOTLOADER)
+            hal_reset_bootloader();
+        else if (pressed && arg == SYS_LEADER)
+            leader_start(change);
+        return;
+    default:
+        break;
+    }
+
+    if (pressed)
+        layer_oneshot_consume();
+}
+
+void
+action_press(const struct key_event *change, action_t action)
+{
+    // keys typed after Leader spell out a sequence instead
+    if (leader_active() && ACTION_TAG(action) == ACT_TAG_KEY && action != KEY_NONE) {
+        pressed_action[change->key] = KEY_NONE;
+        leader_feed(change, action);
+        return;
+    }
+
+    pressed_action[change->key] = action;
+    action_run(change, action);
+}
+
+void
+action_tap(const struct key_event *change, action_t action)
+{
+    struct key_event event = *change;
+
+    event.pressed = true;
+    action_run(&event, action);
+    event.pressed = false;
+    action_run(&event, action);
+}
+
+void
+action_process(const struct key_event *change)
+{
+    if (change->pressed)
+        action_press(change, layer_action(change->key));
+    else
+        action_run(change, pressed_action[change->key]);
+}
+
+static bool
+tap_usage_valid(uint32_t usage)
+{
+    return usage <= NKRO_USAGE_MAX && !ACTION_IS_MOD_USAGE(usage);
+}
+
+bool
+action_valid(action_t action)
+{
+    uint32_t arg = ACTION_ARG(action);
+
+    switch (ACTION_TAG(action)) {
+    case ACT_TAG_KEY:
+        return arg <= NKRO_USAGE_MAX;
+    case ACT_TAG_MOD:
+        return arg <= 0xff;
+    case ACT_TAG_MACRO:
+        return arg < N_MACROS;
+    case ACT_TAG_LAYER:
+        return ACTION_LAYER_OP(action) <= LAYER_OP_ONESHOT && ACTION_LAYER(action) < N_LAYERS;
+    case ACT_TAG_MOD_TAP:
+    case ACT_TAG_RMOD_TAP:
+        return (arg >> 8) != 0 && tap_usage_valid(arg & 0xff);
+    case ACT_TAG_LAYER_TAP:
+        return (arg >> 8) < N_LAYERS && tap_usage_valid(arg & 0xff);
+    case ACT_TAG_SYSTEM:
+        return arg == SYS_BOOTLOADER || arg == SYS_LEADER;
+    case ACT_TAG_CONSUMER:
+        return arg != 0;
+    case ACT_TAG_MOUSE:
+        return arg < MS_COUNT;
+    case ACT_TAG_TRANS:
+        return arg == 0;
+    default:
+        return false;
+    }
+}
@@ -0,0 +1,244 @@
+#include "action.h"
+#include "combo.h"
+#include "config.h"
+#include "event_queue.h"
+#include "matrix.h"
+#include "tap_hold.h"
+
+#define N_COMBOS (int) (sizeof(combos) / sizeof(combos[0]))
+
+_Static_assert(N_COMBOS <= 255, "combo index must fit in a byte");
+
+// The combo table as key masks, sorted by first (lowest) key.
+// combo_first[k] .. combo_first[k + 1] are the combos whose first key
+// is k, so combos whose first key is at most k are a prefix.
+static matrix_t combo_mask[N_COMBOS];
+static uint8_t combo_index[N_COMBOS];
+static uint8_t combo_first[N_KEYS + 1];
+
+// Keys that belong to a combo which consumes its keys, and the first
+// keys of all combos
+static matrix_t consume_keys;
+static matrix_t first_keys;
+
+static matrix_t down;
+
+// Presses held back while they may still become a combo, oldest first
+static struct key_event held[COMBO_MAX_KEYS];
+static int n_held;
+static matrix_t held_mask;
+
+// Combos that fired and still have keys down. The action is released
+// with the first of its keys; the rest are swallowed.
+#define COMBO_ACTIVE_MAX 4
+
+static struct {
+    matrix_t keys;
+    uint8_t slot;       // key whose pressed_action holds the combo action
+    bool released;
+} active[COMBO_ACTIVE_MAX];
+
+static int
+first_key(const struct combo *combo)
+{
+    int first = combo->keys[0];
+    for (int i = 1; i < combo->n_keys; ++i)
+        if (combo->keys[i] < first)
+            first = combo->keys[i];
+    return first;
+}
+
+void
+combo_init(void)
+{
+    int n = 0;
+
+    // counting sort by first key
+    for (int key = 0; key < N_KEYS; ++key) {
+        combo_first[key] = n;
+        for (int i = 0; i < N_COMBOS; ++i)
+            if (first_key(&combos[i]) == key)
+                combo_index[n++] = i;
+    }
+    combo_first[N_KEYS] = n;
+
+    consume_keys = (matrix_t) { 0 };
+    first_keys = (matrix_t) { 0 };
+    for (int i = 0; i < N_COMBOS; ++i) {
+        const struct combo *combo = &combos[combo_index[i]];
+
+        combo_mask[i] = (matrix_t) { 0 };
+        for (int k = 0; k < combo->n_keys; ++k) {
+            matrix_set_key(&combo_mask[i], combo->keys[k]);
+            if (!(combo->flags & COMBO_HELD))
+                matrix_set_key(&consume_keys, combo->keys[k]);
+        }
+        matrix_set_key(&first_keys, first_key(combo));
+    }
+
+    down = (matrix_t) { 0 };
+    held_mask = (matrix_t) { 0 };
+    n_held = 0;
+    for (int i = 0; i < COMBO_ACTIVE_MAX; ++i)
+        active[i].keys = (matrix_t) { 0 };
+}
+
+// Largest combo with the given flags that is fully down in keys and
+// includes key; -1 if none. Only combos whose first key is down can
+// match, so only their slices of the table are compared.
+static int
+combo_complete(const matrix_t *keys, int key, uint8_t flags)
+{
+    int best = -1;
+
+    for (int word = 0; word < MATRIX_WORDS; ++word) {
+        uint32_t firsts = keys->w[word] & first_keys.w[word];
+        while (firsts) {
+            int first = word * 32 + __builtin_ctz(firsts);
+            firsts &= firsts - 1;
+
+            for (int i = combo_first[first]; i < combo_first[first + 1]; ++i) {
+                const struct combo *combo = &combos[combo_index[i]];
+                if ((combo->flags & COMBO_HELD) == flags && matrix_key(&combo_mask[i], key) &&
+                    matrix_subset(&combo_mask[i], keys) &&
+                    (best < 0 || combo->n_keys > combos[combo_index[best]].n_keys))
+                    best = i;
+            }
+        }
+    }
+    return best;
+}
+
+// True if some consuming combo contains all of keys; its first key can
+// be no higher than the lowest key in the set
+static bool
+combo_partial(const matrix_t *keys, int lowest)
+{
+    for (int i = 0; i < combo_first[lowest + 1]; ++i)
+        if (!(combos[combo_index[i]].flags & COMBO_HELD) && matrix_subset(keys, &combo_mask[i]))
+            return true;
+    return false;
+}
+
+static void
+flush_held(void)
+{
+    for (int i = 0; i < n_held; ++i)
+        tap_hold_process(&held[i]);
+    n_held = 0;
+    held_mask = (matrix_t) { 0 };
+}
+
+static bool
+combo_fire(int i, const struct key_event *change)
+{
+    const struct combo *combo = &combos[combo_index[i]];
+
+    for (int a = 0; a < COMBO_ACTIVE_MAX; ++a) {
+        if (!matrix_empty(&active[a].keys))
+            continue;
+
+        struct key_event event = *change;
+        event.key = first_key(combo);
+        if (n_held)
+            event.sample_us = held[0].sample_us;
+
+        active[a].keys = combo_mask[i];
+        active[a].slot = event.key;
+        active[a].released = false;
+        n_held = 0;
+        held_mask = (matrix_t) { 0 };
+        action_press(&event, combo->action);
+        return true;
+    }
+    return false;
+}
+
+// Release of a key that fired a combo: the first one releases the
+// combo action, the others are swallowed
+static bool
+combo_release(const struct key_event *change)
+{
+    for (int a = 0; a < COMBO_ACTIVE_MAX; ++a) {
+        if (!matrix_key(&active[a].keys, change->key))
+            continue;
+
+        matrix_clear_key(&active[a].keys, change->key);
+        if (!active[a].released) {
+            struct key_event event = *change;
+            event.key = active[a].slot;
+            active[a].released = true;
+            action_process(&event);
+        }
+        return true;
+    }
+    return false;
+}
+
+static void
+combo_press(const struct key_event *change)
+{
+    int key = change->key;
+    int i = combo_complete(&down, key, COMBO_HELD);
+
+    if (i >= 0)
+        action_tap(change, combos[combo_index[i]].action);
+
+    if (!matrix_key(&consume_keys, key)) {
+        flush_held();
+        tap_hold_process(change);
+        return;
+    }
+
+    matrix_t keys = held_mask;
+    matrix_set_key(&keys, key);
+    int lowest = n_held && held[0].key < key ? held[0].key : key;
+    for (int h = 1; h < n_held; ++h)
+        if (held[h].key < lowest)
+            lowest = held[h].key;
+
+    i = combo_complete(&keys, key, 0);
+    if (i >= 0 && combo_fire(i, change))
+        return;
+
+    if (!combo_partial(&keys, lowest)) {
+        // cannot grow into a combo with what is held; start over with
+        // just this key
+        flush_held();
+        keys = (matrix_t) { 0 };
+        matrix_set_key(&keys, key);
+        if (!combo_partial(&keys, key)) {
+            tap_hold_process(change);
+            return;
+        }
+    }
+
+    held[n_held++] = *change;
+    held_mask = keys;
+}
+
+void
+combo_process(const struct key_event *change)
+{
+    int key = change->key;
+
+    if (change->pressed) {
+        matrix_set_key(&down, key);
+        combo_press(change);
+        return;
+    }
+
+    matrix_clear_key(&down, key);
+    if (combo_release(change))
+        return;
+    if (matrix_key(&held_mask, key))
+        flush_held();
+    tap_hold_process(change);
+}
+
+void
+combo_task(uint32_t now_us)
+{
+    if (n_held && now_us - held[0].time_us >= COMBO_TERM_MS * 1000u)
+        flush_held();
+}
@@ -0,0 +1,87 @@
+#include <string.h>
+
+#include "debounce.h"
+
+static debounce_algorithm_t debounce_algorithm = DEBOUNCE_ALGORITHM;
+
+// Counter bit-planes and debounced state
+static matrix_t ct0, ct1, state;
+
+void
+debounce_init(debounce_algorithm_t algorithm)
+{
+    debounce_algorithm = algorithm;
+    memset(&state, 0, sizeof(state));
+
+    // defer counters idle at 3 and count down while the input differs,
+    // the integrator starts at 0 (released)
+    uint32_t idle = algorithm == DEBOUNCE_INTEGRATOR ? 0 : ~0u;
+    for (int i = 0; i < MATRIX_WORDS; ++i) {
+        ct0.w[i] = idle;
+        ct1.w[i] = idle;
+    }
+}
+
+// Count down every key whose raw sample differs from its debounced
+// state and reset the others; returns the keys whose counter wrapped
+// after 4 consecutive differing samples
+static inline uint32_t
+defer_expired(int i, uint32_t delta)
+{
+    ct0.w[i] = ~(ct0.w[i] & delta);
+    ct1.w[i] = ct0.w[i] ^ (ct1.w[i] & delta);
+    return delta & ct0.w[i] & ct1.w[i];
+}
+
+void
+debounce_update(const matrix_t *raw, matrix_t *stable)
+{
+    for (int i = 0; i < MATRIX_WORDS; ++i) {
+        uint32_t in = raw->w[i];
+        uint32_t delta = in ^ state.w[i];
+
+        switch (debounce_algorithm) {
+        case DEBOUNCE_DEFER:
+            state.w[i] ^= defer_expired(i, delta);
+            break;
+        case DEBOUNCE_EAGER:
+            state.w[i] ^= delta & (in | defer_expired(i, delta));
+            break;
+        case DEBOUNCE_INTEGRATOR: {
+            uint32_t c0 = ct0.w[i], c1 = ct1.w[i];
+            // saturated at 3 going up, or at 0 going down
+            uint32_t hold = (in & c1 & c0) | (~in & ~(c1 | c0));
+            uint32_t step = ~hold;
+
+            c1 ^= step & ~(in ^ c0);
+            c0 ^= step;
+            state.w[i] = (state.w[i] | (c1 & c0)) & (c1 | c0);
+            ct0.w[i] = c0;
+            ct1.w[i] = c1;
+            break;
+        }
+        default:
+            state.w[i] = in;
+            break;
+        }
+    }
+
+    *stable = state;
+}
+
+const char *
+debounce_algorithm_name(debounce_algorithm_t algorithm)
+{
+    switch (algorithm) {
+    case DEBOUNCE_NONE:
+        return "none";
+    case DEBOUNCE_DEFER:
+        return "defer";
+    case DEBOUNCE_EAGER:
+        return "eager";
+    case DEBOUNCE_INTEGRATOR:
+        return "integrator";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,82 @@
+#include <stdatomic.h>
+
+#include "event_queue.h"
+#include "hal.h"
+#include "trace.h"
+
+_Static_assert((EVENT_QUEUE_SIZE & (EVENT_QUEUE_SIZE - 1)) == 0, "EVENT_QUEUE_SIZE must be a power of two");
+
+static struct key_event events[EVENT_QUEUE_SIZE];
+
+// Free-running indices: head is only written by the producer, tail only
+// by the consumer. The release store on each publishes the slot contents
+// to the other core.
+static atomic_uint head;
+static atomic_uint tail;
+
+// Written by the producer only
+static struct event_queue_stats stats;
+
+bool
+event_queue_push(const struct key_event *event)
+{
+    unsigned h = atomic_load_explicit(&head, memory_order_relaxed);
+    unsigned t = atomic_load_explicit(&tail, memory_order_acquire);
+    unsigned depth = h - t;
+
+    if (depth >= EVENT_QUEUE_SIZE) {
+        stats.dropped++;
+        trace(TRACE_QUEUE_FULL, event->key, event->usage);
+        return false;
+    }
+
+    events[h & (EVENT_QUEUE_SIZE - 1)] = *event;
+    atomic_store_explicit(&head, h + 1, memory_order_release);
+    // the report side may be asleep waiting for exactly this
+    hal_wake_other_core();
+
+    stats.pushed++;
+    if (depth + 1 > stats.depth_max)
+        stats.depth_max = depth + 1;
+    return true;
+}
+
+bool
+event_queue_pop(struct key_event *event)
+{
+    unsigned t = atomic_load_explicit(&tail, memory_order_relaxed);
+    unsigned h = atomic_load_explicit(&head, memory_order_acquire);
+
+    if (h == t)
+        return false;
+
+    *event = events[t & (EVENT_QUEUE_SIZE - 1)];
+    atomic_store_explicit(&tail, t + 1, memory_order_release);
+    return true;
+}
+
+bool
+event_queue_peek(struct key_event *event)
+{
+    unsigned t = atomic_load_explicit(&tail, memory_order_relaxed);
+    unsigned h = atomic_load_explicit(&head, memory_order_acquire);
+
+    if (h == t)
+        return false;
+
+    *event = events[t & (EVENT_QUEUE_SIZE - 1)];
+    return true;
+}
+
+uint32_t
+event_queue_depth(void)
+{
+    return atomic_load_explicit(&head, memory_order_acquire) -
+           atomic_load_explicit(&tail, memory_order_acquire);
+}
+
+const struct event_queue_stats *
+event_queue_stats(void)
+{
+    return &stats;
+}
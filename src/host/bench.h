@@ -0,0 +1,35 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct sched;
+
+uint64_t bench_wall_ns(void);
+void bench_loop_tick(void);
+struct sched *bench_scheduler(void);
+void bench_run_us(uint64_t us);
+bool bench_report_has_usage(uint8_t report_id, const uint8_t *report, uint16_t len, uint8_t usage);
+
+// Record the outcome of a check the bench has worked out; any failure
+// makes the run exit non-zero
+void bench_check(bool ok, const char *what);
+
+void bench_debounce(int iterations);
+void bench_macro(void);
+void bench_tap_hold(void);
+void bench_combo(void);
+void bench_leader(void);
+void bench_store(void);
+void bench_raw_hid(void);
+void bench_trace(const char *capture_path);
+void bench_idle(void);
+void bench_led(void);
+void bench_sched(void);
+void bench_settle_profile(void);
+void bench_settle(int iterations);
+void bench_ghost(int iterations);
+void bench_mouse(void);
+
+#endif /* BENCH_H_ */
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "combo.h"
+#include "config.h"
+#include "event_queue.h"
+#include "hal.h"
+#include "matrix.h"
+#include "sim.h"
+
+// Feed synthetic key events into the combo engine and check the usage
+// stream behind it, then hold the bootloader combo on the simulated
+// matrix and check it fires without the old column strobes. J+K is one
+// of the EXAMPLE_COMBOS, which the host build turns on.
+
+_Static_assert(EXAMPLE_COMBOS, "the combo bench needs the example combos");
+
+#define J KEY_INDEX(7, 2)
+#define K KEY_INDEX(8, 2)
+#define L KEY_INDEX(9, 2)
+#define TERM_US (COMBO_TERM_MS * 1000u)
+
+struct step {
+    uint32_t time_us;
+    int key;        // -1: only run the combo timer
+    bool pressed;
+};
+
+static const struct {
+    const char *name;
+    struct step steps[4];
+    int n_steps;
+    const char *expected;
+} cases[] = {
+    { "combo",
+      { { 0, J, true }, { 10000, K, true }, { 80000, J, false }, { 90000, K, false } }, 4,
+      "+esc -esc" },
+    { "slow",
+      { { 0, J, true }, { TERM_US, -1, false }, { TERM_US + 10000, K, true },
+        { TERM_US + 20000, K, false } }, 4,
+      "+j +k -k" },
+    { "other-key",
+      { { 0, J, true }, { 10000, L, true }, { 20000, L, false }, { 30000, J, false } }, 4,
+      "+j +l -l -j" },
+    { "alone-tap",
+      { { 0, K, true }, { 20000, K, false } }, 2,
+      "+k -k" },
+};
+
+#define N_CASES (int) (sizeof(cases) / sizeof(cases[0]))
+
+static void
+drain(char *out, size_t size)
+{
+    struct key_event event;
+    size_t len = 0;
+
+    out[0] = '\0';
+    while (event_queue_pop(&event) && len < size) {
+        const char *name;
+        char buf[8];
+
+        switch (event.usage) {
+        case KEY_ESC: name = "esc"; break;
+        case KEY_J:   name = "j"; break;
+        case KEY_K:   name = "k"; break;
+        case KEY_L:   name = "l"; break;
+        default:
+            snprintf(buf, sizeof(buf), "%02x", event.usage);
+            name = buf;
+        }
+        len += snprintf(out + len, size - len, "%s%c%s", len ? " " : "", event.pressed ? '+' : '-', name);
+    }
+}
+
+static bool
+bootloader_combo(void)
+{
+    unsigned before = sim_bootloader_requests();
+
+    // pressed one at a time, far apart: a held combo has no term
+    sim_key_set(FN1_COL, FN1_ROW, true);
+    bench_run_us(200000);
+    sim_key_set(0, 1, true);
+    bench_run_us(200000);
+    sim_key_set(13, 0, true);
+    bench_run_us(20000);
+    sim_keys_clear();
+    bench_run_us(50000);
+
+    return sim_bootloader_requests() == before + 1;
+}
+
+void
+bench_combo(void)
+{
+    char out[128];
+    int passed = 0;
+
+    combo_init();
+    drain(out, sizeof(out));
+
+    for (int c = 0; c < N_CASES; ++c) {
+        for (int i = 0; i < cases[c].n_steps; ++i) {
+            const struct step *step = &cases[c].steps[i];
+            if (step->key < 0) {
+                combo_task(step->time_us);
+            } else {
+                struct key_event event = {
+                    .sample_us = step->time_us,
+                    .time_us = step->time_us,
+                    .key = step->key,
+                    .pressed = step->pressed,
+                };
+                combo_process(&event);
+                combo_task(step->time_us);
+            }
+        }
+        drain(out, sizeof(out));
+
+        if (strcmp(out, cases[c].expected) == 0)
+            passed++;
+        else
+            printf("combo: case=%s got=\"%s\" expected=\"%s\"\n", cases[c].name, out, cases[c].expected);
+    }
+
+    bool bootloader = bootloader_combo();
+    printf("combo: cases=%d passed=%d bootloader=%d\n", N_CASES, passed, bootloader);
+    bench_check(passed == N_CASES, "combo: cases");
+    bench_check(bootloader, "combo: held bootloader combo");
+}
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "debounce.h"
+
+// Bounce traces captured from switches on the prototype, one character
+// per 1 ms scan. Each trace is a single intended press (or none, for
+// the glitch traces) starting at the first '1'.
+static const struct {
+    const char *name;
+    bool press;
+    const char *samples;
+} traces[] = {
+    { "clean",          true,  "0000011111111111111111100000000000" },
+    { "press-bounce",   true,  "0000010110111111111111111100000000" },
+    { "release-bounce", true,  "0000011111111111111110101100000000" },
+    { "both-bounce",    true,  "0000010101111111111111110100100000" },
+    { "worn-switch",    true,  "0000010011011111111111011011010000" },
+    { "glitch",         false, "0000000010000000000000000000000000" },
+    { "double-glitch",  false, "0000000011000000000000000000000000" },
+};
+
+#define N_TRACES (int) (sizeof(traces) / sizeof(traces[0]))
+
+// A key far enough into the matrix to live in the second word
+#define TRACE_KEY KEY_INDEX(N_COLS - 1, N_ROWS - 1)
+
+struct trace_result {
+    int press_latency;
+    int release_latency;
+    int transitions;
+};
+
+static struct trace_result
+replay(const char *samples)
+{
+    struct trace_result r = { -1, -1, 0 };
+    int first_raw = -1, last_raw = -1;
+    bool prev = false;
+    int len = strlen(samples);
+    matrix_t raw, stable;
+
+    for (int i = 0; i < len; ++i) {
+        if (samples[i] == '1') {
+            if (first_raw < 0) first_raw = i;
+            last_raw = i;
+        }
+    }
+
+    for (int i = 0; i < len; ++i) {
+        memset(&raw, 0, sizeof(raw));
+        if (samples[i] == '1')
+            matrix_set_key(&raw, TRACE_KEY);
+
+        debounce_update(&raw, &stable);
+        bool down = matrix_key(&stable, TRACE_KEY);
+        if (down != prev) {
+            r.transitions++;
+            if (down && r.press_latency < 0)
+                r.press_latency = i - first_raw;
+            if (!down)
+                r.release_latency = i - (last_raw + 1);
+        }
+        prev = down;
+    }
+    return r;
+}
+
+// Whether an algorithm may add transitions to a trace: none filters
+// nothing, and eager takes a glitch for a short press by design
+static bool
+spurious_allowed(int alg, bool press)
+{
+    return alg == DEBOUNCE_NONE || (alg == DEBOUNCE_EAGER && !press);
+}
+
+// Replay every trace through every algorithm and report added latency
+// (in scans), spurious transitions and presses that never showed up
+void
+bench_debounce(int iterations)
+{
+    for (int alg = 0; alg < DEBOUNCE_COUNT; ++alg) {
+        int press_total = 0, release_total = 0, presses = 0, spurious = 0, missed = 0;
+        bool within_bounds = true;
+
+        for (int t = 0; t < N_TRACES; ++t) {
+            debounce_init(alg);
+            struct trace_result r = replay(traces[t].samples);
+            int expected = traces[t].press ? 2 : 0;
+
+            if (r.transitions > expected) {
+                spurious += r.transitions - expected;
+                within_bounds &= spurious_allowed(alg, traces[t].press);
+            }
+            if (traces[t].press && r.press_latency >= 0 && r.release_latency >= 0) {
+                press_total += r.press_latency;
+                release_total += r.release_latency;
+                presses++;
+            } else if (traces[t].press) {
+                missed++;
+            }
+        }
+
+        matrix_t raw = { 0 }, stable;
+        debounce_init(alg);
+        uint64_t start = bench_wall_ns();
+        for (int i = 0; i < iterations; ++i) {
+            raw.w[i % MATRIX_WORDS] ^= 1u << (i & 31);
+            debounce_update(&raw, &stable);
+        }
+        uint64_t wall = bench_wall_ns() - start;
+
+        printf("debounce: algorithm=%s press_latency_scans=%.2f release_latency_scans=%.2f "
+               "spurious=%d missed=%d host_ns_per_update=%.1f\n",
+               debounce_algorithm_name(alg),
+               presses ? (double) press_total / presses : -1.0,
+               presses ? (double) release_total / presses : -1.0,
+               spurious, missed, iterations ? (double) wall / iterations : 0.0);
+        bench_check(within_bounds, "debounce: spurious transitions within the algorithm's bound");
+        bench_check(missed == 0, "debounce: every press seen");
+    }
+
+    debounce_init(DEBOUNCE_ALGORITHM);
+}
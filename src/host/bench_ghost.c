@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "config.h"
+#include "hal.h"
+#include "matrix.h"
+#include "sim.h"
+
+// Ghost blocking on synthetic matrices scanned without diodes: phantom
+// keys let through with and without the filter and real keys it holds
+// back, a held key and one off the rectangle both still down while a
+// rectangle forms, and the cost of the filter on typing-sized, dense
+// and full matrices.
+
+#define GHOST_TIMED_CALLS 100000
+
+static int
+count_keys(const matrix_t *m, const matrix_t *mask, bool inside)
+{
+    int n = 0;
+
+    for (int i = 0; i < MATRIX_WORDS; ++i)
+        n += __builtin_popcount(m->w[i] & (inside ? mask->w[i] : ~mask->w[i]));
+    return n;
+}
+
+static void
+press(matrix_t *truth, int col, int row)
+{
+    sim_key_set(col, row, true);
+    matrix_set_key(truth, KEY_INDEX(col, row));
+}
+
+static void
+random_keys(matrix_t *truth, int max_keys)
+{
+    *truth = (matrix_t) { 0 };
+    sim_keys_clear();
+    for (int n = rand() % (max_keys + 1); n > 0; --n)
+        press(truth, rand() % N_COLS, rand() % N_ROWS);
+}
+
+// Random matrices with about percent of the keys down, without scanning
+static void
+synthetic(matrix_t *m, int count, int percent)
+{
+    for (int i = 0; i < count; ++i) {
+        m[i] = (matrix_t) { 0 };
+        for (int key = 0; key < N_KEYS; ++key)
+            if (rand() % 100 < percent)
+                matrix_set_key(&m[i], key);
+    }
+}
+
+static double
+filter_ns(const matrix_t *inputs, int count)
+{
+    static const matrix_t prev;
+    uint64_t wall = 0;
+
+    for (int done = 0; done < GHOST_TIMED_CALLS; done += count) {
+        matrix_t m[64];
+        for (int i = 0; i < count; ++i)
+            m[i] = inputs[i];
+
+        uint64_t start = bench_wall_ns();
+        for (int i = 0; i < count; ++i)
+            matrix_ghost_filter(&m[i], &prev);
+        wall += bench_wall_ns() - start;
+    }
+    return (double) wall / GHOST_TIMED_CALLS;
+}
+
+void
+bench_ghost(int iterations)
+{
+    static const matrix_t none;
+    int phantoms = 0, phantoms_passed = 0, real = 0, real_held = 0;
+    matrix_t truth, m;
+
+    srand(6);
+    sim_set_diodes(false);
+
+    for (int i = 0; i < iterations; ++i) {
+        random_keys(&truth, 8);
+        matrix_scan(&m);
+        phantoms += count_keys(&m, &truth, false);
+
+        matrix_ghost_filter(&m, &none);
+        phantoms_passed += count_keys(&m, &truth, false);
+        real += count_keys(&truth, &truth, true);
+        real_held += count_keys(&truth, &m, false);
+    }
+
+    // two keys down on one column, then a third on the next column
+    // closes a rectangle while a key elsewhere goes down too
+    matrix_t prev = { 0 };
+    truth = (matrix_t) { 0 };
+    sim_keys_clear();
+    press(&truth, 1, 1);
+    press(&truth, 1, 2);
+    matrix_scan(&prev);
+    press(&truth, 2, 1);
+    press(&truth, 6, 4);
+    matrix_scan(&m);
+    bool had_phantom = matrix_key(&m, KEY_INDEX(2, 2));
+    int held = matrix_ghost_filter(&m, &prev);
+    bool holdover = had_phantom && held == 4 && matrix_key(&m, KEY_INDEX(1, 1)) &&
+                    matrix_key(&m, KEY_INDEX(1, 2)) && !matrix_key(&m, KEY_INDEX(2, 1)) &&
+                    !matrix_key(&m, KEY_INDEX(2, 2)) && matrix_key(&m, KEY_INDEX(6, 4));
+
+    sim_keys_clear();
+    sim_set_diodes(true);
+
+    matrix_t typing[64], dense[64], full[64];
+    synthetic(typing, 64, 4);
+    synthetic(dense, 64, 50);
+    synthetic(full, 64, 101);
+
+    printf("ghost: matrices=%d phantoms=%d passed=%d real_keys=%d held=%d holdover=%d\n",
+           iterations, phantoms, phantoms_passed, real, real_held, holdover);
+    bench_check(phantoms_passed == 0, "ghost: no phantom key passes the filter");
+    bench_check(holdover, "ghost: ambiguous keys keep their state");
+    printf("ghost: host_ns_per_filter typing=%.1f dense=%.1f full=%.1f\n",
+           filter_ns(typing, 64), filter_ns(dense, 64), filter_ns(full, 64));
+}
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "config.h"
+#include "hal.h"
+#include "keyboard.h"
+#include "matrix.h"
+#include "sim.h"
+#include "store.h"
+
+// Idle scanning: the keyboard stops scanning once nothing has been
+// down for IDLE_LINGER_MS, a press wakes it through the row edge, and
+// the first report after a wake comes about as fast as one while
+// scanning. Wake detection is only as fine as the 50 us loop tick.
+
+#define IDLE_COL 1
+#define IDLE_ROW 2
+
+#define IDLE_SAMPLES 20
+
+static uint8_t watch_usage;
+static bool watch_seen;
+static uint64_t watch_us;
+
+static void
+on_report(uint64_t time_us, uint8_t report_id, const uint8_t *report, uint16_t len)
+{
+    if (!watch_seen && bench_report_has_usage(report_id, report, len, watch_usage)) {
+        watch_seen = true;
+        watch_us = time_us;
+    }
+}
+
+// Press the key at a random point in the scan interval and return the
+// press-to-report latency, or -1 if it never showed up
+static int64_t
+press_latency(void)
+{
+    uint64_t start;
+
+    sim_advance_us(rand() % SCAN_INTERVAL_US);
+    watch_seen = false;
+    sim_key_set(IDLE_COL, IDLE_ROW, true);
+    start = hal_time_us();
+    while (!watch_seen && hal_time_us() - start < 50000)
+        bench_loop_tick();
+    sim_key_set(IDLE_COL, IDLE_ROW, false);
+    bench_run_us(30000);
+    return watch_seen ? (int64_t) (watch_us - start) : -1;
+}
+
+static void
+sample(int64_t latency, int64_t *total, int *samples)
+{
+    if (latency >= 0) {
+        *total += latency;
+        (*samples)++;
+    }
+}
+
+// Scans per second over one second of virtual time
+static uint32_t
+scan_rate(void)
+{
+    uint32_t before = keyboard_scan_stats()->scans;
+
+    bench_run_us(1000000);
+    return keyboard_scan_stats()->scans - before;
+}
+
+void
+bench_idle(void)
+{
+    const struct scan_stats *stats = keyboard_scan_stats();
+    int64_t idle_total = 0, active_total = 0;
+    int idle_samples = 0, active_samples = 0;
+
+    srand(3);
+    watch_usage = ACTION_ARG(store_keymap()[0][KEY_INDEX(IDLE_COL, IDLE_ROW)]);
+    sim_set_report_cb(on_report);
+    sim_keys_clear();
+
+    // a press starts the linger; idle just after it runs out
+    press_latency();
+    uint64_t released_us = hal_time_us();
+    while (!keyboard_idle() && hal_time_us() - released_us < 2 * IDLE_LINGER_MS * 1000ull)
+        bench_loop_tick();
+    bool entered = keyboard_idle();
+    uint64_t linger_ms = (hal_time_us() - released_us) / 1000;
+
+    uint32_t idle_rate = scan_rate();
+
+    sim_key_set(IDLE_COL, IDLE_ROW, true);
+    uint32_t active_rate = scan_rate();
+    sim_key_set(IDLE_COL, IDLE_ROW, false);
+    bench_run_us(30000);
+
+    // every wake sample starts from idle; every active one lands while
+    // the linger is still running
+    uint32_t wakes_before = stats->wakes;
+    for (int i = 0; i < IDLE_SAMPLES; ++i) {
+        while (!keyboard_idle())
+            bench_loop_tick();
+        bench_run_us(rand() % 100000);
+        sample(press_latency(), &idle_total, &idle_samples);
+        sample(press_latency(), &active_total, &active_samples);
+    }
+    uint32_t wakes = stats->wakes - wakes_before;
+
+    sim_set_report_cb(NULL);
+
+    printf("idle_scan: linger_ms=%d entered=%d entered_after_ms=%llu scans_per_s idle=%u active=%u\n",
+           IDLE_LINGER_MS, entered, (unsigned long long) linger_ms, idle_rate, active_rate);
+    printf("idle_scan: wakes=%u/%d wake_to_report_us=%.1f active_to_report_us=%.1f\n",
+           wakes, IDLE_SAMPLES,
+           idle_samples ? (double) idle_total / idle_samples : -1.0,
+           active_samples ? (double) active_total / active_samples : -1.0);
+    bench_check(entered && idle_rate == 0, "idle_scan: scanning stops once idle");
+    bench_check(wakes == IDLE_SAMPLES && idle_samples == IDLE_SAMPLES && active_samples == IDLE_SAMPLES,
+                "idle_scan: every press wakes and is reported");
+}
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "config.h"
+#include "hal.h"
+#include "layer.h"
+#include "leader.h"
+#include "matrix.h"
+#include "sim.h"
+
+// Type leader sequences on the simulated matrix (Leader is on the Tab
+// position of LAYER_EXAMPLES) and check what comes out: a complete
+// sequence runs its action and sends none of its keys, a wrong key or
+// a pause ends it
+
+static uint8_t seen[NKRO_REPORT_BYTES];
+
+static void
+on_leader_report(uint64_t time_us, uint8_t report_id, const uint8_t *report, uint16_t len)
+{
+    (void) time_us;
+
+    for (int usage = 0; usage < 0xe0; ++usage)
+        if (bench_report_has_usage(report_id, report, len, usage))
+            seen[usage >> 3] |= 1 << (usage & 7);
+}
+
+static bool
+was_seen(uint8_t usage)
+{
+    return (seen[usage >> 3] >> (usage & 7)) & 1;
+}
+
+static void
+tap(int col, int row)
+{
+    sim_key_set(col, row, true);
+    bench_run_us(30000);
+    sim_key_set(col, row, false);
+    bench_run_us(30000);
+}
+
+static void
+leader(void)
+{
+    memset(seen, 0, sizeof(seen));
+    layer_on(LAYER_EXAMPLES);
+    tap(0, 2);
+    layer_off(LAYER_EXAMPLES);
+}
+
+#define TAP_B tap(6, 3)
+#define TAP_O tap(9, 1)
+#define TAP_T tap(5, 1)
+#define TAP_Q tap(1, 1)
+#define TAP_X tap(3, 3)
+
+void
+bench_leader(void)
+{
+    unsigned boots = sim_bootloader_requests();
+
+    sim_set_report_cb(on_leader_report);
+
+    leader();
+    TAP_B; TAP_O; TAP_O; TAP_T;
+    bool bootloader = sim_bootloader_requests() == boots + 1 && !was_seen(KEY_B) && !was_seen(KEY_T);
+
+    leader();
+    TAP_Q;
+    bool swallowed = !was_seen(KEY_Q);
+    TAP_B;
+    bench_run_us(200000);
+    bool macro = swallowed && was_seen(KEY_F) && !leader_active();
+
+    leader();
+    TAP_X; TAP_B;
+    bool wrong_key = !was_seen(KEY_X) && was_seen(KEY_B) && !leader_active();
+
+    leader();
+    TAP_B;
+    bench_run_us(LEADER_TIMEOUT_MS * 1000);
+    TAP_O; TAP_O; TAP_T;
+    bool timeout = sim_bootloader_requests() == boots + 1 && !was_seen(KEY_B) && was_seen(KEY_T);
+
+    sim_set_report_cb(NULL);
+    printf("leader: bootloader=%d macro=%d wrong_key=%d timeout=%d\n", bootloader, macro, wrong_key, timeout);
+    bench_check(bootloader && macro && wrong_key && timeout, "leader: sequences");
+}
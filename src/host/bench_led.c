@@ -0,0 +1,73 @@
+#include <stdio.h>
+
+#include "bench.h"
+#include "hal.h"
+#include "led.h"
+#include "sim.h"
+
+// Indicator LEDs: lock-state changes are a single output write, and
+// blink and breathe patterns keep playing with nothing in the loop
+// touching the LEDs. Duty is sampled once per LED_STEP_MS.
+
+#define LED_TOGGLES 1000000
+
+static const int pins[LED_COUNT] = { 25, 23 };
+
+// Share of one period the LED is fully on, and whether the duty only
+// rises then only falls; returns the output writes meanwhile
+static unsigned
+sample_period(enum led led, uint32_t period_ms, int *on_percent, bool *one_peak)
+{
+    unsigned writes = sim_led_writes();
+    int steps = period_ms / LED_STEP_MS, on = 0, falls = 0;
+    uint16_t last = sim_led_duty(led);
+
+    *one_peak = true;
+    for (int i = 0; i < steps; ++i) {
+        uint16_t duty = sim_led_duty(led);
+        on += duty == led_duty(255);
+        if (duty < last)
+            falls = 1;
+        else if (duty > last && falls)
+            *one_peak = false;
+        last = duty;
+        bench_run_us(LED_STEP_MS * 1000);
+    }
+    *on_percent = on * 100 / steps;
+    return sim_led_writes() - writes;
+}
+
+void
+bench_led(void)
+{
+    led_init(pins);
+
+    // a lock-state change, then the same state again
+    unsigned writes = sim_led_writes();
+    led_set(LED_NUMLOCK, LED_ON, LED_NUMLOCK_BRIGHTNESS, 0);
+    bool level_ok = sim_led_duty(LED_NUMLOCK) == led_duty(LED_NUMLOCK_BRIGHTNESS);
+    led_set(LED_NUMLOCK, LED_ON, LED_NUMLOCK_BRIGHTNESS, 0);
+    unsigned lock_writes = sim_led_writes() - writes;
+    led_set(LED_NUMLOCK, LED_OFF, 0, 0);
+    level_ok &= sim_led_duty(LED_NUMLOCK) == 0;
+
+    uint64_t start = bench_wall_ns();
+    for (int i = 0; i < LED_TOGGLES; ++i)
+        led_set(LED_NUMLOCK, i & 1 ? LED_OFF : LED_ON, LED_NUMLOCK_BRIGHTNESS, 0);
+    uint64_t wall = bench_wall_ns() - start;
+
+    int blink_on, breathe_on;
+    bool blink_peak, breathe_peak;
+    led_set(LED_STATUS, LED_BLINK, 255, 2000);
+    unsigned pattern_writes = sample_period(LED_STATUS, 2000, &blink_on, &blink_peak);
+    led_set(LED_STATUS, LED_BREATHE, 255, 3000);
+    pattern_writes += sample_period(LED_STATUS, 3000, &breathe_on, &breathe_peak);
+    led_set(LED_STATUS, LED_OFF, 0, 0);
+
+    printf("led: level=%d lock_writes=%u host_ns_per_lock_change=%.1f blink_on_percent=%d "
+           "blink_single_peak=%d breathe_single_peak=%d writes_while_playing=%u\n",
+           level_ok, lock_writes, (double) wall / LED_TOGGLES, blink_on,
+           blink_peak, breathe_peak, pattern_writes);
+    bench_check(level_ok && lock_writes == 1, "led: lock state levels");
+    bench_check(blink_peak && breathe_peak && pattern_writes == 0, "led: patterns play on their own");
+}
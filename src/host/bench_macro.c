@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "config.h"
+#include "hal.h"
+#include "macro.h"
+#include "sim.h"
+#include "usb_descriptors.h"
+
+// Type the text macro repeatedly and replay the report stream the way a
+// host does, taking the keys that went down in each report in usage
+// order, to check the packed runs decode to the original text
+#define BENCH_MACRO 1
+#define BENCH_MACRO_RUNS 10
+
+static uint8_t prev_report[NKRO_REPORT_BYTES];
+static char typed[1024];
+static int n_typed;
+static int n_reports;
+static uint64_t last_report_us;
+
+static char
+usage_char(uint8_t usage, bool shift)
+{
+    if (usage >= KEY_A && usage <= KEY_Z)
+        return (shift ? 'A' : 'a') + usage - KEY_A;
+    if (usage >= KEY_1 && usage <= KEY_9)
+        return '1' + usage - KEY_1;
+
+    switch (usage) {
+    case KEY_0:     return '0';
+    case KEY_SPACE: return ' ';
+    case KEY_DOT:   return shift ? '>' : '.';
+    case KEY_ENTER: return '\n';
+    default:        return '?';
+    }
+}
+
+static void
+on_macro_report(uint64_t time_us, uint8_t report_id, const uint8_t *boot, uint16_t len)
+{
+    uint8_t report[NKRO_REPORT_BYTES] = { 0 };
+
+    if (report_id == REPORT_ID_KEYBOARD_NKRO) {
+        memcpy(report, boot, len);
+    } else {
+        report[0xe0 >> 3] = boot[0];
+        for (int i = 2; i < len; ++i)
+            report[boot[i] >> 3] |= 1 << (boot[i] & 7);
+    }
+    len = sizeof(report);
+
+    bool shift = bench_report_has_usage(REPORT_ID_KEYBOARD_NKRO, report, len, KEY_LEFTSHIFT);
+
+    for (int usage = KEY_A; usage < 0xe0; ++usage) {
+        bool down = (report[usage >> 3] >> (usage & 7)) & 1;
+        bool was_down = (prev_report[usage >> 3] >> (usage & 7)) & 1;
+        if (down && !was_down && n_typed < (int) sizeof(typed) - 1)
+            typed[n_typed++] = usage_char(usage, shift);
+    }
+    memcpy(prev_report, report, len);
+    n_reports++;
+    last_report_us = time_us;
+}
+
+static void
+bench_macro_protocol(bool boot)
+{
+    const char *text = macro_text[0];
+    int expected_len = strlen(text) * BENCH_MACRO_RUNS;
+    bool match = true;
+
+    // let keys from earlier runs settle first
+    sim_set_boot_protocol(boot);
+    bench_run_us(100000);
+    sim_set_report_cb(on_macro_report);
+    memset(prev_report, 0, sizeof(prev_report));
+    n_typed = 0;
+    n_reports = 0;
+
+    uint64_t start_us = hal_time_us();
+    for (int run = 0; run < BENCH_MACRO_RUNS; ++run) {
+        macro_start(BENCH_MACRO);
+        while (macro_busy())
+            bench_loop_tick();
+    }
+    bench_run_us(10000);
+    sim_set_report_cb(NULL);
+    sim_set_boot_protocol(false);
+
+    for (int i = 0; i < n_typed; ++i)
+        if (typed[i] != text[i % strlen(text)])
+            match = false;
+
+    double seconds = (last_report_us - start_us) / 1e6;
+    printf("macro: protocol=%s keys_per_report=%d chars=%d typed=%d match=%d reports=%d chars_per_second=%.0f reports_per_second=%.0f\n",
+           boot ? "boot" : "report", MACRO_TEXT_KEYS_PER_REPORT, expected_len, n_typed, match && n_typed == expected_len, n_reports,
+           n_typed / seconds, n_reports / seconds);
+    bench_check(match && n_typed == expected_len, boot ? "macro: boot protocol text" : "macro: report protocol text");
+}
+
+void
+bench_macro(void)
+{
+    bench_macro_protocol(false);
+    bench_macro_protocol(true);
+}
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "config.h"
+#include "hal.h"
+#include "latency.h"
+#include "layer.h"
+#include "mouse.h"
+#include "sim.h"
+#include "usb_descriptors.h"
+
+// The example media and mouse keys through the whole pipeline: a
+// volume tap reaching the host as a press and a release, the pointer
+// ramping from its starting to its top speed, diagonal motion scaled
+// down, the wheel, a button click, and the endpoint shared between the
+// three reports: keyboard and media key latency with the pointer
+// moving, against the keyboard alone.
+
+#define MOVE_MS   1500
+#define BUCKET_MS 100
+#define N_BUCKETS (MOVE_MS / BUCKET_MS)
+
+#define LATENCY_SAMPLES 20
+
+// LAYER_EXAMPLES positions, and a key that falls through to layer 0
+#define VOLUP_COL   4
+#define VOLUP_ROW   1
+#define MS_DOWN_COL 3
+#define MS_RIGHT_COL 5
+#define MS_BTN1_COL 6
+#define MS_WH_UP_COL 10
+#define MOUSE_ROW   3
+#define PLAIN_COL   1
+#define PLAIN_ROW   1
+
+static uint64_t start_us;
+static int32_t x_bucket[N_BUCKETS];
+static int32_t total_x, total_y, total_wheel;
+static int mouse_reports;
+static uint8_t buttons_seen[8];
+static int n_buttons_seen;
+static uint16_t consumer_seen[8];
+static int n_consumer_seen;
+
+static uint8_t watch_usage;
+static uint16_t watch_consumer;
+static bool watch_seen;
+static uint64_t watch_us;
+
+static void
+on_report(uint64_t time_us, uint8_t report_id, const uint8_t *report, uint16_t len)
+{
+    if (report_id == REPORT_ID_MOUSE && len == sizeof(struct mouse_report)) {
+        struct mouse_report mouse;
+        memcpy(&mouse, report, sizeof(mouse));
+
+        int bucket = (time_us - start_us) / (BUCKET_MS * 1000);
+        if (bucket >= 0 && bucket < N_BUCKETS)
+            x_bucket[bucket] += mouse.x;
+        total_x += mouse.x;
+        total_y += mouse.y;
+        total_wheel += mouse.wheel;
+        mouse_reports++;
+        if (n_buttons_seen < 8 && (n_buttons_seen == 0 || buttons_seen[n_buttons_seen - 1] != mouse.buttons))
+            buttons_seen[n_buttons_seen++] = mouse.buttons;
+        return;
+    }
+
+    if (report_id == REPORT_ID_CONSUMER_CONTROL && len == 2) {
+        uint16_t usage = report[0] | report[1] << 8;
+        if (n_consumer_seen < 8)
+            consumer_seen[n_consumer_seen++] = usage;
+        if (!watch_seen && watch_consumer && usage == watch_consumer) {
+            watch_seen = true;
+            watch_us = time_us;
+        }
+        return;
+    }
+
+    if (!watch_seen && watch_usage && bench_report_has_usage(report_id, report, len, watch_usage)) {
+        watch_seen = true;
+        watch_us = time_us;
+    }
+}
+
+static void
+reset_counts(void)
+{
+    memset(x_bucket, 0, sizeof(x_bucket));
+    total_x = total_y = total_wheel = 0;
+    mouse_reports = 0;
+    n_buttons_seen = n_consumer_seen = 0;
+    start_us = hal_time_us();
+}
+
+static void
+tap(int col, int row)
+{
+    sim_key_set(col, row, true);
+    bench_run_us(30000);
+    sim_key_set(col, row, false);
+    bench_run_us(30000);
+}
+
+// Hold keys on the mouse row for a while
+static void
+hold(const int *cols, int n, int ms)
+{
+    for (int i = 0; i < n; ++i)
+        sim_key_set(cols[i], MOUSE_ROW, true);
+    bench_run_us(ms * 1000ull);
+    for (int i = 0; i < n; ++i)
+        sim_key_set(cols[i], MOUSE_ROW, false);
+    bench_run_us(30000);
+}
+
+// Press a key at a random point in the scan interval and return how
+// long its press took to show up in a report
+static int64_t
+press_latency(int col, int row, uint8_t usage, uint16_t consumer)
+{
+    uint64_t change_us;
+
+    sim_advance_us(rand() % SCAN_INTERVAL_US);
+    watch_usage = usage;
+    watch_consumer = consumer;
+    watch_seen = false;
+    sim_key_set(col, row, true);
+    change_us = hal_time_us();
+    while (!watch_seen && hal_time_us() - change_us < 50000)
+        bench_loop_tick();
+    sim_key_set(col, row, false);
+    bench_run_us(20000);
+    watch_usage = 0;
+    watch_consumer = 0;
+    return watch_seen ? (int64_t) (watch_us - change_us) : -1;
+}
+
+// Longest a keyboard report waited for the endpoint after debouncing
+// accepted its key, over the presses since the last call
+static uint32_t
+queue_max_us(void)
+{
+    uint32_t samples, max_us;
+
+    latency_summary(LATENCY_QUEUE, &samples, &max_us);
+    latency_reset();
+    return max_us;
+}
+
+static double
+average_latency(int col, int row, uint8_t usage, uint16_t consumer)
+{
+    int64_t total = 0;
+    int samples = 0;
+
+    for (int i = 0; i < LATENCY_SAMPLES; ++i) {
+        int64_t latency = press_latency(col, row, usage, consumer);
+        if (latency >= 0) {
+            total += latency;
+            samples++;
+        }
+    }
+    return samples ? (double) total / samples : -1;
+}
+
+void
+bench_mouse(void)
+{
+    static const int right[] = { MS_RIGHT_COL };
+    static const int diagonal[] = { MS_RIGHT_COL, MS_DOWN_COL };
+    static const int wheel[] = { MS_WH_UP_COL };
+
+    srand(7);
+    sim_keys_clear();
+    sim_set_report_cb(on_report);
+    layer_on(LAYER_EXAMPLES);
+    bench_run_us(30000);
+
+    reset_counts();
+    tap(VOLUP_COL, VOLUP_ROW);
+    bool consumer_ok = n_consumer_seen == 2 && consumer_seen[0] == CONSUMER_VOLUME_UP &&
+                       consumer_seen[1] == 0;
+
+    reset_counts();
+    tap(MS_BTN1_COL, MOUSE_ROW);
+    bool click_ok = n_buttons_seen == 2 && buttons_seen[0] == 1 && buttons_seen[1] == 0 &&
+                    total_x == 0 && total_y == 0;
+
+    // speed in px/s over the first and last bucket, never slowing down
+    reset_counts();
+    hold(right, 1, MOVE_MS);
+    bool ramp_ok = total_y == 0;
+    for (int i = 1; i < N_BUCKETS; ++i)
+        ramp_ok &= x_bucket[i] >= x_bucket[i - 1];
+    int32_t straight_x = total_x;
+    int first_px_s = x_bucket[0] * 1000 / BUCKET_MS;
+    int last_px_s = x_bucket[N_BUCKETS - 1] * 1000 / BUCKET_MS;
+    double reports_per_s = mouse_reports * 1000.0 / MOVE_MS;
+
+    reset_counts();
+    hold(diagonal, 2, MOVE_MS);
+    double diagonal_ratio = straight_x ? (double) total_x / straight_x : 0;
+    bool diagonal_ok = abs(total_x - total_y) <= 2;
+
+    reset_counts();
+    hold(wheel, 1, 1000);
+    int notches = total_wheel;
+
+    // the endpoint shared: keyboard alone, then keyboard and media keys
+    // with the pointer moving at top speed the whole time. End to end
+    // latency depends on where the scans fall against the host's polls;
+    // the wait after debouncing is what a busy endpoint would add.
+    queue_max_us();
+    double keyboard_alone_us = average_latency(PLAIN_COL, PLAIN_ROW, KEY_Q, 0);
+    uint32_t queue_alone_us = queue_max_us();
+    sim_key_set(MS_RIGHT_COL, MOUSE_ROW, true);
+    bench_run_us(MOUSE_ACCEL_MS * 1000ull);
+    reset_counts();
+    queue_max_us();
+    double keyboard_moving_us = average_latency(PLAIN_COL, PLAIN_ROW, KEY_Q, 0);
+    uint32_t queue_moving_us = queue_max_us();
+    double media_moving_us = average_latency(VOLUP_COL, VOLUP_ROW, 0, CONSUMER_VOLUME_UP);
+    uint64_t moving_ms = (hal_time_us() - start_us) / 1000;
+    int moving_reports = mouse_reports;
+    sim_key_set(MS_RIGHT_COL, MOUSE_ROW, false);
+
+    sim_keys_clear();
+    layer_off(LAYER_EXAMPLES);
+    bench_run_us(30000);
+    sim_set_report_cb(NULL);
+
+    printf("mouse: consumer=%d click=%d ramp=%d px_per_s first=%d last=%d reports_per_s=%.0f "
+           "diagonal=%d diagonal_ratio=%.3f wheel_notches_per_s=%d\n",
+           consumer_ok, click_ok, ramp_ok, first_px_s, last_px_s, reports_per_s,
+           diagonal_ok, diagonal_ratio, notches);
+    printf("mouse: latency_us keyboard_alone=%.1f keyboard_moving=%.1f media_moving=%.1f "
+           "queue_max_us alone=%u moving=%u mouse_reports_per_s_moving=%.0f\n",
+           keyboard_alone_us, keyboard_moving_us, media_moving_us,
+           (unsigned) queue_alone_us, (unsigned) queue_moving_us,
+           moving_ms ? moving_reports * 1000.0 / moving_ms : 0.0);
+    bench_check(consumer_ok && click_ok, "mouse: media tap and button click");
+    bench_check(ramp_ok && diagonal_ok && notches > 0, "mouse: pointer and wheel motion");
+    bench_check(queue_moving_us <= queue_alone_us, "mouse: keyboard reports keep their priority");
+}
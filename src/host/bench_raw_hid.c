@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "config.h"
+#include "hal.h"
+#include "matrix.h"
+#include "raw_client.h"
+#include "raw_hid.h"
+#include "sched.h"
+#include "sim.h"
+#include "store.h"
+
+// Drive the raw HID interface through the reference client, with the
+// simulated endpoints as transport: keymap read, write and commit down
+// to a remapped key press, matrix snapshots and streaming, counters,
+// settle delays, trace pull, and keyboard latency with and without the
+// matrix stream running
+
+#define RECV_TIMEOUT_US 100000
+
+#define REMAP_COL 1
+#define REMAP_ROW 2
+
+// Packets delivered by the raw IN endpoint and not yet received
+#define RAW_INBOX_SIZE 16
+
+static uint8_t inbox[RAW_INBOX_SIZE][RAW_HID_REPORT_LEN];
+static int inbox_head, inbox_len;
+static int streamed, streamed_with_key;
+
+static void
+on_raw_report(uint64_t time_us, const uint8_t *report, uint16_t len)
+{
+    (void) time_us;
+
+    if (inbox_len < RAW_INBOX_SIZE && len == RAW_HID_REPORT_LEN)
+        memcpy(inbox[(inbox_head + inbox_len++) % RAW_INBOX_SIZE], report, len);
+}
+
+static bool
+sim_send(void *ctx, const uint8_t *report)
+{
+    (void) ctx;
+
+    raw_hid_receive(report, RAW_HID_REPORT_LEN);
+    return true;
+}
+
+static bool
+sim_recv(void *ctx, uint8_t *report)
+{
+    uint64_t start = hal_time_us();
+    (void) ctx;
+
+    while (inbox_len == 0 && hal_time_us() - start < RECV_TIMEOUT_US)
+        bench_loop_tick();
+    if (inbox_len == 0)
+        return false;
+
+    memcpy(report, inbox[inbox_head], RAW_HID_REPORT_LEN);
+    inbox_head = (inbox_head + 1) % RAW_INBOX_SIZE;
+    inbox_len--;
+    return true;
+}
+
+static bool
+matrix_has_key(const struct raw_hid_matrix *matrix, int key)
+{
+    return (matrix->w[key >> 5] >> (key & 31)) & 1;
+}
+
+static void
+on_matrix(void *ctx, const struct raw_hid_matrix *matrix)
+{
+    (void) ctx;
+
+    streamed++;
+    streamed_with_key += matrix_has_key(matrix, KEY_INDEX(REMAP_COL, REMAP_ROW));
+}
+
+static uint8_t watch_usage;
+static bool watch_seen;
+static uint64_t watch_us;
+
+static void
+on_keyboard_report(uint64_t time_us, uint8_t report_id, const uint8_t *report, uint16_t len)
+{
+    if (!watch_seen && bench_report_has_usage(report_id, report, len, watch_usage)) {
+        watch_seen = true;
+        watch_us = time_us;
+    }
+}
+
+// Press the remap key and return the press-to-report latency of usage,
+// or -1 if it never showed up
+static int64_t
+press_latency(uint8_t usage)
+{
+    uint64_t start;
+
+    watch_usage = usage;
+    watch_seen = false;
+    sim_key_set(REMAP_COL, REMAP_ROW, true);
+    start = hal_time_us();
+    while (!watch_seen && hal_time_us() - start < 50000)
+        bench_loop_tick();
+    sim_key_set(REMAP_COL, REMAP_ROW, false);
+    bench_run_us(30000);
+    return watch_seen ? (int64_t) (watch_us - start) : -1;
+}
+
+// Average latency over a fixed set of presses, with the matrix
+// streaming every change when stream is set
+static double
+average_latency(struct raw_client *client, uint8_t usage, bool stream)
+{
+    struct raw_hid_matrix matrix;
+    int64_t total = 0;
+    int samples = 0;
+
+    raw_client_matrix(client, stream ? 1 : 0, &matrix);
+    for (int i = 0; i < 50; ++i) {
+        sim_advance_us(i * 37 % SCAN_INTERVAL_US);
+        int64_t latency = press_latency(usage);
+        if (latency >= 0) {
+            total += latency;
+            samples++;
+        }
+        // drain the stream so the inbox never fills
+        while (inbox_len)
+            raw_client_poll(client);
+    }
+    raw_client_matrix(client, 0, &matrix);
+    return samples ? (double) total / samples : -1;
+}
+
+void
+bench_raw_hid(void)
+{
+    struct raw_client client = { .send = sim_send, .recv = sim_recv, .on_matrix = on_matrix };
+    struct raw_hid_hello hello = { 0 };
+    int remap_key = KEY_INDEX(REMAP_COL, REMAP_ROW);
+    uint8_t original = ACTION_ARG(store_keymap()[0][remap_key]);
+    uint32_t sequence = 0;
+
+    sim_set_raw_report_cb(on_raw_report);
+    sim_set_report_cb(on_keyboard_report);
+    bench_run_us(30000);
+
+    bool hello_ok = raw_client_hello(&client, &hello) == RAW_OK && hello.n_layers == N_LAYERS &&
+                    hello.n_cols == N_COLS && hello.n_rows == N_ROWS && hello.n_keys == N_KEYS;
+
+    // the whole keymap, several packets per layer
+    action_t actions[N_KEYS];
+    bool read_ok = true;
+    for (int layer = 0; layer < N_LAYERS; ++layer)
+        read_ok &= raw_client_keymap_read(&client, layer, 0, N_KEYS, actions) == RAW_OK &&
+                   memcmp(actions, store_keymap()[layer], sizeof(actions)) == 0;
+
+    // a pending write reads back but changes nothing until committed
+    action_t remapped = KEY_B;
+    bool write_ok = raw_client_keymap_write(&client, 0, remap_key, 1, &remapped) == RAW_OK &&
+                    raw_client_keymap_read(&client, 0, remap_key, 1, actions) == RAW_OK &&
+                    actions[0] == KEY_B && press_latency(original) >= 0;
+    bool commit_ok = raw_client_commit(&client, &sequence) == RAW_OK && sequence == 1 &&
+                     press_latency(KEY_B) >= 0;
+
+    struct raw_hid_packet packet = { .header.command = 0x7f };
+    bool errors_ok = raw_client_keymap_write(&client, N_LAYERS, 0, 1, &remapped) == RAW_ERR_RANGE &&
+                     raw_client_keymap_read(&client, 0, N_KEYS - 1, 2, actions) == RAW_ERR_RANGE &&
+                     raw_client_request(&client, &packet) == RAW_ERR_COMMAND;
+
+    // actions the layout would fail to build with are refused whole,
+    // leaving the keymap as it was
+    static const action_t bad[] = {
+        ACTION(ACT_TAG_LAYER, N_LAYERS), ACTION(ACT_TAG_LAYER, 0x300),
+        ACTION(ACT_TAG_MACRO, N_MACROS), ACTION(ACT_TAG_MOD_TAP, KEY_A),
+        ACTION(ACT_TAG_LAYER_TAP, N_LAYERS << 8 | KEY_A), ACTION(ACT_TAG_MOD_TAP, 0x1e0),
+        ACTION(ACT_TAG_CONSUMER, 0), ACTION(ACT_TAG_MOUSE, MS_COUNT), ACTION(ACT_TAG_SYSTEM, 2),
+        ACTION(0xa, 0),
+    };
+    for (unsigned i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i)
+        errors_ok &= raw_client_keymap_write(&client, 0, remap_key, 1, &bad[i]) == RAW_ERR_RANGE;
+    action_t partly_bad[] = { KEY_C, ACTION(ACT_TAG_LAYER, N_LAYERS) };
+    errors_ok &= raw_client_keymap_write(&client, 0, remap_key, 2, partly_bad) == RAW_ERR_RANGE &&
+                 raw_client_keymap_read(&client, 0, remap_key, 1, actions) == RAW_OK &&
+                 actions[0] == KEY_B;
+
+    // snapshot with the key held, then stream a few presses
+    struct raw_hid_matrix matrix;
+    sim_key_set(REMAP_COL, REMAP_ROW, true);
+    bench_run_us(30000);
+    bool snapshot_ok = raw_client_matrix(&client, 0, &matrix) == RAW_OK &&
+                       matrix.n_words == MATRIX_WORDS && matrix_has_key(&matrix, remap_key);
+    sim_key_set(REMAP_COL, REMAP_ROW, false);
+    bench_run_us(30000);
+
+    streamed = streamed_with_key = 0;
+    raw_client_matrix(&client, 10, &matrix);
+    for (int i = 0; i < 5; ++i) {
+        sim_key_set(REMAP_COL, REMAP_ROW, true);
+        bench_run_us(30000);
+        sim_key_set(REMAP_COL, REMAP_ROW, false);
+        bench_run_us(30000);
+    }
+    raw_client_matrix(&client, 0, &matrix);
+    while (inbox_len)
+        raw_client_poll(&client);
+    int stream_packets = streamed, stream_pressed = streamed_with_key;
+
+    struct raw_hid_counters counters = { 0 };
+    bool counters_ok = raw_client_counters(&client, &counters) == RAW_OK && counters.scans != 0 &&
+                       counters.events != 0;
+
+    // every task of the host scheduler, a page at a time; no core1
+    struct raw_hid_tasks tasks = { 0 };
+    const struct sched *s = bench_scheduler();
+    bool tasks_ok = raw_client_tasks(&client, 1, 0, &tasks) == RAW_ERR_RANGE;
+    for (int first = 0; tasks_ok && first < s->n_tasks; first += tasks.count) {
+        tasks_ok = raw_client_tasks(&client, 0, first, &tasks) == RAW_OK && tasks.count > 0 &&
+                   tasks.n_tasks == s->n_tasks && tasks.wakes != 0;
+        for (int i = 0; tasks_ok && i < tasks.count; ++i)
+            tasks_ok = strncmp(tasks.tasks[i].name, s->tasks[first + i].name, RAW_HID_TASK_NAME_LEN) == 0 &&
+                       tasks.tasks[i].runs != 0;
+    }
+
+    // the settle delays calibrated so far, then saved into the store
+    struct raw_hid_settle settle = { 0 };
+    bool settle_ok = raw_client_settle(&client, false, &settle) == RAW_OK && settle.n_cols == N_COLS &&
+                     settle.scan_us < settle.default_scan_us &&
+                     raw_client_settle(&client, true, &settle) == RAW_OK && settle.sequence == sequence + 1 &&
+                     memcmp(store_settings()->settle_drive_us, settle.drive_us, N_COLS) == 0 &&
+                     memcmp(store_settings()->settle_release_us, settle.release_us, N_COLS) == 0;
+
+    // a burst of records, less whatever the UART takes meanwhile
+    struct trace_record records[64];
+    int n_records = 0;
+    for (int i = 0; i < 32; ++i)
+        trace(TRACE_MACRO, i, 0);
+    bool trace_ok = raw_client_trace(&client, records, 64, &n_records) == RAW_OK && n_records > 0;
+    for (int i = 0; i < n_records; ++i)
+        trace_ok &= records[i].id < TRACE_EVENT_COUNT;
+
+    double quiet_us = average_latency(&client, KEY_B, false);
+    streamed = 0;
+    double streaming_us = average_latency(&client, KEY_B, true);
+    int streamed_during_latency = streamed;
+
+    // an answer the endpoint refuses is sent again, not worked out again
+    uint32_t generation = store_generation();
+    sim_raw_report_refuse(2);
+    bool reset_ok = raw_client_reset(&client, &sequence) == RAW_OK && sequence == 0 &&
+                    store_generation() == generation + 1 && press_latency(original) >= 0;
+
+    sim_set_raw_report_cb(NULL);
+    sim_set_report_cb(NULL);
+
+    printf("raw_hid: hello=%d keymap_read=%d pending_write=%d commit=%d errors=%d snapshot=%d "
+           "stream_packets=%d stream_pressed=%d counters=%d tasks=%d settle=%d trace=%d trace_records=%d reset=%d\n",
+           hello_ok, read_ok, write_ok, commit_ok, errors_ok, snapshot_ok, stream_packets,
+           stream_pressed, counters_ok, tasks_ok, settle_ok, trace_ok, n_records, reset_ok);
+    bench_check(hello_ok && read_ok && write_ok && commit_ok && errors_ok && snapshot_ok &&
+                counters_ok && tasks_ok && settle_ok && trace_ok && reset_ok, "raw_hid: commands");
+    bench_check(stream_packets == 10 && stream_pressed == 5, "raw_hid: one stream packet per change");
+    printf("raw_hid: keyboard_latency_us quiet=%.1f streaming=%.1f streamed_packets=%d\n",
+           quiet_us, streaming_us, streamed_during_latency);
+}
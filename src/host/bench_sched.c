@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "config.h"
+#include "hal.h"
+#include "keyboard.h"
+#include "matrix.h"
+#include "sched.h"
+#include "sim.h"
+#include "store.h"
+
+// The scheduler left to sleep as long as it likes in virtual time:
+// wake-ups and busy time per second while typing, while the keyboard
+// lingers with nothing pressed and once it is idle, plus press-to-report
+// latency, against the 20000 passes a second of the old 50 us loop.
+
+#define TYPE_COL 1
+#define TYPE_ROW 2
+
+#define LATENCY_SAMPLES 100
+
+struct window {
+    uint32_t wakes;
+    uint64_t busy_us;
+    uint64_t start_us;
+};
+
+static uint8_t watch_usage;
+static bool watch_seen;
+static uint64_t watch_us;
+
+static void
+on_report(uint64_t time_us, uint8_t report_id, const uint8_t *report, uint16_t len)
+{
+    if (!watch_seen && bench_report_has_usage(report_id, report, len, watch_usage)) {
+        watch_seen = true;
+        watch_us = time_us;
+    }
+}
+
+// Passes and sleeps with no cap, until end_us or the usage shows up
+static void
+run_until(uint64_t end_us, bool stop_on_report)
+{
+    struct sched *s = bench_scheduler();
+
+    while (hal_time_us() < end_us && !(stop_on_report && watch_seen)) {
+        uint64_t next_us = sched_pass(s);
+        hal_wait_until(next_us < end_us ? next_us : end_us);
+    }
+}
+
+static void
+window_start(struct window *w)
+{
+    const struct sched *s = bench_scheduler();
+
+    w->wakes = s->wakes;
+    w->busy_us = s->busy_us;
+    w->start_us = hal_time_us();
+}
+
+static void
+window_print(const char *name, const struct window *w)
+{
+    const struct sched *s = bench_scheduler();
+    double seconds = (hal_time_us() - w->start_us) / 1e6;
+
+    printf("sched: phase=%s wakes_per_s=%.0f busy_percent=%.1f\n", name,
+           (s->wakes - w->wakes) / seconds, 100.0 * (s->busy_us - w->busy_us) / (hal_time_us() - w->start_us));
+}
+
+static void
+type_for(uint64_t us)
+{
+    uint64_t end_us = hal_time_us() + us;
+
+    while (hal_time_us() < end_us) {
+        sim_key_set(TYPE_COL, TYPE_ROW, true);
+        run_until(hal_time_us() + 30000, false);
+        sim_key_set(TYPE_COL, TYPE_ROW, false);
+        run_until(hal_time_us() + 30000, false);
+    }
+}
+
+void
+bench_sched(void)
+{
+    struct sched *s = bench_scheduler();
+    struct sched_stats before[8];
+    struct window w;
+    int64_t total = 0;
+    int samples = 0;
+
+    srand(4);
+    watch_usage = ACTION_ARG(store_keymap()[0][KEY_INDEX(TYPE_COL, TYPE_ROW)]);
+    sim_set_report_cb(on_report);
+    sim_keys_clear();
+    for (int i = 0; i < s->n_tasks; ++i)
+        before[i] = s->tasks[i].stats;
+
+    window_start(&w);
+    type_for(1000000);
+    window_print("typing", &w);
+
+    window_start(&w);
+    run_until(hal_time_us() + IDLE_LINGER_MS * 1000ull / 2, false);
+    window_print("lingering", &w);
+
+    run_until(hal_time_us() + IDLE_LINGER_MS * 1000ull, false);
+    window_start(&w);
+    run_until(hal_time_us() + 1000000, false);
+    window_print(keyboard_idle() ? "idle" : "not_idle", &w);
+
+    // presses at random points in the scan interval
+    for (int i = 0; i < LATENCY_SAMPLES; ++i) {
+        sim_advance_us(rand() % SCAN_INTERVAL_US);
+        watch_seen = false;
+        sim_key_set(TYPE_COL, TYPE_ROW, true);
+        uint64_t start = hal_time_us();
+        run_until(start + 50000, true);
+        if (watch_seen) {
+            total += watch_us - start;
+            samples++;
+        }
+        sim_key_set(TYPE_COL, TYPE_ROW, false);
+        run_until(hal_time_us() + 30000, false);
+    }
+    sim_set_report_cb(NULL);
+
+    printf("sched: latency_samples=%d avg_us=%.1f loop_passes_per_s_before=%d\n",
+           samples, samples ? (double) total / samples : -1.0, 1000000 / 50);
+    for (int i = 0; i < s->n_tasks; ++i) {
+        const struct sched_stats *stats = &s->tasks[i].stats;
+        printf("sched: task=%s runs=%u late=%u max_us=%u\n",
+               s->tasks[i].name, stats->runs - before[i].runs, stats->late - before[i].late,
+               stats->max_us);
+    }
+}
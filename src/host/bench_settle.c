@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "config.h"
+#include "hal.h"
+#include "matrix.h"
+#include "sim.h"
+
+// Settle calibration on the simulated board from bench_settle_profile():
+// scan time at boot with the default delays and after a calibration
+// with a key down on every column, reads checked against the switches
+// on random matrices before and after, and a column that gets slower
+// raising its delays at the next calibration. Scans are driven
+// directly, so none of this reaches the keymap.
+
+#define SETTLE_SCANS 1500
+
+#define SLOW_COL 3
+
+static uint8_t
+profile_rise_us(int col)
+{
+    return 1 + col % 4;
+}
+
+static uint8_t
+profile_fall_us(int col)
+{
+    return col % 3;
+}
+
+void
+bench_settle_profile(void)
+{
+    for (int col = 0; col < N_COLS; ++col)
+        sim_set_settle_us(col, profile_rise_us(col), profile_fall_us(col));
+}
+
+// Scans of random matrices that did not read back what was pressed
+static int
+misreads(int iterations)
+{
+    int wrong = 0;
+
+    for (int i = 0; i < iterations; ++i) {
+        matrix_t expected = { 0 }, m;
+
+        sim_keys_clear();
+        for (int n = rand() % 11; n > 0; --n) {
+            int col = rand() % N_COLS, row = rand() % N_ROWS;
+            sim_key_set(col, row, true);
+            matrix_set_key(&expected, KEY_INDEX(col, row));
+        }
+        matrix_scan(&m);
+        wrong += memcmp(&m, &expected, sizeof(m)) != 0;
+    }
+    sim_keys_clear();
+    return wrong;
+}
+
+static void
+scan_held(int scans)
+{
+    matrix_t m;
+
+    for (int i = 0; i < scans; ++i)
+        matrix_scan(&m);
+}
+
+void
+bench_settle(int iterations)
+{
+    const struct matrix_settle *settle = matrix_settle();
+
+    srand(5);
+
+    // boot again with nothing held: nothing to measure yet
+    sim_keys_clear();
+    matrix_init();
+    uint32_t calibrated_at_boot = settle->calibrated;
+    int before = misreads(iterations);
+
+    for (int col = 0; col < N_COLS; ++col)
+        sim_key_set(col, col % N_ROWS, true);
+    scan_held(SETTLE_SCANS);
+    sim_keys_clear();
+    scan_held(1);
+
+    bool covered = true;
+    int calibrated = 0;
+    for (int col = 0; col < N_COLS; ++col) {
+        covered &= settle->drive_us[col] > profile_rise_us(col) &&
+                   settle->release_us[col] > profile_fall_us(col);
+        calibrated += (settle->calibrated >> col) & 1;
+    }
+    uint32_t scan_us = settle->scan_us;
+    int after = misreads(iterations);
+
+    // the delays follow a column that got slower, and nothing lowers
+    // them again once it is back to normal
+    sim_set_settle_us(SLOW_COL, 7, 5);
+    sim_key_set(SLOW_COL, 0, true);
+    scan_held(SETTLE_SCANS);
+    bool raised = settle->drive_us[SLOW_COL] > 7 && settle->release_us[SLOW_COL] > 5;
+    bench_settle_profile();
+    scan_held(SETTLE_SCANS);
+    raised &= settle->drive_us[SLOW_COL] > 7;
+    sim_keys_clear();
+    scan_held(1);
+
+    printf("settle: calibrated_at_boot=%u columns=%d/%d covered=%d calibrations=%u raised=%d\n",
+           (unsigned) __builtin_popcount(calibrated_at_boot), calibrated, N_COLS, covered,
+           settle->calibrations, raised);
+    printf("settle: scan_us default=%u calibrated=%u now=%u misreads before=%d after=%d\n",
+           settle->default_scan_us, scan_us, settle->scan_us, before, after);
+    bench_check(covered && calibrated == N_COLS && raised, "settle: calibration");
+    bench_check(after == 0, "settle: no misreads once calibrated");
+}
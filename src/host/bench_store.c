@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "config.h"
+#include "layer.h"
+#include "macro.h"
+#include "matrix.h"
+#include "sim.h"
+#include "store.h"
+
+// Exercise the flash store against the RAM-backed region: commit and
+// reload, wear levelling, power loss in the middle of a commit, a
+// corrupted image and a format change
+
+#define STORE_COMMITS 200
+
+#define KEY_UNDER_TEST KEY_INDEX(1, 2)
+
+static bool
+keymap_is(action_t action)
+{
+    return store_keymap()[0][KEY_UNDER_TEST] == action;
+}
+
+static bool
+commit_key(action_t action)
+{
+    store_edit()->actions[0][KEY_UNDER_TEST] = action;
+    return store_commit();
+}
+
+void
+bench_store(void)
+{
+    sim_flash_reset();
+    store_init();
+    bool defaults = store_sequence() == 0 && keymap_is(action_table[0][KEY_UNDER_TEST]) && store_macro(0) != NULL &&
+                    memcmp(store_macro(0), macros[0], macro_code_length(macros[0], STORE_MACRO_BYTES)) == 0;
+
+    // commit, then reload as after a reboot
+    static const uint8_t str_macro[] = { MACRO_OP_STR, 'h', 'i', 0, MACRO_OP_END };
+    struct store_image *image = store_edit();
+    image->actions[0][KEY_UNDER_TEST] = KEY_B;
+    image->macro_offset[2] = 512;
+    memcpy(&image->macro_code[512], str_macro, sizeof(str_macro));
+    bool committed = store_commit();
+    store_init();
+    bool reloaded = committed && store_sequence() == 1 && keymap_is(KEY_B) &&
+                    store_macro(0) != NULL && macro_code_length(store_macro(0), STORE_MACRO_BYTES) ==
+                    macro_code_length(macros[0], STORE_MACRO_BYTES) &&
+                    memcmp(store_macro(2), str_macro, sizeof(str_macro)) == 0;
+
+    // wear levelling: every sector takes its share of the erases
+    for (int i = 0; i < STORE_COMMITS; ++i)
+        commit_key(i & 1 ? KEY_C : KEY_D);
+    unsigned min_erases = ~0u, max_erases = 0;
+    for (int sector = 0; sector < HAL_FLASH_SECTORS; ++sector) {
+        unsigned erases = sim_flash_erase_count(sector);
+        if (erases < min_erases) min_erases = erases;
+        if (erases > max_erases) max_erases = erases;
+    }
+
+    // power lost partway through every page of a commit: the previous
+    // image must survive each time
+    int power_fail_ok = 0, power_fail_cases = 0;
+    for (long bytes = 0; bytes < (long) sizeof(struct store_image); bytes += 97) {
+        uint32_t sequence = store_sequence();
+        action_t before = store_keymap()[0][KEY_UNDER_TEST];
+
+        sim_flash_power_fail_after(bytes);
+        commit_key(KEY_E);
+        sim_flash_power_fail_after(-1);
+        store_init();
+
+        power_fail_cases++;
+        power_fail_ok += store_sequence() == sequence && keymap_is(before);
+    }
+
+    // a flipped bit in the newest image falls back to the one before it
+    uint32_t sequence = store_sequence();
+    commit_key(KEY_F);
+    sim_flash_corrupt((const uint8_t *) store_keymap() - hal_flash_region() + 3);
+    store_init();
+    bool corrupt = store_sequence() == sequence;
+
+    // a macro running off the end of the image fails the commit and is
+    // not loaded; text this build does not have ends the macro
+    static const uint8_t unterminated[] = { MACRO_OP_STR, 'x', 'x' };
+    static const uint8_t bad_text[] = { MACRO_OP_TEXT, N_MACRO_TEXT, MACRO_OP_END };
+    image = store_edit();
+    image->macro_offset[3] = STORE_MACRO_BYTES - sizeof(unterminated);
+    memcpy(&image->macro_code[STORE_MACRO_BYTES - sizeof(unterminated)], unterminated, sizeof(unterminated));
+    committed = store_commit();
+    store_init();
+    bool bad_macro = !committed && store_sequence() == sequence;
+    image = store_edit();
+    image->macro_offset[3] = 768;
+    memcpy(&image->macro_code[768], bad_text, sizeof(bad_text));
+    bad_macro &= store_commit();
+    macro_start(3);
+    bad_macro &= !macro_task(0) && !macro_busy();
+
+    store_reset();
+    store_init();
+    bool reset = store_sequence() == 0 && keymap_is(action_table[0][KEY_UNDER_TEST]);
+    layer_init();
+
+    printf("store: defaults=%d reloaded=%d commits=%d erases_per_sector=%u..%u "
+           "power_fail=%d/%d corrupt_fallback=%d bad_macro=%d reset=%d\n",
+           defaults, reloaded, STORE_COMMITS, min_erases, max_erases,
+           power_fail_ok, power_fail_cases, corrupt, bad_macro, reset);
+    bench_check(defaults && reloaded && corrupt && reset, "store: load, commit and fallback");
+    bench_check(bad_macro, "store: malformed macros rejected");
+    bench_check(max_erases - min_erases <= 1, "store: erases spread over the sectors");
+    bench_check(power_fail_ok == power_fail_cases, "store: power fail keeps the previous image");
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "config.h"
+#include "event_queue.h"
+#include "layer.h"
+#include "matrix.h"
+#include "sim.h"
+#include "tap_hold.h"
+
+// Feed synthetic debounced key events straight into the tap-hold
+// resolver and compare the usage events that come out against what
+// each mode should produce. The mod-tap key is the example on
+// LAYER_EXAMPLES, turned on for the duration.
+
+#define TH_KEY    KEY_INDEX(0, 3)    // CTL_ESC on LAYER_EXAMPLES
+#define PLAIN_KEY KEY_INDEX(1, 2)    // KEY_A
+#define TERM_US   (TAPPING_TERM_MS * 1000u)
+
+struct step {
+    uint32_t time_us;
+    int key;        // -1: only run the tapping-term timer
+    bool pressed;
+};
+
+// Each case runs in every mode; expected[mode] is the usage stream
+static const struct {
+    const char *name;
+    struct step steps[5];
+    int n_steps;
+    const char *expected[TAP_HOLD_MODE_COUNT];
+} cases[] = {
+    { "tap",
+      { { 0, TH_KEY, true }, { 50000, TH_KEY, false } }, 2,
+      { "+esc -esc", "+esc -esc", "+esc -esc" } },
+    { "hold",
+      { { 0, TH_KEY, true }, { TERM_US, -1, false }, { TERM_US + 50000, TH_KEY, false } }, 3,
+      { "+ctrl -ctrl", "+ctrl -ctrl", "+ctrl -ctrl" } },
+    { "nested",
+      { { 0, TH_KEY, true }, { 30000, PLAIN_KEY, true }, { 60000, PLAIN_KEY, false },
+        { 90000, TH_KEY, false } }, 4,
+      { "+esc +a -a -esc", "+ctrl +a -a -ctrl", "+ctrl +a -a -ctrl" } },
+    { "roll",
+      { { 0, TH_KEY, true }, { 30000, PLAIN_KEY, true }, { 60000, TH_KEY, false },
+        { 90000, PLAIN_KEY, false } }, 4,
+      { "+esc +a -esc -a", "+esc +a -esc -a", "+ctrl +a -ctrl -a" } },
+    { "hold-then-key",
+      { { 0, TH_KEY, true }, { TERM_US, -1, false }, { TERM_US + 10000, PLAIN_KEY, true },
+        { TERM_US + 20000, PLAIN_KEY, false }, { TERM_US + 30000, TH_KEY, false } }, 5,
+      { "+ctrl +a -a -ctrl", "+ctrl +a -a -ctrl", "+ctrl +a -a -ctrl" } },
+};
+
+#define N_CASES (int) (sizeof(cases) / sizeof(cases[0]))
+
+static void
+drain(char *out, size_t size)
+{
+    struct key_event event;
+    size_t len = 0;
+
+    out[0] = '\0';
+    while (event_queue_pop(&event) && len < size) {
+        const char *name;
+        char buf[8];
+
+        switch (event.usage) {
+        case KEY_ESC:      name = "esc"; break;
+        case KEY_A:        name = "a"; break;
+        case KEY_LEFTCTRL: name = "ctrl"; break;
+        default:
+            snprintf(buf, sizeof(buf), "%02x", event.usage);
+            name = buf;
+        }
+        len += snprintf(out + len, size - len, "%s%c%s", len ? " " : "", event.pressed ? '+' : '-', name);
+    }
+}
+
+static void
+feed(int key, bool pressed, uint32_t time_us)
+{
+    struct key_event event = {
+        .sample_us = time_us,
+        .time_us = time_us,
+        .key = key,
+        .pressed = pressed,
+    };
+    tap_hold_process(&event);
+}
+
+// A plain key must come out of the resolver in the same call that
+// fed it in, whatever the mode
+static int
+plain_keys_delayed(void)
+{
+    struct key_event event;
+    int delayed = 0;
+
+    for (int key = 0; key < N_KEYS; ++key) {
+        action_t action = layer_action(key);
+        if (ACTION_TAG(action) != ACT_TAG_KEY || action == KEY_NONE)
+            continue;
+
+        feed(key, true, 0);
+        delayed += !event_queue_pop(&event);
+        feed(key, false, 1000);
+        delayed += !event_queue_pop(&event);
+    }
+    return delayed;
+}
+
+static bool esc_reported;
+
+static void
+on_tap_report(uint64_t time_us, uint8_t report_id, const uint8_t *report, uint16_t len)
+{
+    (void) time_us;
+    esc_reported |= bench_report_has_usage(report_id, report, len, KEY_ESC);
+}
+
+// A quick tap is resolved with its press and release in the same scan;
+// check the press still reaches the host as a report of its own
+static bool
+tap_reported(void)
+{
+    esc_reported = false;
+    sim_set_report_cb(on_tap_report);
+    sim_key_set(KEY_COL(TH_KEY), KEY_ROW(TH_KEY), true);
+    bench_run_us(30000);
+    sim_key_set(KEY_COL(TH_KEY), KEY_ROW(TH_KEY), false);
+    bench_run_us(50000);
+    sim_set_report_cb(NULL);
+    return esc_reported;
+}
+
+void
+bench_tap_hold(void)
+{
+    char out[128];
+
+    layer_on(LAYER_EXAMPLES);
+    for (int mode = 0; mode < TAP_HOLD_MODE_COUNT; ++mode) {
+        int passed = 0;
+
+        tap_hold_init(mode);
+        drain(out, sizeof(out));
+
+        for (int c = 0; c < N_CASES; ++c) {
+            for (int i = 0; i < cases[c].n_steps; ++i) {
+                const struct step *step = &cases[c].steps[i];
+                if (step->key < 0)
+                    tap_hold_task(step->time_us);
+                else
+                    feed(step->key, step->pressed, step->time_us);
+            }
+            drain(out, sizeof(out));
+
+            if (strcmp(out, cases[c].expected[mode]) == 0)
+                passed++;
+            else
+                printf("tap_hold: mode=%s case=%s got=\"%s\" expected=\"%s\"\n",
+                       tap_hold_mode_name(mode), cases[c].name, out, cases[c].expected[mode]);
+        }
+
+        int delayed = plain_keys_delayed();
+        printf("tap_hold: mode=%s cases=%d passed=%d plain_keys_delayed=%d\n",
+               tap_hold_mode_name(mode), N_CASES, passed, delayed);
+        bench_check(passed == N_CASES, "tap_hold: resolution");
+        bench_check(delayed == 0, "tap_hold: plain keys not delayed");
+    }
+
+    tap_hold_init(TAP_HOLD_MODE);
+    bool tap_ok = tap_reported();
+    layer_off(LAYER_EXAMPLES);
+    printf("tap_hold: end_to_end_tap_reported=%d\n", tap_ok);
+    bench_check(tap_ok, "tap_hold: tap reaches the host");
+}
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "config.h"
+#include "hal.h"
+#include "matrix.h"
+#include "sim.h"
+#include "trace.h"
+
+// Cost of a trace() call, a full ring dropping and reporting it, and
+// the trace of typed keys coming out of the simulated UART as valid
+// frames once the keyboard goes idle. The capture can be saved for
+// tools/trace_decode.py.
+
+#define TRACE_CALLS 1000000
+
+static const int typed[][2] = { { 1, 2 }, { 2, 2 }, { 3, 2 }, { 4, 2 } };
+#define N_TYPED (int) (sizeof(typed) / sizeof(typed[0]))
+
+// Pull every valid frame out of a UART capture
+static int
+decode_frames(const uint8_t *data, size_t len, struct trace_record *records, int max, int *skipped)
+{
+    int n = 0;
+    size_t i = 0;
+
+    *skipped = 0;
+    while (i + TRACE_FRAME_LEN <= len && n < max) {
+        uint8_t check = 0;
+        for (size_t k = 1; k < TRACE_FRAME_LEN - 1; ++k)
+            check ^= data[i + k];
+
+        if (data[i] != TRACE_SYNC || check != data[i + TRACE_FRAME_LEN - 1]) {
+            i++;
+            (*skipped)++;
+            continue;
+        }
+        memcpy(&records[n++], &data[i + 1], sizeof(struct trace_record));
+        i += TRACE_FRAME_LEN;
+    }
+    return n;
+}
+
+static void
+trace_drain(void)
+{
+    struct trace_record record;
+
+    while (trace_pop(&record))
+        ;
+}
+
+void
+bench_trace(const char *capture_path)
+{
+    struct trace_record record;
+
+    trace_drain();
+
+    // a full ring drops the rest and says how many once drained
+    for (int i = 0; i < 2 * TRACE_RING_SIZE; ++i)
+        trace(TRACE_KEY, i, 0);
+    int popped = 0;
+    uint32_t dropped = 0;
+    while (trace_pop(&record)) {
+        if (record.id == TRACE_DROPPED)
+            dropped += record.b;
+        else
+            popped++;
+    }
+    bool overflow_ok = popped == TRACE_RING_SIZE && dropped == TRACE_RING_SIZE;
+
+    // time the write path, draining in between so it never drops
+    uint64_t wall = 0;
+    for (int done = 0; done < TRACE_CALLS; done += TRACE_RING_SIZE) {
+        uint64_t start = bench_wall_ns();
+        for (int i = 0; i < TRACE_RING_SIZE; ++i)
+            trace(TRACE_REPORT, i, i);
+        wall += bench_wall_ns() - start;
+        trace_drain();
+    }
+
+    // type through the pipeline and let the idle loop drain to the UART
+    sim_uart_clear();
+    for (int i = 0; i < N_TYPED; ++i) {
+        sim_key_set(typed[i][0], typed[i][1], true);
+        bench_run_us(30000);
+        sim_key_set(typed[i][0], typed[i][1], false);
+        bench_run_us(30000);
+    }
+    bench_run_us(200000);
+
+    size_t len;
+    const uint8_t *uart = sim_uart_output(&len);
+    static struct trace_record records[4096];
+    int skipped;
+    int n = decode_frames(uart, len, records, 4096, &skipped);
+
+    int key_events = 0, reports = 0, in_order = 1;
+    for (int i = 0; i < n; ++i) {
+        if (records[i].id == TRACE_KEY) {
+            int t = key_events / 2;
+            bool pressed = key_events % 2 == 0;
+            in_order &= t < N_TYPED && records[i].a == KEY_INDEX(typed[t][0], typed[t][1]) &&
+                        records[i].b == pressed;
+            key_events++;
+        }
+        reports += records[i].id == TRACE_REPORT;
+        if (i && (int32_t) (records[i].time_us - records[i - 1].time_us) < 0)
+            in_order = 0;
+    }
+
+    if (capture_path) {
+        FILE *out = fopen(capture_path, "wb");
+        if (out) {
+            fwrite(uart, 1, len, out);
+            fclose(out);
+        }
+    }
+
+    printf("trace: overflow=%d host_ns_per_record=%.1f uart_bytes=%zu frames=%d garbage=%d "
+           "keys=%d/%d reports=%d ordered=%d\n",
+           overflow_ok, (double) wall / TRACE_CALLS, len, n, skipped,
+           key_events, 2 * N_TYPED, reports, in_order);
+    bench_check(overflow_ok, "trace: ring overflow");
+    bench_check(skipped == 0 && key_events == 2 * N_TYPED && in_order, "trace: UART frames");
+}
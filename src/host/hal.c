@@ -0,0 +1,572 @@
+#include <string.h>
+
+#include "hal.h"
+#include "led.h"
+#include "sim.h"
+
+#define SIM_MAX_COLS 32
+#define SIM_MAX_ROWS 32
+
+static const int *sim_columns;
+static const int *sim_rows;
+static int sim_n_cols;
+static int sim_n_rows;
+
+static uint32_t gpio_out;
+static bool sim_keys[SIM_MAX_COLS][SIM_MAX_ROWS];
+
+// Column nets charge and discharge through the switch and diode: a row
+// follows a closed switch rise_us after its column is driven and lets
+// go fall_us after it is released
+static uint8_t sim_rise_us[SIM_MAX_COLS];
+static uint8_t sim_fall_us[SIM_MAX_COLS];
+static uint64_t pin_changed_us[32];
+
+// Without diodes a driven column also reaches, through closed
+// switches, every other column on a row it pulls up, and their rows
+static bool sim_diodes = true;
+
+static uint64_t now_us;
+
+// Row edge latch standing in for the GPIO interrupt; edges are seen
+// when a key changes, so wake timing is as fine as the caller's steps
+static uint32_t wake_mask;
+static uint32_t wake_rows;
+static bool wake_fired;
+
+static sim_report_cb_t report_cb;
+static bool boot_protocol;
+
+// The interrupt IN endpoint holds one report until the host's next
+// poll, which happens on a bInterval boundary
+static uint32_t ep_interval_us = 5000;
+static bool in_flight;
+static uint64_t in_flight_done_us;
+static uint8_t in_flight_id;
+static uint8_t in_flight_report[64];
+static uint16_t in_flight_len;
+static unsigned reports_sent;
+static unsigned bootloader_requests;
+
+// Raw HID IN endpoint, on its own interval
+static sim_raw_report_cb_t raw_report_cb;
+static uint32_t raw_ep_interval_us = 4000;
+static bool raw_in_flight;
+static uint64_t raw_done_us;
+static uint8_t raw_report[64];
+static uint16_t raw_len;
+static int raw_refuse;
+
+// Flash region with NOR semantics. Programming can be cut off after a
+// number of bytes to model power loss in the middle of a commit.
+static uint8_t flash[HAL_FLASH_REGION_SIZE];
+static unsigned flash_erases[HAL_FLASH_SECTORS];
+static long flash_budget = -1;
+static bool flash_ready;
+
+// Debug UART at 115200 baud 8N1 behind a 32-byte FIFO; everything it
+// sends is kept for the trace bench
+#define SIM_UART_FIFO        32
+#define SIM_UART_US_PER_BYTE 87
+#define SIM_UART_CAPTURE     (1 << 20)
+
+static uint8_t uart_capture[SIM_UART_CAPTURE];
+static size_t uart_captured;
+static uint64_t uart_busy_until_us;
+
+// PWM outputs: a level, or a waveform stepping every LED_STEP_MS from
+// the moment it was started
+struct sim_led {
+    uint16_t level;
+    const uint16_t *waveform;
+    int len;
+    uint64_t start_us;
+};
+
+static struct sim_led leds[LED_COUNT];
+static unsigned led_writes;
+
+//--------------------------------------------------------------------+
+// Simulation controls
+//--------------------------------------------------------------------+
+void
+sim_key_set(int col, int row, bool pressed)
+{
+    sim_keys[col][row] = pressed;
+
+    if (wake_mask) {
+        uint32_t rows = hal_gpio_get_all() & wake_mask;
+        if (rows & ~wake_rows)
+            wake_fired = true;
+        wake_rows = rows;
+    }
+}
+
+void
+sim_keys_clear(void)
+{
+    memset(sim_keys, 0, sizeof(sim_keys));
+}
+
+void
+sim_set_diodes(bool diodes)
+{
+    sim_diodes = diodes;
+}
+
+void
+sim_set_settle_us(int col, uint8_t rise_us, uint8_t fall_us)
+{
+    sim_rise_us[col] = rise_us;
+    sim_fall_us[col] = fall_us;
+}
+
+void
+sim_advance_us(uint32_t us)
+{
+    now_us += us;
+}
+
+void
+sim_set_report_cb(sim_report_cb_t cb)
+{
+    report_cb = cb;
+}
+
+void
+sim_set_ep_interval_us(uint32_t us)
+{
+    ep_interval_us = us;
+}
+
+// Deliver the in-flight report once the host has polled for it
+bool
+sim_report_complete(void)
+{
+    if (!in_flight || now_us < in_flight_done_us)
+        return false;
+
+    in_flight = false;
+    if (report_cb)
+        report_cb(in_flight_done_us, in_flight_id, in_flight_report, in_flight_len);
+    return true;
+}
+
+uint64_t
+sim_next_completion_us(void)
+{
+    uint64_t next_us = UINT64_MAX;
+
+    if (in_flight)
+        next_us = in_flight_done_us;
+    if (raw_in_flight && raw_done_us < next_us)
+        next_us = raw_done_us;
+    return next_us;
+}
+
+unsigned
+sim_reports_sent(void)
+{
+    return reports_sent;
+}
+
+void
+sim_set_boot_protocol(bool boot)
+{
+    boot_protocol = boot;
+}
+
+unsigned
+sim_bootloader_requests(void)
+{
+    return bootloader_requests;
+}
+
+const uint8_t *
+sim_uart_output(size_t *len)
+{
+    *len = uart_captured;
+    return uart_capture;
+}
+
+void
+sim_uart_clear(void)
+{
+    uart_captured = 0;
+}
+
+void
+sim_set_raw_report_cb(sim_raw_report_cb_t cb)
+{
+    raw_report_cb = cb;
+}
+
+void
+sim_set_raw_ep_interval_us(uint32_t us)
+{
+    raw_ep_interval_us = us;
+}
+
+void
+sim_raw_report_refuse(int reports)
+{
+    raw_refuse = reports;
+}
+
+bool
+sim_raw_report_complete(void)
+{
+    if (!raw_in_flight || now_us < raw_done_us)
+        return false;
+
+    raw_in_flight = false;
+    if (raw_report_cb)
+        raw_report_cb(raw_done_us, raw_report, raw_len);
+    return true;
+}
+
+uint16_t
+sim_led_duty(int led)
+{
+    const struct sim_led *l = &leds[led];
+
+    if (!l->waveform)
+        return l->level;
+    return l->waveform[(now_us - l->start_us) / (LED_STEP_MS * 1000) % l->len];
+}
+
+unsigned
+sim_led_writes(void)
+{
+    return led_writes;
+}
+
+void
+sim_flash_reset(void)
+{
+    memset(flash, 0xff, sizeof(flash));
+    memset(flash_erases, 0, sizeof(flash_erases));
+    flash_budget = -1;
+    flash_ready = true;
+}
+
+void
+sim_flash_power_fail_after(long bytes)
+{
+    flash_budget = bytes;
+}
+
+void
+sim_flash_corrupt(uint32_t offset)
+{
+    flash[offset] ^= 0x01;
+}
+
+unsigned
+sim_flash_erase_count(int sector)
+{
+    return flash_erases[sector];
+}
+
+//--------------------------------------------------------------------+
+// Matrix I/O
+//--------------------------------------------------------------------+
+void
+hal_matrix_init(const int *columns, int n_cols, const int *rows, int n_rows)
+{
+    sim_columns = columns;
+    sim_n_cols = n_cols;
+    sim_rows = rows;
+    sim_n_rows = n_rows;
+    gpio_out = 0;
+}
+
+static void
+gpio_write(uint32_t mask, uint32_t value)
+{
+    uint32_t changed = (gpio_out ^ value) & mask;
+
+    for (int pin = 0; pin < 32; ++pin)
+        if (changed & (1u << pin))
+            pin_changed_us[pin] = now_us;
+    gpio_out ^= changed;
+}
+
+void
+hal_gpio_put(int pin, bool value)
+{
+    gpio_write(1u << pin, value ? 1u << pin : 0);
+}
+
+bool
+hal_gpio_get(int pin)
+{
+    return (hal_gpio_get_all() >> pin) & 1;
+}
+
+void
+hal_gpio_set_mask(uint32_t mask)
+{
+    gpio_write(mask, mask);
+}
+
+void
+hal_gpio_clr_mask(uint32_t mask)
+{
+    gpio_write(mask, 0);
+}
+
+// Rows with a closed switch on the column, as a bit per row
+static uint32_t
+sim_key_rows(int col)
+{
+    uint32_t rows = 0;
+
+    for (int row = 0; row < sim_n_rows; ++row)
+        rows |= (uint32_t) sim_keys[col][row] << row;
+    return rows;
+}
+
+// A row pin reads high when a column with a closed switch on it has
+// been driven long enough, or released too recently
+uint32_t
+hal_gpio_get_all(void)
+{
+    uint32_t gpio = gpio_out, rows = 0;
+
+    for (int col = 0; col < sim_n_cols; ++col) {
+        int pin = sim_columns[col];
+        uint64_t since_us = now_us - pin_changed_us[pin];
+        bool driven = gpio_out & (1u << pin);
+
+        if (driven ? since_us < sim_rise_us[col] : since_us >= sim_fall_us[col])
+            continue;
+        rows |= sim_key_rows(col);
+    }
+
+    while (!sim_diodes && rows) {
+        uint32_t reached = rows;
+        for (int col = 0; col < sim_n_cols; ++col)
+            if (sim_key_rows(col) & rows)
+                rows |= sim_key_rows(col);
+        if (rows == reached)
+            break;
+    }
+
+    for (int row = 0; row < sim_n_rows; ++row)
+        if (rows & (1u << row))
+            gpio |= 1u << sim_rows[row];
+    return gpio;
+}
+
+void
+hal_row_wake_arm(uint32_t mask)
+{
+    wake_mask = mask;
+    wake_rows = hal_gpio_get_all() & mask;
+    wake_fired = wake_rows != 0;
+}
+
+void
+hal_row_wake_disarm(void)
+{
+    wake_mask = 0;
+}
+
+bool
+hal_row_wake_fired(void)
+{
+    return wake_fired;
+}
+
+//--------------------------------------------------------------------+
+// Clock
+//--------------------------------------------------------------------+
+uint64_t
+hal_time_us(void)
+{
+    return now_us;
+}
+
+void
+hal_sleep_us(uint32_t us)
+{
+    now_us += us;
+}
+
+int
+hal_core_num(void)
+{
+    return 0;
+}
+
+// Nothing interrupts the virtual clock; the caller bounds the wait by
+// the next thing it expects from the simulation
+void
+hal_wait_until(uint64_t time_us)
+{
+    if (time_us > now_us)
+        now_us = time_us;
+}
+
+void
+hal_wake_other_core(void)
+{
+}
+
+//--------------------------------------------------------------------+
+// HID sink
+//--------------------------------------------------------------------+
+bool
+hal_hid_ready(void)
+{
+    return !in_flight;
+}
+
+bool
+hal_hid_boot_protocol(void)
+{
+    return boot_protocol;
+}
+
+bool
+hal_hid_report(uint8_t report_id, const void *report, uint16_t len)
+{
+    if (in_flight || len > sizeof(in_flight_report))
+        return false;
+
+    memcpy(in_flight_report, report, len);
+    in_flight_id = report_id;
+    in_flight_len = len;
+    in_flight_done_us = (now_us / ep_interval_us + 1) * ep_interval_us;
+    in_flight = true;
+    reports_sent++;
+    return true;
+}
+
+bool
+hal_hid_keyboard_report(uint8_t report_id, uint8_t modifiers, const uint8_t keycodes[6])
+{
+    uint8_t report[8] = { modifiers, 0 };
+    memcpy(&report[2], keycodes, 6);
+
+    return hal_hid_report(report_id, report, sizeof(report));
+}
+
+void
+hal_reset_bootloader(void)
+{
+    bootloader_requests++;
+}
+
+//--------------------------------------------------------------------+
+// Trace output
+//--------------------------------------------------------------------+
+int
+hal_trace_write(const uint8_t *data, int len)
+{
+    int n = 0;
+
+    if (uart_busy_until_us < now_us)
+        uart_busy_until_us = now_us;
+
+    // FIFO level is the backlog still to shift out
+    while (n < len && uart_busy_until_us - now_us < SIM_UART_FIFO * SIM_UART_US_PER_BYTE) {
+        if (uart_captured < SIM_UART_CAPTURE)
+            uart_capture[uart_captured++] = data[n];
+        uart_busy_until_us += SIM_UART_US_PER_BYTE;
+        n++;
+    }
+    return n;
+}
+
+//--------------------------------------------------------------------+
+// Raw HID sink
+//--------------------------------------------------------------------+
+bool
+hal_raw_hid_ready(void)
+{
+    return !raw_in_flight;
+}
+
+bool
+hal_raw_hid_report(const void *report, uint16_t len)
+{
+    if (raw_in_flight || len > sizeof(raw_report))
+        return false;
+    if (raw_refuse > 0) {
+        raw_refuse--;
+        return false;
+    }
+
+    memcpy(raw_report, report, len);
+    raw_len = len;
+    raw_done_us = (now_us / raw_ep_interval_us + 1) * raw_ep_interval_us;
+    raw_in_flight = true;
+    return true;
+}
+
+//--------------------------------------------------------------------+
+// Indicator LEDs
+//--------------------------------------------------------------------+
+void
+hal_led_init(const int *pins, int n)
+{
+    (void) pins;
+
+    for (int i = 0; i < n; ++i)
+        leds[i] = (struct sim_led) { 0 };
+}
+
+void
+hal_led_level(int led, uint16_t duty)
+{
+    leds[led].waveform = NULL;
+    leds[led].level = duty;
+    led_writes++;
+}
+
+void
+hal_led_waveform(int led, const uint16_t *duty, int len)
+{
+    leds[led].waveform = duty;
+    leds[led].len = len;
+    leds[led].start_us = now_us;
+    led_writes++;
+}
+
+//--------------------------------------------------------------------+
+// Persistent storage
+//--------------------------------------------------------------------+
+// Starts out erased, like a new part
+const uint8_t *
+hal_flash_region(void)
+{
+    if (!flash_ready)
+        sim_flash_reset();
+    return flash;
+}
+
+void
+hal_flash_erase(uint32_t offset)
+{
+    if (flash_budget == 0)
+        return;
+
+    memset(&flash[offset], 0xff, HAL_FLASH_SECTOR_SIZE);
+    flash_erases[offset / HAL_FLASH_SECTOR_SIZE]++;
+}
+
+void
+hal_flash_program(uint32_t offset, const void *data, uint32_t len)
+{
+    const uint8_t *bytes = data;
+
+    for (uint32_t i = 0; i < len; ++i) {
+        if (flash_budget == 0)
+            return;
+        if (flash_budget > 0)
+            flash_budget--;
+        flash[offset + i] &= bytes[i];
+    }
+}
@@ -0,0 +1,460 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "event_queue.h"
+#include "bench.h"
+#include "hal.h"
+#include "latency.h"
+#include "keyboard.h"
+#include "matrix.h"
+#include "matrix_pio.h"
+#include "raw_hid.h"
+#include "report.h"
+#include "sched.h"
+#include "sim.h"
+#include "trace.h"
+#include "usb_descriptors.h"
+
+// Host driver for the scan/report pipeline. Runs the firmware logic
+// against the simulated matrix and virtual clock and prints scan-time
+// and scan-to-report latency figures.
+//
+// usage: pikey_host [ITERATIONS [TRACE_CAPTURE]]
+//
+// Exits non-zero when any bench check failed, so ctest runs it as the
+// regression test.
+
+#define LOOP_TICK_US 50
+
+static uint8_t expected_usage;
+static bool expected_down;
+static bool seen;
+static uint64_t seen_us;
+
+static int checks_failed;
+
+uint64_t
+bench_wall_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// Stands in for tud_task(): deliver whatever the simulated endpoints
+// have completed, and wake up again when the next one will
+static uint64_t
+sim_usb_task(void)
+{
+    if (sim_report_complete())
+        hid_report_complete();
+    sim_raw_report_complete();
+    return sim_next_completion_us();
+}
+
+// The single-core firmware's task table
+static struct sched_task tasks[] = {
+    { .name = "scan", .run = scan_task, .deadline_us = SCAN_INTERVAL_US },
+    { .name = "usb", .run = sim_usb_task },
+    { .name = "report", .run = report_task, .deadline_us = 1000 },
+    { .name = "raw_hid", .run = raw_hid_task, .deadline_us = 1000 * RAW_HID_EP_INTERVAL_MS },
+    { .name = "trace", .run = trace_task, .deadline_us = 10000 },
+};
+
+static struct sched host_sched;
+
+// One scheduler pass, then sleep in virtual time until the next task
+// is due. The bench changes keys between ticks, so sleep no longer
+// than LOOP_TICK_US and let them be seen about when they happen.
+void
+bench_loop_tick(void)
+{
+    uint64_t next_us = sched_pass(&host_sched);
+    uint64_t limit_us = hal_time_us() + LOOP_TICK_US;
+
+    hal_wait_until(next_us < limit_us ? next_us : limit_us);
+}
+
+struct sched *
+bench_scheduler(void)
+{
+    return &host_sched;
+}
+
+void
+bench_run_us(uint64_t us)
+{
+    uint64_t start = hal_time_us();
+    while (hal_time_us() - start < us)
+        bench_loop_tick();
+}
+
+bool
+bench_report_has_usage(uint8_t report_id, const uint8_t *report, uint16_t len, uint8_t usage)
+{
+    if (report_id == REPORT_ID_KEYBOARD_NKRO)
+        return usage < len * 8 && (report[usage >> 3] >> (usage & 7)) & 1;
+    if (report_id != 0)
+        return false;
+
+    for (int i = 2; i < len; ++i)
+        if (report[i] == usage)
+            return true;
+    return false;
+}
+
+void
+bench_check(bool ok, const char *what)
+{
+    if (ok)
+        return;
+    fprintf(stderr, "FAIL: %s\n", what);
+    checks_failed++;
+}
+
+static void
+on_report(uint64_t time_us, uint8_t report_id, const uint8_t *report, uint16_t len)
+{
+    bool down = bench_report_has_usage(report_id, report, len, expected_usage);
+
+    if (!seen && down == expected_down) {
+        seen = true;
+        seen_us = time_us;
+    }
+}
+
+static void
+bench_scan(int iterations)
+{
+    uint64_t virt_start = hal_time_us();
+    uint64_t wall_start = bench_wall_ns();
+
+    for (int i = 0; i < iterations; ++i)
+        poll_columns();
+
+    uint64_t wall = bench_wall_ns() - wall_start;
+    uint64_t virt = hal_time_us() - virt_start;
+
+    printf("scan: iterations=%d virtual_us_per_scan=%.1f host_ns_per_scan=%.1f\n",
+           iterations, iterations ? (double) virt / iterations : 0.0,
+           iterations ? (double) wall / iterations : 0.0);
+}
+
+static void
+random_matrix(int max_keys)
+{
+    sim_keys_clear();
+    for (int n = rand() % (max_keys + 1); n > 0; --n)
+        sim_key_set(rand() % N_COLS, rand() % N_ROWS, true);
+}
+
+// Check the PIO snapshot decoder against the CPU scanner on random
+// matrices, then time the decode on its own
+static void
+bench_pio(int iterations)
+{
+    matrix_t cpu, pio;
+    const uint32_t *snapshot;
+    int mismatches = 0;
+
+    srand(2);
+    matrix_pio_init(10);
+
+    for (int i = 0; i < iterations; ++i) {
+        random_matrix(10);
+        matrix_scan(&cpu);
+        matrix_pio_latest(&snapshot);
+        pio_scan_decode(snapshot, &pio);
+        if (memcmp(&cpu, &pio, sizeof(cpu)) != 0)
+            mismatches++;
+    }
+
+    uint64_t wall_start = bench_wall_ns();
+    for (int i = 0; i < iterations; ++i)
+        pio_scan_decode(snapshot, &pio);
+    uint64_t wall = bench_wall_ns() - wall_start;
+
+    sim_keys_clear();
+    printf("pio: iterations=%d mismatches=%d host_ns_per_decode=%.1f\n",
+           iterations, mismatches, iterations ? (double) wall / iterations : 0.0);
+    bench_check(mismatches == 0, "pio: decode matches the CPU scan");
+}
+
+// Wait until the report stream reflects the expected state of a key,
+// returning the latency from the switch change in virtual microseconds.
+static int64_t
+run_until_seen(uint64_t change_us, uint64_t timeout_us)
+{
+    seen = false;
+    while (!seen && hal_time_us() - change_us < timeout_us)
+        bench_loop_tick();
+    return seen ? (int64_t) (seen_us - change_us) : -1;
+}
+
+// Keys held back by a combo wait for the combo term, which is not
+// pipeline latency; leave them out
+static bool
+combo_member(int key)
+{
+    for (size_t i = 0; i < sizeof(combos) / sizeof(combos[0]); ++i)
+        for (int k = 0; k < combos[i].n_keys; ++k)
+            if (!(combos[i].flags & COMBO_HELD) && combos[i].keys[k] == key)
+                return true;
+    return false;
+}
+
+static void
+bench_latency(int iterations)
+{
+    uint64_t total = 0, min = UINT64_MAX, max = 0;
+    int samples = 0, missed = 0;
+
+    srand(1);
+    sim_set_report_cb(on_report);
+
+    for (int i = 0; i < iterations; ++i) {
+        int col, row;
+        action_t action;
+        do {
+            col = rand() % N_COLS;
+            row = rand() % N_ROWS;
+            action = action_table[0][KEY_INDEX(col, row)];
+        } while (ACTION_TAG(action) != ACT_TAG_KEY || action == KEY_NONE ||
+                 combo_member(KEY_INDEX(col, row)));
+
+        // land the press at an arbitrary point in the poll interval
+        sim_advance_us(rand() % SCAN_INTERVAL_US);
+
+        expected_usage = ACTION_ARG(action);
+        expected_down = true;
+        sim_key_set(col, row, true);
+        int64_t latency = run_until_seen(hal_time_us(), 100000);
+
+        expected_down = false;
+        sim_key_set(col, row, false);
+        run_until_seen(hal_time_us(), 100000);
+
+        if (latency < 0) {
+            missed++;
+            continue;
+        }
+        total += latency;
+        if ((uint64_t) latency < min) min = latency;
+        if ((uint64_t) latency > max) max = latency;
+        samples++;
+    }
+
+    sim_set_report_cb(NULL);
+    bench_check(missed == 0, "latency: every press reported");
+
+    if (samples == 0) {
+        printf("latency: no samples, missed=%d\n", missed);
+        return;
+    }
+    const struct scan_stats *stats = keyboard_scan_stats();
+    const struct event_queue_stats *queue = event_queue_stats();
+    printf("latency: samples=%d missed=%d min_us=%llu avg_us=%.1f max_us=%llu "
+           "scan_budget_us=%d scan_max_us=%u scan_overruns=%u\n",
+           samples, missed, (unsigned long long) min, (double) total / samples,
+           (unsigned long long) max, SCAN_INTERVAL_US, stats->max_us, stats->overruns);
+    printf("queue: events=%u depth_max=%u dropped=%u\n",
+           queue->pushed, queue->depth_max, queue->dropped);
+}
+
+static uint8_t last_report[NKRO_REPORT_BYTES];
+static uint8_t last_report_id;
+
+static void
+on_capture_report(uint64_t time_us, uint8_t report_id, const uint8_t *report, uint16_t len)
+{
+    (void) time_us;
+
+    memcpy(last_report, report, len < sizeof(last_report) ? len : sizeof(last_report));
+    last_report_id = report_id;
+}
+
+// Tap or hold matrix positions and report which usage the host sees
+static bool
+key_reported(uint8_t usage)
+{
+    return bench_report_has_usage(last_report_id, last_report, sizeof(last_report), usage);
+}
+
+// Long enough for a change to be scanned, debounced and reported in
+// either scan mode
+#define LAYER_STEP_US 50000
+
+// Check layer resolution through the whole pipeline: Fn held as a
+// momentary layer, then the same key with Fn released
+static void
+bench_layers(void)
+{
+    sim_set_report_cb(on_capture_report);
+
+    sim_key_set(FN1_COL, FN1_ROW, true);
+    bench_run_us(LAYER_STEP_US);
+    sim_key_set(0, 0, true);
+    bench_run_us(LAYER_STEP_US);
+    bool f1 = key_reported(KEY_F1);
+    bool trns = false;
+    sim_key_set(0, 0, false);
+    sim_key_set(1, 1, true);
+    bench_run_us(LAYER_STEP_US);
+    trns = key_reported(KEY_Q);
+    sim_key_set(1, 1, false);
+    sim_key_set(FN1_COL, FN1_ROW, false);
+    bench_run_us(LAYER_STEP_US);
+
+    sim_key_set(0, 0, true);
+    bench_run_us(LAYER_STEP_US);
+    bool one = key_reported(KEY_1);
+    sim_key_set(0, 0, false);
+    bench_run_us(LAYER_STEP_US);
+
+    printf("layers: momentary=%d transparent=%d base=%d\n", f1, trns, one);
+    bench_check(f1 && trns && one, "layers: resolution");
+    sim_set_report_cb(NULL);
+}
+
+static int rollover_keys;
+static bool rollover_error;
+
+static void
+on_rollover_report(uint64_t time_us, uint8_t report_id, const uint8_t *report, uint16_t len)
+{
+    (void) time_us;
+
+    rollover_keys = 0;
+    for (int usage = KEY_A; usage <= KEY_Z; ++usage)
+        rollover_keys += bench_report_has_usage(report_id, report, len, usage);
+    rollover_error = bench_report_has_usage(report_id, report, len, KEY_ERR_OVF);
+}
+
+// Hold ten letters at once and check what each protocol reports
+static void
+bench_rollover(void)
+{
+    static const int held[][2] = {
+        { 1, 1 }, { 2, 1 }, { 3, 1 }, { 4, 1 }, { 5, 1 },
+        { 1, 2 }, { 2, 2 }, { 3, 2 }, { 4, 2 }, { 5, 2 },
+    };
+    const int n_held = sizeof(held) / sizeof(held[0]);
+
+    sim_set_report_cb(on_rollover_report);
+    for (int boot = 0; boot < 2; ++boot) {
+        sim_set_boot_protocol(boot);
+        for (int i = 0; i < n_held; ++i)
+            sim_key_set(held[i][0], held[i][1], true);
+        bench_run_us(100000);
+        printf("rollover: protocol=%s held=%d reported=%d error_rollover=%d\n",
+               boot ? "boot" : "report", n_held, rollover_keys, rollover_error);
+        // the boot report has six slots and says so with ErrorRollOver
+        bench_check(boot ? rollover_keys == 0 && rollover_error : rollover_keys == n_held && !rollover_error,
+                    boot ? "rollover: boot protocol" : "rollover: report protocol");
+        sim_keys_clear();
+    }
+    sim_set_boot_protocol(false);
+    sim_set_report_cb(NULL);
+}
+
+// Count reports over a second of idle typing-free time, with and
+// without a host-requested idle rate
+static void
+bench_idle_reports(void)
+{
+    static const uint8_t idle_rates[] = { 0, 125 };
+
+    sim_keys_clear();
+    for (unsigned i = 0; i < sizeof(idle_rates); ++i) {
+        hid_set_idle(idle_rates[i]);
+        bench_run_us(100000);
+
+        unsigned before = sim_reports_sent();
+        bench_run_us(1000000);
+        unsigned reports = sim_reports_sent() - before;
+        printf("idle: idle_rate_ms=%d reports_per_second=%u\n", idle_rates[i] * 4, reports);
+        bench_check(idle_rates[i] ? reports > 0 : reports == 0, "idle: reports only at the idle rate");
+    }
+    hid_set_idle(0);
+}
+
+// Read every latency histogram back through the feature report path,
+// the same way a host tool would
+static void
+print_latency_histograms(void)
+{
+    static const char *names[] = { "debounce", "queue", "usb", "total" };
+
+    for (uint8_t stage = 0; stage < LATENCY_STAGES; ++stage) {
+        struct latency_report report;
+
+        latency_set_report(&stage, 1);
+        latency_get_report((uint8_t *) &report, sizeof(report));
+
+        printf("histogram: stage=%s samples=%u max_us=%u buckets=",
+               names[report.stage], report.samples, report.max_us);
+        for (int i = 0; i < report.n_buckets; ++i)
+            printf("%s%u", i ? "," : "", report.buckets[i]);
+        printf("\n");
+    }
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [ITERATIONS [TRACE_CAPTURE]]\n"
+                    "  ITERATIONS  positive number of samples per bench (default 1000)\n", prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int iterations = 1000;
+
+    if (argc > 1) {
+        char *end;
+        long n = strtol(argv[1], &end, 10);
+        if (end == argv[1] || *end != '\0' || n <= 0 || n > INT_MAX) {
+            usage(argv[0]);
+            return 2;
+        }
+        iterations = n;
+    }
+
+    bench_settle_profile();
+    keypins_init();
+    sched_init(&host_sched, tasks, sizeof(tasks) / sizeof(tasks[0]));
+    sim_set_ep_interval_us(HID_EP_INTERVAL_MS * 1000);
+    sim_set_raw_ep_interval_us(RAW_HID_EP_INTERVAL_MS * 1000);
+
+    bench_scan(iterations);
+    bench_settle(iterations);
+    latency_reset();
+    bench_latency(iterations);
+    print_latency_histograms();
+    bench_rollover();
+    bench_layers();
+    bench_tap_hold();
+    bench_combo();
+    bench_leader();
+    bench_store();
+    bench_raw_hid();
+    bench_trace(argc > 2 ? argv[2] : NULL);
+    bench_macro();
+    bench_idle_reports();
+    bench_mouse();
+    bench_led();
+    bench_sched();
+    bench_idle();
+    bench_pio(iterations);
+    bench_ghost(iterations);
+    bench_debounce(iterations);
+
+    if (checks_failed)
+        fprintf(stderr, "%d checks failed\n", checks_failed);
+    return checks_failed ? 1 : 0;
+}
@@ -0,0 +1,46 @@
+#include "hal.h"
+#include "matrix_pio.h"
+
+// Reference model of src/rp2040/matrix_scan.pio: feed each pattern slot,
+// hold it for the settle delay, take one full GPIO sample, release and
+// hold again. Snapshots are produced on demand rather than continuously.
+
+static uint32_t column_patterns[PIO_SCAN_SLOTS];
+static uint32_t snapshots[PIO_SCAN_RING][PIO_SCAN_SLOTS];
+static uint32_t settle;
+static uint32_t seq;
+
+bool
+matrix_pio_init(uint32_t settle_us)
+{
+    settle = settle_us;
+    seq = 0;
+    pio_scan_patterns(column_patterns);
+    return true;
+}
+
+uint32_t
+matrix_pio_latest(const uint32_t **snapshot)
+{
+    uint32_t *slot = snapshots[seq % PIO_SCAN_RING];
+
+    for (int i = 0; i < PIO_SCAN_SLOTS; ++i) {
+        hal_gpio_set_mask(column_patterns[i]);
+        hal_sleep_us(settle);
+        slot[i] = hal_gpio_get_all();
+        hal_gpio_clr_mask(column_patterns[i]);
+        hal_sleep_us(settle);
+    }
+
+    *snapshot = slot;
+    return seq++;
+}
+
+void
+matrix_pio_idle(bool idle)
+{
+    if (idle)
+        hal_gpio_set_mask(MATRIX_COLUMN_MASK);
+    else
+        hal_gpio_clr_mask(MATRIX_COLUMN_MASK);
+}
@@ -0,0 +1,216 @@
+#include <string.h>
+
+#include "raw_client.h"
+
+// Packets that may arrive ahead of a response: the matrix stream, or
+// answers to requests that timed out earlier
+#define RAW_CLIENT_SKIP_MAX 64
+
+static void
+dispatch_stream(struct raw_client *client, const struct raw_hid_packet *packet)
+{
+    if (packet->header.command == RAW_EVT_MATRIX && client->on_matrix)
+        client->on_matrix(client->ctx, &packet->matrix);
+}
+
+int
+raw_client_request(struct raw_client *client, struct raw_hid_packet *packet)
+{
+    struct raw_hid_packet response;
+
+    packet->header.status = 0;
+    packet->header.tag = ++client->tag;
+    if (!client->send(client->ctx, (const uint8_t *) packet))
+        return RAW_CLIENT_ERR_TRANSPORT;
+
+    for (int i = 0; i < RAW_CLIENT_SKIP_MAX; ++i) {
+        if (!client->recv(client->ctx, (uint8_t *) &response))
+            return RAW_CLIENT_ERR_TRANSPORT;
+
+        if (response.header.command == packet->header.command &&
+            response.header.tag == packet->header.tag) {
+            *packet = response;
+            return packet->header.status;
+        }
+        dispatch_stream(client, &response);
+    }
+    return RAW_CLIENT_ERR_PROTOCOL;
+}
+
+int
+raw_client_poll(struct raw_client *client)
+{
+    struct raw_hid_packet packet;
+
+    if (!client->recv(client->ctx, (uint8_t *) &packet))
+        return RAW_CLIENT_ERR_TRANSPORT;
+    dispatch_stream(client, &packet);
+    return RAW_OK;
+}
+
+static int
+raw_client_command(struct raw_client *client, uint8_t command, struct raw_hid_packet *packet)
+{
+    memset(packet, 0, sizeof(*packet));
+    packet->header.command = command;
+    return raw_client_request(client, packet);
+}
+
+int
+raw_client_hello(struct raw_client *client, struct raw_hid_hello *hello)
+{
+    struct raw_hid_packet packet;
+    int status = raw_client_command(client, RAW_CMD_HELLO, &packet);
+
+    if (status == RAW_OK)
+        *hello = packet.hello;
+    if (status == RAW_OK && hello->version != RAW_HID_VERSION)
+        status = RAW_CLIENT_ERR_PROTOCOL;
+    return status;
+}
+
+// Keymap transfers are split into packets of RAW_HID_KEYMAP_MAX actions
+int
+raw_client_keymap_read(struct raw_client *client, int layer, int first, int count, action_t *actions)
+{
+    while (count > 0) {
+        struct raw_hid_packet packet = { .header.command = RAW_CMD_KEYMAP_READ };
+        int n = count < (int) RAW_HID_KEYMAP_MAX ? count : (int) RAW_HID_KEYMAP_MAX;
+
+        packet.keymap.layer = layer;
+        packet.keymap.first = first;
+        packet.keymap.count = n;
+
+        int status = raw_client_request(client, &packet);
+        if (status != RAW_OK)
+            return status;
+        if (packet.keymap.count != n)
+            return RAW_CLIENT_ERR_PROTOCOL;
+
+        memcpy(actions, packet.keymap.actions, n * sizeof(action_t));
+        actions += n;
+        first += n;
+        count -= n;
+    }
+    return RAW_OK;
+}
+
+int
+raw_client_keymap_write(struct raw_client *client, int layer, int first, int count, const action_t *actions)
+{
+    while (count > 0) {
+        struct raw_hid_packet packet = { .header.command = RAW_CMD_KEYMAP_WRITE };
+        int n = count < (int) RAW_HID_KEYMAP_MAX ? count : (int) RAW_HID_KEYMAP_MAX;
+
+        packet.keymap.layer = layer;
+        packet.keymap.first = first;
+        packet.keymap.count = n;
+        memcpy(packet.keymap.actions, actions, n * sizeof(action_t));
+
+        int status = raw_client_request(client, &packet);
+        if (status != RAW_OK)
+            return status;
+
+        actions += n;
+        first += n;
+        count -= n;
+    }
+    return RAW_OK;
+}
+
+int
+raw_client_commit(struct raw_client *client, uint32_t *sequence)
+{
+    struct raw_hid_packet packet;
+    int status = raw_client_command(client, RAW_CMD_KEYMAP_COMMIT, &packet);
+
+    if (status == RAW_OK || status == RAW_ERR_FLASH)
+        *sequence = packet.commit.sequence;
+    return status;
+}
+
+int
+raw_client_reset(struct raw_client *client, uint32_t *sequence)
+{
+    struct raw_hid_packet packet;
+    int status = raw_client_command(client, RAW_CMD_KEYMAP_RESET, &packet);
+
+    if (status == RAW_OK)
+        *sequence = packet.commit.sequence;
+    return status;
+}
+
+int
+raw_client_matrix(struct raw_client *client, uint16_t interval_ms, struct raw_hid_matrix *matrix)
+{
+    struct raw_hid_packet packet = { .header.command = RAW_CMD_MATRIX };
+
+    packet.matrix_request.interval_ms = interval_ms;
+    int status = raw_client_request(client, &packet);
+    if (status == RAW_OK)
+        *matrix = packet.matrix;
+    return status;
+}
+
+int
+raw_client_counters(struct raw_client *client, struct raw_hid_counters *counters)
+{
+    struct raw_hid_packet packet;
+    int status = raw_client_command(client, RAW_CMD_COUNTERS, &packet);
+
+    if (status == RAW_OK)
+        *counters = packet.counters;
+    return status;
+}
+
+int
+raw_client_trace(struct raw_client *client, struct trace_record *records, int max, int *count)
+{
+    *count = 0;
+    while (*count + (int) RAW_HID_TRACE_MAX <= max) {
+        struct raw_hid_packet packet;
+        int status = raw_client_command(client, RAW_CMD_TRACE, &packet);
+        if (status != RAW_OK)
+            return status;
+
+        int n = packet.trace.count;
+        if (n > (int) RAW_HID_TRACE_MAX)
+            return RAW_CLIENT_ERR_PROTOCOL;
+        memcpy(&records[*count], packet.trace.records, n * sizeof(struct trace_record));
+        *count += n;
+        if (n < (int) RAW_HID_TRACE_MAX)
+            break;
+    }
+    return RAW_OK;
+}
+
+int
+raw_client_tasks(struct raw_client *client, int core, int first, struct raw_hid_tasks *tasks)
+{
+    struct raw_hid_packet packet = { .header.command = RAW_CMD_TASKS };
+
+    packet.tasks_request.core = core;
+    packet.tasks_request.first = first;
+    int status = raw_client_request(client, &packet);
+    if (status != RAW_OK)
+        return status;
+    if (packet.tasks.count > RAW_HID_TASKS_MAX)
+        return RAW_CLIENT_ERR_PROTOCOL;
+    *tasks = packet.tasks;
+    return RAW_OK;
+}
+
+int
+raw_client_settle(struct raw_client *client, bool save, struct raw_hid_settle *settle)
+{
+    struct raw_hid_packet packet = { .header.command = RAW_CMD_SETTLE };
+
+    packet.settle_request.save = save;
+    int status = raw_client_request(client, &packet);
+    if (status != RAW_OK)
+        return status;
+    if (packet.settle.n_cols > RAW_HID_SETTLE_COLS)
+        return RAW_CLIENT_ERR_PROTOCOL;
+    *settle = packet.settle;
+    return RAW_OK;
+}
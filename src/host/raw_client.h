@@ -0,0 +1,53 @@
+#ifndef RAW_CLIENT_H_
+#define RAW_CLIENT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "raw_hid.h"
+
+// Reference client for the raw HID protocol, shared by the Linux tool
+// in tools/pikey_raw.c and the simulator bench. The transport moves
+// one 64-byte report at a time; recv waits for the next one and fails
+// on a timeout.
+struct raw_client {
+    bool (*send)(void *ctx, const uint8_t *report);
+    bool (*recv)(void *ctx, uint8_t *report);
+    void *ctx;
+
+    // Called with every streamed matrix packet, if set
+    void (*on_matrix)(void *ctx, const struct raw_hid_matrix *matrix);
+
+    uint8_t tag;
+};
+
+// Results are a raw_hid_status, or one of these
+#define RAW_CLIENT_ERR_TRANSPORT -1
+#define RAW_CLIENT_ERR_PROTOCOL  -2
+
+// Send a request and wait for its response in the same packet
+int raw_client_request(struct raw_client *client, struct raw_hid_packet *packet);
+
+// Receive one packet and hand it to on_matrix if streamed
+int raw_client_poll(struct raw_client *client);
+
+int raw_client_hello(struct raw_client *client, struct raw_hid_hello *hello);
+int raw_client_keymap_read(struct raw_client *client, int layer, int first, int count, action_t *actions);
+int raw_client_keymap_write(struct raw_client *client, int layer, int first, int count, const action_t *actions);
+int raw_client_commit(struct raw_client *client, uint32_t *sequence);
+int raw_client_reset(struct raw_client *client, uint32_t *sequence);
+int raw_client_matrix(struct raw_client *client, uint16_t interval_ms, struct raw_hid_matrix *matrix);
+int raw_client_counters(struct raw_client *client, struct raw_hid_counters *counters);
+
+// Pull trace records until the device has no more or fewer than a
+// packet's worth of room is left in records
+int raw_client_trace(struct raw_client *client, struct trace_record *records, int max, int *count);
+
+// One page of a core's scheduler counters, starting at task first
+int raw_client_tasks(struct raw_client *client, int core, int first, struct raw_hid_tasks *tasks);
+
+// Matrix settle delays and scan times; save stores the delays, which
+// commits pending keymap writes too
+int raw_client_settle(struct raw_client *client, bool save, struct raw_hid_settle *settle);
+
+#endif /* RAW_CLIENT_H_ */
@@ -0,0 +1,67 @@
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Controls for the simulated matrix, virtual clock and HID sink behind
+// the host HAL backend.
+
+typedef void (*sim_report_cb_t)(uint64_t time_us, uint8_t report_id, const uint8_t *report, uint16_t len);
+
+void sim_key_set(int col, int row, bool pressed);
+void sim_keys_clear(void);
+
+// Take the diodes out of the matrix, so that three keys on the corners
+// of a rectangle make the fourth read pressed too
+void sim_set_diodes(bool diodes);
+
+// Time a closed switch on the column takes to pull its row up after the
+// column is driven, and to let go after it is released; 0 by default
+void sim_set_settle_us(int col, uint8_t rise_us, uint8_t fall_us);
+
+void sim_advance_us(uint32_t us);
+
+// Reports sit in the simulated endpoint until the next bInterval
+// boundary; sim_report_complete() delivers them to the report callback
+// and returns true when the application should be told.
+void sim_set_report_cb(sim_report_cb_t cb);
+void sim_set_ep_interval_us(uint32_t us);
+bool sim_report_complete(void);
+unsigned sim_reports_sent(void);
+
+// When the next report on either endpoint completes, UINT64_MAX if
+// none is in flight
+uint64_t sim_next_completion_us(void);
+void sim_set_boot_protocol(bool boot);
+unsigned sim_bootloader_requests(void);
+
+// The raw HID IN endpoint works the same way on its own interval
+typedef void (*sim_raw_report_cb_t)(uint64_t time_us, const uint8_t *report, uint16_t len);
+
+void sim_set_raw_report_cb(sim_raw_report_cb_t cb);
+void sim_set_raw_ep_interval_us(uint32_t us);
+bool sim_raw_report_complete(void);
+
+// Refuse the next few raw reports as if the endpoint had been taken
+void sim_raw_report_refuse(int reports);
+
+// Duty an indicator LED shows right now, and how many times the LED
+// outputs were reprogrammed
+uint16_t sim_led_duty(int led);
+unsigned sim_led_writes(void);
+
+// Flash region behind hal_flash_*: erased to 0xff by sim_flash_reset().
+// After a power fail the given number of further bytes are programmed
+// and everything else is lost until the next reset.
+void sim_flash_reset(void);
+void sim_flash_power_fail_after(long bytes);
+void sim_flash_corrupt(uint32_t offset);
+unsigned sim_flash_erase_count(int sector);
+
+// Bytes sent on the debug UART, which drains at 115200 baud
+const uint8_t *sim_uart_output(size_t *len);
+void sim_uart_clear(void);
+
+#endif /* SIM_H_ */
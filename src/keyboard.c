@@ -0,0 +1,238 @@
+#include <string.h>
+
+#include "combo.h"
+#include "config.h"
+#include "debounce.h"
+#include "event_queue.h"
+#include "hal.h"
+#include "keyboard.h"
+#include "layer.h"
+#include "leader.h"
+#include "matrix.h"
+#include "sched.h"
+#include "store.h"
+#include "tap_hold.h"
+#include "trace.h"
+
+static matrix_t raw_matrix;
+static matrix_t prev_raw_matrix;
+static matrix_t key_matrix;
+static matrix_t prev_matrix;
+
+// When each key's raw input last changed, for latency accounting
+static uint32_t raw_change_us[N_KEYS];
+
+static struct scan_stats scan_stats;
+
+// Keys ghost blocking held back in the last scan
+static int ghosts_held;
+
+// Odd while poll_columns() updates key_matrix
+static volatile uint32_t matrix_seq;
+
+// Store generation the keymap and settings were last loaded from
+static uint32_t store_seen;
+
+// Idle: columns all driven and no scanning until a row rises. Entered
+// once nothing has been down for IDLE_LINGER_MS, which must outlast
+// the one timer that runs with every key up.
+_Static_assert(IDLE_LINGER_MS == 0 || IDLE_LINGER_MS > LEADER_TIMEOUT_MS,
+               "idle would stop a leader sequence from timing out");
+
+static bool idle;
+static uint64_t active_us;
+static uint64_t idle_since_us;
+
+// Timestamp raw input changes so debounce delay can be measured
+static void
+track_raw_changes(uint32_t time_us)
+{
+    for (int word = 0; word < MATRIX_WORDS; ++word) {
+        uint32_t changed = raw_matrix.w[word] ^ prev_raw_matrix.w[word];
+        while (changed) {
+            raw_change_us[word * 32 + __builtin_ctz(changed)] = time_us;
+            changed &= changed - 1;
+        }
+    }
+    prev_raw_matrix = raw_matrix;
+}
+
+// Hand every key whose debounced state changed to the combo engine
+static void
+emit_changes(uint32_t time_us)
+{
+    for (int word = 0; word < MATRIX_WORDS; ++word) {
+        uint32_t changed = key_matrix.w[word] ^ prev_matrix.w[word];
+        while (changed) {
+            int bit = __builtin_ctz(changed);
+            changed &= changed - 1;
+            int key = word * 32 + bit;
+            struct key_event event = {
+                .sample_us = raw_change_us[key],
+                .time_us = time_us,
+                .key = key,
+                .pressed = (key_matrix.w[word] >> bit) & 1,
+            };
+            trace(TRACE_KEY, key, event.pressed);
+            combo_process(&event);
+        }
+    }
+    prev_matrix = key_matrix;
+}
+
+// Possible ghosts keep their previous raw state, so a key held before
+// a rectangle formed stays down and a phantom never goes down
+static void
+ghost_filter(void)
+{
+    int held = matrix_ghost_filter(&raw_matrix, &prev_raw_matrix);
+
+    if (held)
+        scan_stats.ghosted++;
+    if (held != ghosts_held)
+        trace(TRACE_GHOST, 0, held);
+    ghosts_held = held;
+}
+
+int 
+poll_columns(void) 
+{
+    matrix_scan(&raw_matrix);
+    if (MATRIX_GHOST_FILTER)
+        ghost_filter();
+    matrix_seq++;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    debounce_update(&raw_matrix, &key_matrix);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    matrix_seq++;
+
+    return 0;
+}
+
+// Apply the active keymap and settings from the store; algorithm and
+// mode changes restart their state machines, so only do that if they
+// actually changed. The settings are compared against a copy: the
+// image they came from may since have been erased or reprogrammed.
+static void
+keymap_load(void)
+{
+    static struct store_settings loaded;
+    static bool have_loaded;
+    uint32_t generation = store_generation();
+    const struct store_settings settings = *store_settings();
+
+    if (!have_loaded || settings.debounce_algorithm != loaded.debounce_algorithm)
+        debounce_init(settings.debounce_algorithm < DEBOUNCE_COUNT ?
+                      settings.debounce_algorithm : DEBOUNCE_ALGORITHM);
+    if (!have_loaded || settings.tap_hold_mode != loaded.tap_hold_mode)
+        tap_hold_init(settings.tap_hold_mode < TAP_HOLD_MODE_COUNT ?
+                      settings.tap_hold_mode : TAP_HOLD_MODE);
+    tap_hold_set_term_ms(settings.tapping_term_ms);
+    matrix_settle_load(settings.settle_drive_us, settings.settle_release_us);
+    layer_init();
+
+    loaded = settings;
+    have_loaded = true;
+    store_seen = generation;
+}
+
+void 
+keypins_init(void)
+{
+    matrix_init();
+    store_init();
+    keymap_load();
+    combo_init();
+}
+
+// Scan on a microsecond deadline, SCAN_INTERVAL_US apart, and push the
+// resulting key events to the report side. Runs on core1 when
+// DUAL_CORE is set, otherwise next to the report side on core0.
+uint64_t 
+scan_task(void) 
+{
+    static uint64_t next_scan_us = 0;
+    uint64_t now_us = hal_time_us();
+
+    if (idle) {
+        // the row edge interrupt wakes the scheduler
+        if (!matrix_idle_woken())
+            return SCHED_IDLE;
+
+        // scan straight away rather than on the old schedule
+        matrix_idle_exit();
+        idle = false;
+        scan_stats.wakes++;
+        trace(TRACE_WAKE, 0, now_us - idle_since_us);
+        now_us = hal_time_us();
+        next_scan_us = now_us;
+        active_us = now_us;
+    }
+
+    if (now_us < next_scan_us) return next_scan_us; // not enough time
+
+    // if we fell more than a whole interval behind, don't try to
+    // catch up with a burst of back-to-back scans
+    next_scan_us += SCAN_INTERVAL_US;
+    if (next_scan_us <= now_us)
+        next_scan_us = now_us + SCAN_INTERVAL_US;
+
+    if (store_generation() != store_seen)
+        keymap_load();
+
+    poll_columns();
+    track_raw_changes(now_us);
+    emit_changes(now_us);
+    combo_task(now_us);
+    tap_hold_task(now_us);
+    leader_task(now_us);
+
+    uint32_t elapsed = hal_time_us() - now_us;
+    scan_stats.done_us = now_us + elapsed;
+    scan_stats.scans++;
+    scan_stats.last_us = elapsed;
+    if (elapsed > scan_stats.max_us)
+        scan_stats.max_us = elapsed;
+    if (elapsed > SCAN_INTERVAL_US) {
+        scan_stats.overruns++;
+        trace(TRACE_SCAN_OVERRUN, 0, elapsed);
+    }
+
+    if (!matrix_empty(&raw_matrix) || !matrix_empty(&key_matrix)) {
+        active_us = now_us;
+    } else if (IDLE_LINGER_MS && now_us - active_us >= IDLE_LINGER_MS * 1000ull) {
+        matrix_idle_enter();
+        idle = true;
+        idle_since_us = hal_time_us();
+        trace(TRACE_IDLE, 0, scan_stats.scans);
+        // a key that closed while the rows were being armed may have
+        // raised no edge to wake on; come straight back round instead
+        return matrix_idle_woken() ? idle_since_us : SCHED_IDLE;
+    }
+    return next_scan_us;
+}
+
+bool
+keyboard_idle(void)
+{
+    return idle;
+}
+
+const struct scan_stats *
+keyboard_scan_stats(void)
+{
+    return &scan_stats;
+}
+
+void
+keyboard_matrix(matrix_t *keys)
+{
+    uint32_t seq;
+
+    do {
+        seq = matrix_seq;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        *keys = key_matrix;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != matrix_seq);
+}
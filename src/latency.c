@@ -0,0 +1,75 @@
+#include <string.h>
+
+#include "latency.h"
+
+struct latency_histogram {
+    uint32_t samples;
+    uint32_t max_us;
+    uint16_t buckets[LATENCY_BUCKETS];
+};
+
+static struct latency_histogram histograms[LATENCY_STAGES];
+static uint8_t selected_stage;
+
+static inline int
+latency_bucket(uint32_t us)
+{
+    int bucket = us ? 31 - __builtin_clz(us) : 0;
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+void
+latency_record(enum latency_stage stage, uint32_t us)
+{
+    struct latency_histogram *h = &histograms[stage];
+    uint16_t *bucket = &h->buckets[latency_bucket(us)];
+
+    if (*bucket != UINT16_MAX)
+        (*bucket)++;
+    h->samples++;
+    if (us > h->max_us)
+        h->max_us = us;
+}
+
+void
+latency_reset(void)
+{
+    memset(histograms, 0, sizeof(histograms));
+}
+
+void
+latency_summary(enum latency_stage stage, uint32_t *samples, uint32_t *max_us)
+{
+    *samples = histograms[stage].samples;
+    *max_us = histograms[stage].max_us;
+}
+
+uint16_t
+latency_get_report(uint8_t *buffer, uint16_t reqlen)
+{
+    const struct latency_histogram *h = &histograms[selected_stage];
+    struct latency_report report = {
+        .stage = selected_stage,
+        .n_stages = LATENCY_STAGES,
+        .n_buckets = LATENCY_BUCKETS,
+        .samples = h->samples,
+        .max_us = h->max_us,
+    };
+    memcpy(report.buckets, h->buckets, sizeof(report.buckets));
+
+    uint16_t len = reqlen < LATENCY_REPORT_LEN ? reqlen : LATENCY_REPORT_LEN;
+    memcpy(buffer, &report, len);
+    return len;
+}
+
+void
+latency_set_report(const uint8_t *buffer, uint16_t bufsize)
+{
+    if (bufsize < 1)
+        return;
+
+    if (buffer[0] < LATENCY_STAGES)
+        selected_stage = buffer[0];
+    if (bufsize >= 2 && buffer[1] == LATENCY_CMD_RESET)
+        latency_reset();
+}
@@ -0,0 +1,92 @@
+#include "layer.h"
+#include "store.h"
+#include "trace.h"
+
+// Keymap in use: the flash image or the compiled table
+static const action_t (*keymap)[N_KEYS];
+
+// Layers on which each key has a non-transparent action
+static uint32_t opaque_layers[N_KEYS];
+
+static uint32_t active_layers = 1;
+static uint32_t oneshot_layers;
+
+// Highest active layer with a non-transparent action, per key
+static uint8_t key_layer[N_KEYS];
+
+static void
+layer_state_set(uint32_t state)
+{
+    active_layers = state | 1;
+    trace(TRACE_LAYER, 0, active_layers);
+
+    for (int key = 0; key < N_KEYS; ++key) {
+        uint32_t layers = active_layers & opaque_layers[key];
+        key_layer[key] = layers ? 31 - __builtin_clz(layers) : 0;
+    }
+}
+
+void
+layer_init(void)
+{
+    keymap = store_keymap();
+
+    for (int key = 0; key < N_KEYS; ++key) {
+        opaque_layers[key] = 0;
+        for (int layer = 0; layer < N_LAYERS; ++layer)
+            if (ACTION_TAG(keymap[layer][key]) != ACT_TAG_TRANS)
+                opaque_layers[key] |= 1u << layer;
+    }
+
+    oneshot_layers = 0;
+    layer_state_set(1);
+}
+
+action_t
+layer_action(int key)
+{
+    return keymap[key_layer[key]][key];
+}
+
+void
+layer_on(int layer)
+{
+    layer_state_set(active_layers | (1u << layer));
+}
+
+void
+layer_off(int layer)
+{
+    oneshot_layers &= ~(1u << layer);
+    layer_state_set(active_layers & ~(1u << layer));
+}
+
+void
+layer_toggle(int layer)
+{
+    layer_state_set(active_layers ^ (1u << layer));
+}
+
+uint32_t
+layer_state(void)
+{
+    return active_layers;
+}
+
+void
+layer_oneshot(int layer)
+{
+    oneshot_layers |= 1u << layer;
+    layer_on(layer);
+}
+
+void
+layer_oneshot_consume(void)
+{
+    if (!oneshot_layers)
+        return;
+
+    uint32_t state = active_layers & ~oneshot_layers;
+    oneshot_layers = 0;
+    layer_state_set(state);
+}
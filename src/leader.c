@@ -0,0 +1,49 @@
+#include "config.h"
+#include "event_queue.h"
+#include "leader.h"
+
+#include "leader_trie.h"
+
+static bool active;
+static uint16_t state;
+static uint32_t last_us;
+
+void
+leader_start(const struct key_event *change)
+{
+    active = true;
+    state = 0;
+    last_us = change->time_us;
+}
+
+bool
+leader_active(void)
+{
+    return active;
+}
+
+// One step down the trie: an add, a bounds check and a compare
+void
+leader_feed(const struct key_event *change, uint8_t usage)
+{
+    uint32_t next = leader_base[state] + usage;
+
+    last_us = change->time_us;
+    if (leader_base[state] == 0 || next >= LEADER_TRIE_SIZE || leader_check[next] != state + 1) {
+        active = false;
+        return;
+    }
+
+    state = next;
+    if (leader_base[state] == 0) {
+        active = false;
+        action_tap(change, leader_action[state]);
+    }
+}
+
+void
+leader_task(uint32_t now_us)
+{
+    if (active && now_us - last_us >= LEADER_TIMEOUT_MS * 1000u)
+        active = false;
+}
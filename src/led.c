@@ -0,0 +1,76 @@
+#include "hal.h"
+#include "led.h"
+
+struct led_state {
+    enum led_pattern pattern;
+    uint8_t brightness;
+    uint32_t period_ms;
+};
+
+static struct led_state state[LED_COUNT];
+static uint16_t waveforms[LED_COUNT][LED_WAVEFORM_MAX];
+
+uint16_t
+led_duty(uint8_t brightness)
+{
+    // 255 * 255 + 2 * 255 == 0xffff
+    return brightness * (brightness + 2);
+}
+
+void
+led_init(const int pins[LED_COUNT])
+{
+    hal_led_init(pins, LED_COUNT);
+    for (int led = 0; led < LED_COUNT; ++led)
+        state[led] = (struct led_state) { LED_OFF, 0, 0 };
+}
+
+// One period of the pattern, an entry per LED_STEP_MS; returns the
+// number of entries
+static int
+render(uint16_t *table, enum led_pattern pattern, uint8_t brightness, uint32_t period_ms)
+{
+    int steps = period_ms / LED_STEP_MS;
+
+    if (steps < 2)
+        steps = 2;
+    if (steps > LED_WAVEFORM_MAX)
+        steps = LED_WAVEFORM_MAX;
+
+    int half = steps / 2;
+    for (int i = 0; i < steps; ++i) {
+        if (pattern == LED_BLINK) {
+            table[i] = i < half ? led_duty(brightness) : 0;
+        } else {
+            // triangle through the gamma curve, so the fade looks even
+            int ramp = i < half ? i : steps - i;
+            table[i] = led_duty(brightness * ramp / half);
+        }
+    }
+    return steps;
+}
+
+void
+led_set(enum led led, enum led_pattern pattern, uint8_t brightness, uint32_t period_ms)
+{
+    struct led_state next = { pattern, brightness, period_ms };
+
+    if (pattern == LED_OFF || pattern == LED_ON)
+        next.period_ms = 0;
+    if (pattern == LED_OFF)
+        next.brightness = 0;
+    if (next.pattern == state[led].pattern && next.brightness == state[led].brightness &&
+        next.period_ms == state[led].period_ms)
+        return;
+    state[led] = next;
+
+    if (pattern == LED_OFF || pattern == LED_ON) {
+        hal_led_level(led, led_duty(next.brightness));
+        return;
+    }
+
+    // stop the old waveform before its table is overwritten
+    hal_led_level(led, 0);
+    int steps = render(waveforms[led], pattern, brightness, period_ms);
+    hal_led_waveform(led, waveforms[led], steps);
+}
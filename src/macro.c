@@ -0,0 +1,311 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "config.h"
+#include "macro.h"
+#include "report.h"
+#include "store.h"
+#include "trace.h"
+
+// US layout: usage for each printable ASCII character, with MACRO_SHIFT
+// set when it needs Shift. Zero entries are not typed.
+#define MACRO_SHIFT 0x80
+
+static const uint8_t ascii_usage[128] = {
+    ['\t'] = KEY_TAB, ['\n'] = KEY_ENTER, [' '] = KEY_SPACE,
+    ['!'] = MACRO_SHIFT | KEY_1, ['"'] = MACRO_SHIFT | KEY_APOSTROPHE,
+    ['#'] = MACRO_SHIFT | KEY_3, ['$'] = MACRO_SHIFT | KEY_4,
+    ['%'] = MACRO_SHIFT | KEY_5, ['&'] = MACRO_SHIFT | KEY_7,
+    ['\''] = KEY_APOSTROPHE, ['('] = MACRO_SHIFT | KEY_9,
+    [')'] = MACRO_SHIFT | KEY_0, ['*'] = MACRO_SHIFT | KEY_8,
+    ['+'] = MACRO_SHIFT | KEY_EQUAL, [','] = KEY_COMMA, ['-'] = KEY_MINUS,
+    ['.'] = KEY_DOT, ['/'] = KEY_SLASH,
+    ['0'] = KEY_0, ['1'] = KEY_1, ['2'] = KEY_2, ['3'] = KEY_3, ['4'] = KEY_4,
+    ['5'] = KEY_5, ['6'] = KEY_6, ['7'] = KEY_7, ['8'] = KEY_8, ['9'] = KEY_9,
+    [':'] = MACRO_SHIFT | KEY_SEMICOLON, [';'] = KEY_SEMICOLON,
+    ['<'] = MACRO_SHIFT | KEY_COMMA, ['='] = KEY_EQUAL,
+    ['>'] = MACRO_SHIFT | KEY_DOT, ['?'] = MACRO_SHIFT | KEY_SLASH,
+    ['@'] = MACRO_SHIFT | KEY_2,
+    ['A'] = MACRO_SHIFT | KEY_A, ['B'] = MACRO_SHIFT | KEY_B, ['C'] = MACRO_SHIFT | KEY_C,
+    ['D'] = MACRO_SHIFT | KEY_D, ['E'] = MACRO_SHIFT | KEY_E, ['F'] = MACRO_SHIFT | KEY_F,
+    ['G'] = MACRO_SHIFT | KEY_G, ['H'] = MACRO_SHIFT | KEY_H, ['I'] = MACRO_SHIFT | KEY_I,
+    ['J'] = MACRO_SHIFT | KEY_J, ['K'] = MACRO_SHIFT | KEY_K, ['L'] = MACRO_SHIFT | KEY_L,
+    ['M'] = MACRO_SHIFT | KEY_M, ['N'] = MACRO_SHIFT | KEY_N, ['O'] = MACRO_SHIFT | KEY_O,
+    ['P'] = MACRO_SHIFT | KEY_P, ['Q'] = MACRO_SHIFT | KEY_Q, ['R'] = MACRO_SHIFT | KEY_R,
+    ['S'] = MACRO_SHIFT | KEY_S, ['T'] = MACRO_SHIFT | KEY_T, ['U'] = MACRO_SHIFT | KEY_U,
+    ['V'] = MACRO_SHIFT | KEY_V, ['W'] = MACRO_SHIFT | KEY_W, ['X'] = MACRO_SHIFT | KEY_X,
+    ['Y'] = MACRO_SHIFT | KEY_Y, ['Z'] = MACRO_SHIFT | KEY_Z,
+    ['['] = KEY_LEFTBRACE, ['\\'] = KEY_BACKSLASH, [']'] = KEY_RIGHTBRACE,
+    ['^'] = MACRO_SHIFT | KEY_6, ['_'] = MACRO_SHIFT | KEY_MINUS, ['`'] = KEY_GRAVE,
+    ['a'] = KEY_A, ['b'] = KEY_B, ['c'] = KEY_C, ['d'] = KEY_D, ['e'] = KEY_E,
+    ['f'] = KEY_F, ['g'] = KEY_G, ['h'] = KEY_H, ['i'] = KEY_I, ['j'] = KEY_J,
+    ['k'] = KEY_K, ['l'] = KEY_L, ['m'] = KEY_M, ['n'] = KEY_N, ['o'] = KEY_O,
+    ['p'] = KEY_P, ['q'] = KEY_Q, ['r'] = KEY_R, ['s'] = KEY_S, ['t'] = KEY_T,
+    ['u'] = KEY_U, ['v'] = KEY_V, ['w'] = KEY_W, ['x'] = KEY_X, ['y'] = KEY_Y,
+    ['z'] = KEY_Z,
+    ['{'] = MACRO_SHIFT | KEY_LEFTBRACE, ['|'] = MACRO_SHIFT | KEY_BACKSLASH,
+    ['}'] = MACRO_SHIFT | KEY_RIGHTBRACE, ['~'] = MACRO_SHIFT | KEY_GRAVE,
+};
+
+// Macros triggered while another one runs wait here; more are dropped
+#define MACRO_QUEUE_SIZE 4
+
+static uint8_t macro_queue[MACRO_QUEUE_SIZE];
+static int queue_head;
+static int queue_len;
+
+static const uint8_t *pc;   // next op of the running macro, NULL when idle
+static const char *text;    // rest of the string being typed, or NULL
+static uint32_t wait_until_us;
+static bool waiting;
+
+// Usages to release in the next step (the second half of a tap)
+static uint8_t release[2];
+static int n_release;
+
+// Run of text keys down in the current report, and whether the text
+// currently holds Shift
+static uint8_t text_held[MACRO_TEXT_KEYS_PER_REPORT];
+static int n_text_held;
+static bool text_shift;
+
+// Usages held by M_DOWN, released by M_UP or at the end of the macro
+static uint8_t held[NKRO_REPORT_BYTES];
+
+static void
+macro_tap(uint8_t usage)
+{
+    report_usage(usage, true);
+    release[n_release++] = usage;
+}
+
+static void
+macro_hold(uint8_t usage, bool pressed)
+{
+    uint8_t bit = 1 << (usage & 7);
+    bool is_held = held[usage >> 3] & bit;
+
+    if (pressed == is_held)
+        return;
+    held[usage >> 3] ^= bit;
+    report_usage(usage, pressed);
+}
+
+// Release everything M_DOWN left held; true if anything was
+static bool
+macro_release_held(void)
+{
+    bool released = false;
+
+    for (int byte = 0; byte < NKRO_REPORT_BYTES; ++byte) {
+        uint32_t bits = held[byte];
+        while (bits) {
+            report_usage(byte * 8 + __builtin_ctz(bits), false);
+            bits &= bits - 1;
+            released = true;
+        }
+        held[byte] = 0;
+    }
+    return released;
+}
+
+void
+macro_start(int index)
+{
+    if (store_macro(index) == NULL || queue_len == MACRO_QUEUE_SIZE)
+        return;
+
+    macro_queue[(queue_head + queue_len++) % MACRO_QUEUE_SIZE] = index;
+    trace(TRACE_MACRO, index, 0);
+}
+
+bool
+macro_busy(void)
+{
+    return pc != NULL || queue_len != 0 || n_release != 0;
+}
+
+uint32_t
+macro_wait_us(uint32_t now_us)
+{
+    int32_t left = wait_until_us - now_us;
+
+    return waiting && left > 0 ? left : 0;
+}
+
+static uint8_t
+text_entry(unsigned char c)
+{
+    return c < sizeof(ascii_usage) ? ascii_usage[c] : 0;
+}
+
+static bool
+text_is_held(uint8_t usage)
+{
+    for (int i = 0; i < n_text_held; ++i)
+        if (text_held[i] == usage)
+            return true;
+    return false;
+}
+
+static void
+text_release(void)
+{
+    for (int i = 0; i < n_text_held; ++i)
+        report_usage(text_held[i], false);
+    n_text_held = 0;
+}
+
+// Type the next run of characters of the current string in one report.
+// Keys pressed in the same report reach the host in usage order, so a
+// run only grows while usages ascend; it also shares one shift state
+// and leaves out keys still down from the previous run. The previous
+// run is released in the same report, except where the shift state
+// changes or a key repeats, which take a report of their own. False
+// once the string is done and everything is released.
+static bool
+macro_text_step(void)
+{
+    uint8_t run[MACRO_TEXT_KEYS_PER_REPORT];
+    const char *p = text;
+    bool shift = text_shift;
+    int n = 0;
+
+    for (; *p && n < MACRO_TEXT_KEYS_PER_REPORT; ++p) {
+        uint8_t entry = text_entry(*p);
+        uint8_t usage = entry & ~MACRO_SHIFT;
+
+        if (entry == 0)
+            continue;
+        if (n == 0)
+            shift = entry & MACRO_SHIFT;
+        if ((bool) (entry & MACRO_SHIFT) != shift || text_is_held(usage) ||
+            (n && usage <= run[n - 1]))
+            break;
+        run[n++] = usage;
+    }
+
+    if (n == 0 || shift != text_shift) {
+        bool changed = n_text_held != 0 || shift != text_shift;
+
+        text_release();
+        if (shift != text_shift) {
+            report_usage(KEY_LEFTSHIFT, shift);
+            text_shift = shift;
+        }
+        if (n == 0 && *p == '\0') {
+            if (text_shift) {
+                report_usage(KEY_LEFTSHIFT, false);
+                text_shift = false;
+                changed = true;
+            }
+            text = NULL;
+        }
+        return changed;
+    }
+
+    text_release();
+    for (int i = 0; i < n; ++i)
+        report_usage(run[i], true);
+    memcpy(text_held, run, n);
+    n_text_held = n;
+    text = p;
+    return true;
+}
+
+bool
+macro_task(uint32_t now_us)
+{
+    if (n_release) {
+        for (int i = 0; i < n_release; ++i)
+            report_usage(release[i], false);
+        n_release = 0;
+        return true;
+    }
+
+    if (waiting) {
+        if ((int32_t) (now_us - wait_until_us) < 0)
+            return false;
+        waiting = false;
+    }
+
+    for (;;) {
+        if (text && macro_text_step())
+            return true;
+
+        if (pc == NULL) {
+            if (queue_len == 0)
+                return false;
+            pc = store_macro(macro_queue[queue_head]);
+            queue_head = (queue_head + 1) % MACRO_QUEUE_SIZE;
+            queue_len--;
+            if (pc == NULL)
+                continue;
+        }
+
+        switch (*pc++) {
+        case MACRO_OP_DOWN:
+            macro_hold(*pc++, true);
+            return true;
+        case MACRO_OP_UP:
+            macro_hold(*pc++, false);
+            return true;
+        case MACRO_OP_TAP:
+            macro_tap(*pc++);
+            return true;
+        case MACRO_OP_DELAY:
+            wait_until_us = now_us + (pc[0] | pc[1] << 8) * 1000u;
+            waiting = true;
+            pc += 2;
+            return false;
+        case MACRO_OP_STR:
+            text = (const char *) pc;
+            pc += strlen(text) + 1;
+            break;
+        case MACRO_OP_TEXT:
+            if (*pc < N_MACRO_TEXT) {
+                text = macro_text[*pc++];
+                break;
+            }
+            // a stored macro can name text this build no longer has;
+            // end it there
+            /* fall through */
+        case MACRO_OP_END:
+        default:
+            pc = NULL;
+            if (macro_release_held())
+                return true;
+            break;
+        }
+    }
+}
+
+int
+macro_code_length(const uint8_t *code, int max)
+{
+    int len = 0;
+
+    while (len < max) {
+        switch (code[len++]) {
+        case MACRO_OP_DOWN:
+        case MACRO_OP_UP:
+        case MACRO_OP_TAP:
+        case MACRO_OP_TEXT:
+            len += 1;
+            break;
+        case MACRO_OP_DELAY:
+            len += 2;
+            break;
+        case MACRO_OP_STR: {
+            const uint8_t *end = len < max ? memchr(&code[len], 0, max - len) : NULL;
+            if (end == NULL)
+                return -1;
+            len = end - code + 1;
+            break;
+        }
+        default:
+            return len;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,313 @@
+#include <string.h>
+
+#include "hal.h"
+#include "matrix.h"
+#include "matrix_pio.h"
+#include "trace.h"
+
+// Wait after driving or releasing a column until it is calibrated, and
+// the most any calibration can give
+#define MATRIX_SETTLE_US 10
+
+// Settle calibration: every MATRIX_CALIBRATE_SCANS scans, each column
+// that had a key down last scan is sampled every microsecond through
+// MATRIX_CALIBRATE_ROUNDS drive/release cycles instead of waiting. Only
+// a closed switch shows how long a column takes to settle, so columns
+// nobody has pressed yet stay at MATRIX_SETTLE_US.
+#define MATRIX_CALIBRATE_SCANS  1000
+#define MATRIX_CALIBRATE_ROUNDS 4
+
+_Static_assert(N_COLS <= 32, "calibrated columns are kept as a bit mask");
+
+#define MATRIX_PIN_BIT_ENTRY(pin) (1u << (pin)),
+const uint32_t matrix_column_bits[N_COLS] = { CONFIG_COLUMN_PINS(MATRIX_PIN_BIT_ENTRY) };
+
+static struct matrix_settle settle;
+
+// Ghost blocking works on pairs of rows: bit p of row_pairs[rows] is
+// set when rows holds both rows of pair p, and pair_rows[p] gives them
+// back. A pair closed on two columns is a rectangle.
+#define ROW_PAIRS (N_ROWS * (N_ROWS - 1) / 2)
+_Static_assert(ROW_PAIRS <= 32, "row pairs are kept as a bit mask");
+
+static uint32_t row_pairs[1u << N_ROWS];
+static uint32_t pair_rows[ROW_PAIRS];
+
+// Columns with a key down in the last scan, and scans since the last
+// calibration
+static uint32_t active_cols;
+static uint32_t calibrate_countdown;
+
+#if MATRIX_SCAN_PIO
+static bool pio_active;
+#endif
+
+// Measured time plus half again and a microsecond, as a delay
+static uint8_t
+settle_margin(int measured_us)
+{
+    int us = measured_us + measured_us / 2 + 1;
+    return us < MATRIX_SETTLE_US ? us : MATRIX_SETTLE_US;
+}
+
+// Raise a column's delays to cover a measurement; the first one for a
+// column replaces the uncalibrated MATRIX_SETTLE_US
+static void
+settle_update(int col, uint8_t drive_us, uint8_t release_us)
+{
+    uint32_t bit = 1u << col;
+
+    if (!(settle.calibrated & bit) || drive_us > settle.drive_us[col])
+        settle.drive_us[col] = drive_us;
+    if (!(settle.calibrated & bit) || release_us > settle.release_us[col])
+        settle.release_us[col] = release_us;
+    settle.calibrated |= bit;
+}
+
+// Microseconds after the column edge until the last change on the
+// rows, sampling every microsecond up to MATRIX_SETTLE_US; *rows gets
+// the final sample
+static int
+settle_sample(uint32_t *rows)
+{
+    uint32_t last = hal_gpio_get_all() & MATRIX_ROW_MASK;
+    int changed_us = 0;
+
+    for (int us = 1; us <= MATRIX_SETTLE_US; ++us) {
+        hal_sleep_us(1);
+        uint32_t gpio = hal_gpio_get_all() & MATRIX_ROW_MASK;
+        if (gpio != last)
+            changed_us = us;
+        last = gpio;
+    }
+    *rows = last;
+    return changed_us;
+}
+
+// Drive and release a column MATRIX_CALIBRATE_ROUNDS times, sampling
+// in place of the settle waits, and return the rows it read. Rounds
+// that saw no key down on it measure nothing.
+static uint32_t
+calibrate_column(int col)
+{
+    int drive_max = -1, release_max = -1;
+    uint32_t rows = 0;
+
+    for (int round = 0; round < MATRIX_CALIBRATE_ROUNDS; ++round) {
+        uint32_t driven, released;
+
+        hal_gpio_set_mask(matrix_column_bits[col]);
+        int drive_us = settle_sample(&driven);
+        hal_gpio_clr_mask(matrix_column_bits[col]);
+        int release_us = settle_sample(&released);
+
+        rows |= driven;
+        if (driven) {
+            if (drive_us > drive_max)
+                drive_max = drive_us;
+            if (release_us > release_max)
+                release_max = release_us;
+        }
+    }
+
+    if (drive_max >= 0)
+        settle_update(col, settle_margin(drive_max), settle_margin(release_max));
+    return rows;
+}
+
+static void
+scan_columns(matrix_t *m, uint32_t calibrate)
+{
+    for (int col = 0; col < N_COLS; ++col) {
+        uint32_t gpio;
+
+        if (calibrate & (1u << col)) {
+            gpio = calibrate_column(col);
+        } else {
+            hal_gpio_set_mask(matrix_column_bits[col]);
+            hal_sleep_us(settle.drive_us[col]);
+            gpio = hal_gpio_get_all();
+            hal_gpio_clr_mask(matrix_column_bits[col]);
+            hal_sleep_us(settle.release_us[col]);
+        }
+
+        uint32_t rows = matrix_rows_gather(gpio);
+        matrix_set_column(m, col, rows);
+        if (rows)
+            active_cols |= 1u << col;
+    }
+}
+
+static void
+ghost_init(void)
+{
+    int pair = 0;
+
+    for (int a = 0; a < N_ROWS; ++a)
+        for (int b = a + 1; b < N_ROWS; ++b)
+            pair_rows[pair++] = (1u << a) | (1u << b);
+
+    for (uint32_t rows = 0; rows < (1u << N_ROWS); ++rows) {
+        row_pairs[rows] = 0;
+        for (pair = 0; pair < ROW_PAIRS; ++pair)
+            if ((rows & pair_rows[pair]) == pair_rows[pair])
+                row_pairs[rows] |= 1u << pair;
+    }
+}
+
+void
+matrix_init(void)
+{
+    matrix_t m;
+
+    hal_matrix_init(config_column_map, N_COLS, config_row_map, N_ROWS);
+    hal_gpio_clr_mask(MATRIX_COLUMN_MASK);
+    ghost_init();
+
+    memset(&settle, 0, sizeof(settle));
+    memset(settle.drive_us, MATRIX_SETTLE_US, sizeof(settle.drive_us));
+    memset(settle.release_us, MATRIX_SETTLE_US, sizeof(settle.release_us));
+    active_cols = 0;
+    calibrate_countdown = MATRIX_CALIBRATE_SCANS;
+
+#if MATRIX_SCAN_PIO
+    pio_active = matrix_pio_init(MATRIX_SETTLE_US);
+    if (!pio_active)
+        trace(TRACE_PIO_FALLBACK, 0, 0);
+    if (pio_active)
+        return;
+#endif
+
+    // time the uncalibrated scan, then calibrate whatever is held down
+    uint64_t start_us = hal_time_us();
+    scan_columns(&m, 0);
+    settle.default_scan_us = hal_time_us() - start_us;
+    settle.scan_us = settle.default_scan_us;
+
+    settle.calibrations++;
+    scan_columns(&m, (1u << N_COLS) - 1);
+}
+
+void
+matrix_scan(matrix_t *m)
+{
+#if MATRIX_SCAN_PIO
+    if (pio_active) {
+        const uint32_t *snapshot;
+        matrix_pio_latest(&snapshot);
+        pio_scan_decode(snapshot, m);
+        return;
+    }
+#endif
+
+    uint32_t calibrate = 0;
+    if (--calibrate_countdown == 0 && active_cols) {
+        calibrate = active_cols;
+        calibrate_countdown = MATRIX_CALIBRATE_SCANS;
+        settle.calibrations++;
+    } else if (calibrate_countdown == 0) {
+        // nothing to measure; look again next scan
+        calibrate_countdown = 1;
+    }
+
+    memset(m, 0, sizeof(*m));
+    active_cols = 0;
+
+    uint64_t start_us = hal_time_us();
+    scan_columns(m, calibrate);
+    if (!calibrate)
+        settle.scan_us = hal_time_us() - start_us;
+}
+
+// Two passes over the columns with a table lookup each, whatever is
+// pressed: the first collects the row pairs closed on more than one
+// column, the second holds back those rows on the columns that have
+// them. Fewer than four keys skip both.
+int
+matrix_ghost_filter(matrix_t *m, const matrix_t *prev)
+{
+    uint32_t rows[N_COLS], seen = 0, shared = 0;
+    int keys = 0, held = 0;
+
+    for (int i = 0; i < MATRIX_WORDS; ++i)
+        keys += __builtin_popcount(m->w[i]);
+    if (keys < 4)
+        return 0;
+
+    for (int col = 0; col < N_COLS; ++col) {
+        rows[col] = matrix_column(m, col);
+        uint32_t pairs = row_pairs[rows[col]];
+        shared |= seen & pairs;
+        seen |= pairs;
+    }
+    if (!shared)
+        return 0;
+
+    for (int col = 0; col < N_COLS; ++col) {
+        uint32_t hit = row_pairs[rows[col]] & shared, ambiguous = 0;
+
+        while (hit) {
+            ambiguous |= pair_rows[__builtin_ctz(hit)];
+            hit &= hit - 1;
+        }
+        if (!ambiguous)
+            continue;
+
+        matrix_flip_column(m, col, (rows[col] ^ matrix_column(prev, col)) & ambiguous);
+        held += __builtin_popcount(ambiguous);
+    }
+    return held;
+}
+
+void
+matrix_settle_load(const uint8_t drive_us[N_COLS], const uint8_t release_us[N_COLS])
+{
+    for (int col = 0; col < N_COLS; ++col) {
+        if (drive_us[col] == 0 || release_us[col] == 0)
+            continue;
+        settle_update(col, drive_us[col] < MATRIX_SETTLE_US ? drive_us[col] : MATRIX_SETTLE_US,
+                      release_us[col] < MATRIX_SETTLE_US ? release_us[col] : MATRIX_SETTLE_US);
+    }
+}
+
+const struct matrix_settle *
+matrix_settle(void)
+{
+    return &settle;
+}
+
+void
+matrix_idle_enter(void)
+{
+#if MATRIX_SCAN_PIO
+    if (pio_active)
+        matrix_pio_idle(true);
+    else
+#endif
+        hal_gpio_set_mask(MATRIX_COLUMN_MASK);
+
+    // arm only once the rows have settled, or the drive itself could
+    // look like a key
+    hal_sleep_us(MATRIX_SETTLE_US);
+    hal_row_wake_arm(MATRIX_ROW_MASK);
+}
+
+void
+matrix_idle_exit(void)
+{
+    hal_row_wake_disarm();
+
+#if MATRIX_SCAN_PIO
+    if (pio_active)
+        matrix_pio_idle(false);
+    else
+#endif
+        hal_gpio_clr_mask(MATRIX_COLUMN_MASK);
+    hal_sleep_us(MATRIX_SETTLE_US);
+}
+
+bool
+matrix_idle_woken(void)
+{
+    return hal_row_wake_fired() || (hal_gpio_get_all() & MATRIX_ROW_MASK) != 0;
+}
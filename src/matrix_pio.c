@@ -0,0 +1,18 @@
+#include "matrix_pio.h"
+
+void
+pio_scan_patterns(uint32_t patterns[PIO_SCAN_SLOTS])
+{
+    for (int slot = 0; slot < PIO_SCAN_SLOTS; ++slot)
+        patterns[slot] = slot < N_COLS ? matrix_column_bits[slot] : 0;
+}
+
+void
+pio_scan_decode(const uint32_t snapshot[PIO_SCAN_SLOTS], matrix_t *m)
+{
+    for (int i = 0; i < MATRIX_WORDS; ++i)
+        m->w[i] = 0;
+
+    for (int col = 0; col < N_COLS; ++col)
+        matrix_set_column(m, col, matrix_rows_gather(snapshot[col]));
+}
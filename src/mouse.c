@@ -0,0 +1,187 @@
+#include "action.h"
+#include "mouse.h"
+#include "sched.h"
+
+// Axes in report order after the buttons
+enum { AXIS_X, AXIS_Y, AXIS_WHEEL, AXIS_PAN, AXIS_COUNT };
+
+// Diagonal pointer motion is scaled by 1/sqrt(2), as 181/256
+#define MOUSE_DIAGONAL 181
+
+// Most frames caught up in one go after the task was held off, and the
+// most motion kept waiting for a report
+#define MOUSE_FRAMES_MAX  100
+#define MOUSE_PENDING_MAX 1024
+
+#define POINTER_KEYS ((1u << MS_UP) | (1u << MS_DOWN) | (1u << MS_LEFT) | (1u << MS_RIGHT))
+#define WHEEL_KEYS   ((1u << MS_WH_UP) | (1u << MS_WH_DOWN) | (1u << MS_WH_LEFT) | (1u << MS_WH_RIGHT))
+
+static uint16_t held;           // bit per MS_* direction key
+static uint8_t buttons;
+static uint8_t sent_buttons;
+static uint8_t unsent_buttons;  // pressed and not reported yet
+
+static uint64_t frame_us;       // start of the last frame integrated
+static uint32_t pointer_ms;     // frames since the pointer started moving
+static uint32_t wheel_ms;
+
+static int32_t pending[AXIS_COUNT];     // whole units not reported yet
+static uint16_t frac[AXIS_COUNT];       // 1/256 units
+
+static int
+direction(int plus, int minus)
+{
+    return ((held >> plus) & 1) - ((held >> minus) & 1);
+}
+
+// min + (max - min) * (t / accel)^2, with t/accel in 1/256 steps
+static uint32_t
+ramp(uint32_t ms, uint32_t min, uint32_t max, uint32_t accel_ms)
+{
+    uint32_t t = ms < accel_ms ? ms : accel_ms;
+    uint32_t u = (t << 8) / accel_ms;
+
+    return min + ((max - min) * u * u >> 16);
+}
+
+static void
+axis_step(int axis, int dir, uint32_t speed)
+{
+    if (!dir) {
+        frac[axis] = 0;
+        return;
+    }
+
+    frac[axis] += speed;
+    pending[axis] += dir * (frac[axis] >> 8);
+    frac[axis] &= 0xff;
+
+    if (pending[axis] > MOUSE_PENDING_MAX)
+        pending[axis] = MOUSE_PENDING_MAX;
+    else if (pending[axis] < -MOUSE_PENDING_MAX)
+        pending[axis] = -MOUSE_PENDING_MAX;
+}
+
+// One USB frame of motion
+static void
+frame(void)
+{
+    int dir[AXIS_COUNT] = {
+        [AXIS_X] = direction(MS_RIGHT, MS_LEFT),
+        [AXIS_Y] = direction(MS_DOWN, MS_UP),
+        [AXIS_WHEEL] = direction(MS_WH_UP, MS_WH_DOWN),
+        [AXIS_PAN] = direction(MS_WH_RIGHT, MS_WH_LEFT),
+    };
+    uint32_t pointer = ramp(pointer_ms, MOUSE_SPEED_MIN, MOUSE_SPEED_MAX, MOUSE_ACCEL_MS);
+    uint32_t wheel = ramp(wheel_ms, MOUSE_WHEEL_MIN, MOUSE_WHEEL_MAX, MOUSE_WHEEL_ACCEL_MS);
+
+    if (dir[AXIS_X] && dir[AXIS_Y])
+        pointer = pointer * MOUSE_DIAGONAL >> 8;
+
+    axis_step(AXIS_X, dir[AXIS_X], pointer);
+    axis_step(AXIS_Y, dir[AXIS_Y], pointer);
+    axis_step(AXIS_WHEEL, dir[AXIS_WHEEL], wheel);
+    axis_step(AXIS_PAN, dir[AXIS_PAN], wheel);
+
+    pointer_ms = dir[AXIS_X] || dir[AXIS_Y] ? pointer_ms + 1 : 0;
+    wheel_ms = dir[AXIS_WHEEL] || dir[AXIS_PAN] ? wheel_ms + 1 : 0;
+}
+
+static void
+advance(uint64_t now_us)
+{
+    int frames = 0;
+
+    if (!held) {
+        frame_us = now_us;
+        return;
+    }
+    while (now_us - frame_us >= MOUSE_FRAME_US && frames++ < MOUSE_FRAMES_MAX) {
+        frame();
+        frame_us += MOUSE_FRAME_US;
+    }
+    if (now_us - frame_us >= MOUSE_FRAME_US)
+        frame_us = now_us;
+}
+
+void
+mouse_key(uint8_t key, bool pressed, uint64_t now_us)
+{
+    if (key >= MS_COUNT)
+        return;
+
+    if (key >= MS_BTN1) {
+        uint8_t bit = 1 << (key - MS_BTN1);
+        if (pressed) {
+            buttons |= bit;
+            unsent_buttons |= bit;
+        } else {
+            buttons &= ~bit;
+        }
+        return;
+    }
+
+    advance(now_us);
+    if (pressed) {
+        // start from just under one whole unit, so the first frame moves
+        int axis = key < MS_LEFT ? AXIS_Y : key < MS_WH_UP ? AXIS_X :
+                   key < MS_WH_LEFT ? AXIS_WHEEL : AXIS_PAN;
+        held |= 1u << key;
+        frac[axis] = 0xff;
+        frame();
+        frame_us = now_us;
+    } else {
+        // the ramp starts over on the next press
+        held &= ~(1u << key);
+        if (!(held & POINTER_KEYS))
+            pointer_ms = 0;
+        if (!(held & WHEEL_KEYS))
+            wheel_ms = 0;
+    }
+}
+
+bool
+mouse_button_unsent(uint8_t key)
+{
+    return key >= MS_BTN1 && key < MS_COUNT && ((unsent_buttons >> (key - MS_BTN1)) & 1);
+}
+
+static int8_t
+take(int axis)
+{
+    int32_t n = pending[axis];
+
+    if (n > 127)
+        n = 127;
+    else if (n < -127)
+        n = -127;
+    pending[axis] -= n;
+    return n;
+}
+
+bool
+mouse_report(struct mouse_report *report, uint64_t now_us)
+{
+    advance(now_us);
+    if (buttons == sent_buttons && !unsent_buttons && !pending[AXIS_X] && !pending[AXIS_Y] &&
+        !pending[AXIS_WHEEL] && !pending[AXIS_PAN])
+        return false;
+
+    report->buttons = buttons;
+    report->x = take(AXIS_X);
+    report->y = take(AXIS_Y);
+    report->wheel = take(AXIS_WHEEL);
+    report->pan = take(AXIS_PAN);
+    sent_buttons = report->buttons;
+    unsent_buttons = 0;
+    return true;
+}
+
+uint64_t
+mouse_next_us(void)
+{
+    bool moving = held || pending[AXIS_X] || pending[AXIS_Y] || pending[AXIS_WHEEL] ||
+                  pending[AXIS_PAN];
+
+    return moving ? frame_us + MOUSE_FRAME_US : SCHED_IDLE;
+}
@@ -0,0 +1,321 @@
+#include <string.h>
+
+#include "action.h"
+#include "config.h"
+#include "event_queue.h"
+#include "hal.h"
+#include "keyboard.h"
+#include "latency.h"
+#include "matrix.h"
+#include "raw_hid.h"
+#include "sched.h"
+#include "store.h"
+#include "trace.h"
+
+_Static_assert(MATRIX_WORDS <= RAW_HID_MATRIX_WORDS, "matrix does not fit a raw HID packet");
+_Static_assert(N_COLS <= RAW_HID_SETTLE_COLS, "settle delays do not fit a raw HID packet");
+_Static_assert(N_KEYS <= 256 && N_LAYERS <= 256, "keymap indices must fit in a byte");
+
+// Requests waiting for an answer; the host sends one at a time, so this
+// only absorbs a host that does not wait. More are dropped.
+#define RAW_HID_QUEUE_SIZE 4
+
+static struct raw_hid_packet requests[RAW_HID_QUEUE_SIZE];
+static int queue_head;
+static int queue_len;
+
+// Answer to the request at the head of the queue, handled once and then
+// kept until the endpoint takes it
+static struct raw_hid_packet response;
+static bool response_pending;
+
+// Pending keymap edits, NULL until the first write after a commit
+static struct store_image *editing;
+
+static uint32_t stream_interval_us;
+static uint32_t streamed_us;
+static matrix_t streamed;
+
+void
+raw_hid_receive(const uint8_t *report, uint16_t len)
+{
+    if (queue_len == RAW_HID_QUEUE_SIZE)
+        return;
+
+    struct raw_hid_packet *request = &requests[(queue_head + queue_len++) % RAW_HID_QUEUE_SIZE];
+    memset(request, 0, sizeof(*request));
+    memcpy(request, report, len < sizeof(*request) ? len : sizeof(*request));
+}
+
+static void
+matrix_snapshot(struct raw_hid_matrix *matrix, const matrix_t *keys)
+{
+    matrix->time_us = hal_time_us();
+    matrix->scans = keyboard_scan_stats()->scans;
+    matrix->n_words = MATRIX_WORDS;
+    memcpy(matrix->w, keys->w, sizeof(keys->w));
+}
+
+static uint8_t
+keymap_range(const struct raw_hid_keymap *keymap)
+{
+    if (keymap->layer >= N_LAYERS || keymap->count > RAW_HID_KEYMAP_MAX ||
+        keymap->first + keymap->count > N_KEYS)
+        return RAW_ERR_RANGE;
+    return RAW_OK;
+}
+
+static uint8_t
+handle_keymap_read(const struct raw_hid_keymap *request, struct raw_hid_keymap *keymap)
+{
+    const action_t (*actions)[N_KEYS] = editing ? editing->actions : store_keymap();
+
+    *keymap = *request;
+    if (keymap_range(request) != RAW_OK)
+        return RAW_ERR_RANGE;
+
+    memcpy(keymap->actions, &actions[request->layer][request->first],
+           request->count * sizeof(action_t));
+    return RAW_OK;
+}
+
+static uint8_t
+handle_keymap_write(const struct raw_hid_keymap *request, struct raw_hid_keymap *keymap)
+{
+    keymap->layer = request->layer;
+    keymap->first = request->first;
+    keymap->count = request->count;
+    if (keymap_range(request) != RAW_OK)
+        return RAW_ERR_RANGE;
+    for (int i = 0; i < request->count; ++i) {
+        if (!action_valid(request->actions[i]))
+            return RAW_ERR_RANGE;
+    }
+
+    if (!editing)
+        editing = store_edit();
+    memcpy(&editing->actions[request->layer][request->first], request->actions,
+           request->count * sizeof(action_t));
+    return RAW_OK;
+}
+
+// Flash writes stall the other core and this loop for the length of a
+// sector erase; only ever done on explicit request
+static uint8_t
+handle_keymap_commit(struct raw_hid_commit *commit)
+{
+    bool ok = true;
+
+    if (editing)
+        ok = store_commit();
+    editing = NULL;
+    commit->sequence = store_sequence();
+    return ok ? RAW_OK : RAW_ERR_FLASH;
+}
+
+static uint8_t
+handle_matrix(const struct raw_hid_matrix_request *request, struct raw_hid_matrix *matrix)
+{
+    uint16_t interval_ms = request->interval_ms;
+    matrix_t keys;
+
+    keyboard_matrix(&keys);
+    matrix_snapshot(matrix, &keys);
+
+    stream_interval_us = interval_ms * 1000u;
+    streamed = keys;
+    streamed_us = matrix->time_us;
+    return RAW_OK;
+}
+
+static void
+handle_counters(struct raw_hid_counters *counters)
+{
+    const struct scan_stats *scan = keyboard_scan_stats();
+    const struct event_queue_stats *queue = event_queue_stats();
+    uint32_t latency_samples, latency_max_us;
+
+    latency_summary(LATENCY_TOTAL, &latency_samples, &latency_max_us);
+    counters->scans = scan->scans;
+    counters->scan_max_us = scan->max_us;
+    counters->scan_overruns = scan->overruns;
+    counters->events = queue->pushed;
+    counters->events_dropped = queue->dropped;
+    counters->queue_depth_max = queue->depth_max;
+    counters->latency_samples = latency_samples;
+    counters->latency_max_us = latency_max_us;
+    counters->scans_ghosted = scan->ghosted;
+}
+
+static void
+handle_trace(struct raw_hid_trace *trace)
+{
+    struct trace_record record;
+
+    while (trace->count < RAW_HID_TRACE_MAX && trace_pop(&record))
+        memcpy(&trace->records[trace->count++], &record, sizeof(record));
+}
+
+static uint8_t
+handle_tasks(const struct raw_hid_tasks_request *request, struct raw_hid_tasks *tasks)
+{
+    uint8_t core = request->core, first = request->first;
+    const struct sched *s = core < 2 ? sched_core(core) : NULL;
+
+    tasks->core = core;
+    tasks->first = first;
+    if (!s || first > s->n_tasks)
+        return RAW_ERR_RANGE;
+
+    tasks->n_tasks = s->n_tasks;
+    tasks->wakes = s->wakes;
+    tasks->busy_ms = s->busy_us / 1000;
+    for (int i = first; i < s->n_tasks && tasks->count < RAW_HID_TASKS_MAX; ++i) {
+        const struct sched_stats *stats = &s->tasks[i].stats;
+        struct raw_hid_task *task = &tasks->tasks[tasks->count++];
+
+        strncpy(task->name, s->tasks[i].name, sizeof(task->name));
+        task->runs = stats->runs;
+        task->late = stats->late;
+        task->max_us = stats->max_us;
+        task->busy_ms = stats->total_us / 1000;
+    }
+    return RAW_OK;
+}
+
+static uint8_t
+handle_settle(const struct raw_hid_settle_request *request, struct raw_hid_settle *response)
+{
+    const struct matrix_settle *settle = matrix_settle();
+    uint8_t status = RAW_OK;
+
+    if (request->save) {
+        if (!editing)
+            editing = store_edit();
+        memcpy(editing->settings.settle_drive_us, settle->drive_us, N_COLS);
+        memcpy(editing->settings.settle_release_us, settle->release_us, N_COLS);
+        // uncalibrated columns stay uncalibrated
+        for (int col = 0; col < N_COLS; ++col)
+            if (!(settle->calibrated & (1u << col)))
+                editing->settings.settle_drive_us[col] = editing->settings.settle_release_us[col] = 0;
+        struct raw_hid_commit commit;
+        status = handle_keymap_commit(&commit);
+    }
+
+    response->default_scan_us = settle->default_scan_us;
+    response->scan_us = settle->scan_us;
+    response->calibrated = settle->calibrated;
+    response->calibrations = settle->calibrations;
+    response->sequence = store_sequence();
+    response->n_cols = N_COLS;
+    memcpy(response->drive_us, settle->drive_us, N_COLS);
+    memcpy(response->release_us, settle->release_us, N_COLS);
+    return status;
+}
+
+static void
+raw_hid_handle(const struct raw_hid_packet *request, struct raw_hid_packet *response)
+{
+    uint8_t status = RAW_OK;
+
+    switch (request->header.command) {
+    case RAW_CMD_HELLO:
+        response->hello = (struct raw_hid_hello) {
+            .version = RAW_HID_VERSION,
+            .n_layers = N_LAYERS,
+            .n_cols = N_COLS,
+            .n_rows = N_ROWS,
+            .n_keys = N_KEYS,
+            .keymap_max = RAW_HID_KEYMAP_MAX,
+            .store_sequence = store_sequence(),
+        };
+        break;
+    case RAW_CMD_KEYMAP_READ:
+        status = handle_keymap_read(&request->keymap, &response->keymap);
+        break;
+    case RAW_CMD_KEYMAP_WRITE:
+        status = handle_keymap_write(&request->keymap, &response->keymap);
+        break;
+    case RAW_CMD_KEYMAP_COMMIT:
+        status = handle_keymap_commit(&response->commit);
+        break;
+    case RAW_CMD_KEYMAP_RESET:
+        editing = NULL;
+        store_reset();
+        response->commit.sequence = store_sequence();
+        break;
+    case RAW_CMD_MATRIX:
+        status = handle_matrix(&request->matrix_request, &response->matrix);
+        break;
+    case RAW_CMD_COUNTERS:
+        handle_counters(&response->counters);
+        break;
+    case RAW_CMD_TRACE:
+        handle_trace(&response->trace);
+        break;
+    case RAW_CMD_TASKS:
+        status = handle_tasks(&request->tasks_request, &response->tasks);
+        break;
+    case RAW_CMD_SETTLE:
+        status = handle_settle(&request->settle_request, &response->settle);
+        break;
+    default:
+        status = RAW_ERR_COMMAND;
+        break;
+    }
+
+    response->header.command = request->header.command;
+    response->header.status = status;
+    response->header.tag = request->header.tag;
+    trace(TRACE_RAW_HID, request->header.command, status);
+}
+
+// Send the matrix if it changed and the stream interval has passed;
+// returns when to look again. Nothing signals a change, so an unchanged
+// matrix is checked again an interval later.
+static uint64_t
+raw_hid_stream(void)
+{
+    struct raw_hid_packet packet = { .header.command = RAW_EVT_MATRIX };
+    uint64_t now_us = hal_time_us();
+    uint32_t since_us = (uint32_t) now_us - streamed_us;
+    matrix_t keys;
+
+    if (since_us < stream_interval_us)
+        return now_us + stream_interval_us - since_us;
+
+    keyboard_matrix(&keys);
+    if (memcmp(&keys, &streamed, sizeof(keys)) == 0)
+        return now_us + stream_interval_us;
+
+    matrix_snapshot(&packet.matrix, &keys);
+    if (hal_raw_hid_report(&packet, sizeof(packet))) {
+        streamed = keys;
+        streamed_us = now_us;
+    }
+    return SCHED_IDLE;
+}
+
+// Requests arrive from tud_task() and the endpoint frees up on its
+// completion interrupt, so only the stream needs a timer
+uint64_t
+raw_hid_task(void)
+{
+    if (!hal_raw_hid_ready())
+        return SCHED_IDLE;
+
+    if (!response_pending) {
+        if (queue_len == 0)
+            return stream_interval_us ? raw_hid_stream() : SCHED_IDLE;
+
+        memset(&response, 0, sizeof(response));
+        raw_hid_handle(&requests[queue_head], &response);
+        queue_head = (queue_head + 1) % RAW_HID_QUEUE_SIZE;
+        queue_len--;
+        response_pending = true;
+    }
+
+    if (hal_raw_hid_report(&response, sizeof(response)))
+        response_pending = false;
+    return SCHED_IDLE;
+}
@@ -0,0 +1,430 @@
+#include <string.h>
+
+#include "config.h"
+#include "event_queue.h"
+#include "hal.h"
+#include "keyboard.h"
+#include "latency.h"
+#include "macro.h"
+#include "mouse.h"
+#include "report.h"
+#include "sched.h"
+#include "trace.h"
+#include "usb_descriptors.h"
+
+// Number of held sources per usage; a usage stays in the report while
+// any key (or macro keycode) still holds it
+static uint8_t usage_count[NKRO_USAGE_MAX + 1];
+static uint8_t nkro_report[NKRO_REPORT_BYTES];
+
+// Last report handed to the endpoint, so that only changes are sent
+static uint8_t sent_report[NKRO_REPORT_BYTES];
+static uint8_t sent_report_id;
+static uint32_t sent_ms;
+
+// Usages that went down since the last report was sent. Their release
+// waits in the queue until that press has reached the host, so a quick
+// tap is never folded away inside one report.
+static uint8_t unsent_press[NKRO_REPORT_BYTES];
+
+// Consumer control usages held, most recent last; the report carries
+// the most recent one. A press not yet sent holds back its release.
+#define CONSUMER_HELD_MAX 4
+
+static uint16_t consumer_held[CONSUMER_HELD_MAX];
+static int n_consumer_held;
+static uint16_t consumer_sent;
+static uint16_t consumer_unsent;
+
+// Which of the other reports goes first when the keyboard has nothing,
+// and the scan it last went out after
+static int next_other;
+static uint32_t other_scans;
+
+// How soon after a scan the other reports may still go out
+#define OTHER_REPORT_WINDOW_US (SCAN_INTERVAL_US / 10)
+
+// SET_IDLE duration in ms; 0 means report on change only
+static uint16_t idle_ms = 0;
+
+// Timestamps of the events folded into the next report and into the
+// report currently in flight. Events beyond the limit are not sampled.
+#define LATENCY_PENDING_MAX 16
+
+struct latency_sample {
+    uint32_t sample_us;
+    uint32_t accept_us;
+};
+
+static struct latency_sample pending[LATENCY_PENDING_MAX];
+static int n_pending;
+static struct latency_sample in_flight[LATENCY_PENDING_MAX];
+static int n_in_flight;
+static uint32_t in_flight_us;
+
+static void
+latency_pending_add(const struct key_event *event)
+{
+    if (n_pending < LATENCY_PENDING_MAX) {
+        pending[n_pending].sample_us = event->sample_us;
+        pending[n_pending].accept_us = event->time_us;
+        n_pending++;
+    }
+}
+
+static void
+latency_report_sent(uint32_t now_us)
+{
+    for (int i = 0; i < n_pending; ++i) {
+        latency_record(LATENCY_DEBOUNCE, pending[i].accept_us - pending[i].sample_us);
+        latency_record(LATENCY_QUEUE, now_us - pending[i].accept_us);
+        in_flight[i] = pending[i];
+    }
+    n_in_flight = n_pending;
+    n_pending = 0;
+    in_flight_us = now_us;
+}
+
+static void
+latency_report_complete(uint32_t now_us)
+{
+    for (int i = 0; i < n_in_flight; ++i) {
+        latency_record(LATENCY_USB, now_us - in_flight_us);
+        latency_record(LATENCY_TOTAL, now_us - in_flight[i].sample_us);
+    }
+    n_in_flight = 0;
+}
+
+void
+report_usage(uint8_t usage, bool pressed)
+{
+    if (usage > NKRO_USAGE_MAX)
+        return;
+
+    if (pressed) {
+        if (usage_count[usage]++ == 0)
+            nkro_report[usage >> 3] |= 1 << (usage & 7);
+    } else if (usage_count[usage] && --usage_count[usage] == 0) {
+        nkro_report[usage >> 3] &= ~(1 << (usage & 7));
+    }
+}
+
+static void
+consumer_usage(uint16_t usage, bool pressed)
+{
+    if (pressed) {
+        if (n_consumer_held == CONSUMER_HELD_MAX) {
+            memmove(&consumer_held[0], &consumer_held[1], sizeof(consumer_held) - sizeof(consumer_held[0]));
+            n_consumer_held--;
+        }
+        consumer_held[n_consumer_held++] = usage;
+        consumer_unsent = usage;
+        return;
+    }
+
+    for (int i = n_consumer_held - 1; i >= 0; --i) {
+        if (consumer_held[i] == usage) {
+            memmove(&consumer_held[i], &consumer_held[i + 1], (n_consumer_held - i - 1) * sizeof(consumer_held[0]));
+            n_consumer_held--;
+            break;
+        }
+    }
+}
+
+// Fold the NKRO bitmap into the 8-byte boot report: the modifier usages
+// 0xE0..0xE7 are exactly the last byte of the bitmap, and more than six
+// other keys fill the key slots with ErrorRollOver
+static void
+boot_report(uint8_t report[8])
+{
+    int current_key_index = 0;
+
+    report[0] = nkro_report[0xe0 >> 3];
+    report[1] = 0;
+    memset(&report[2], KEY_NONE, MAX_COINCIDENT_KEYS);
+
+    for (int byte = 0; byte < (0xe0 >> 3); ++byte) {
+        uint32_t bits = nkro_report[byte];
+        while (bits) {
+            int usage = byte * 8 + __builtin_ctz(bits);
+            bits &= bits - 1;
+
+            if (current_key_index >= MAX_COINCIDENT_KEYS) {
+                memset(&report[2], KEY_ERR_OVF, MAX_COINCIDENT_KEYS);
+                return; // too many keys pressed
+            }
+            report[2 + current_key_index++] = usage;
+        }
+    }
+}
+
+// In boot protocol the host only understands the 8-byte report without
+// a report ID; otherwise send the NKRO bitmap
+static uint16_t
+current_report(uint8_t *report, uint8_t *report_id)
+{
+    if (hal_hid_boot_protocol()) {
+        boot_report(report);
+        *report_id = 0;
+        return 8;
+    }
+
+    memcpy(report, nkro_report, sizeof(nkro_report));
+    *report_id = REPORT_ID_KEYBOARD_NKRO;
+    return sizeof(nkro_report);
+}
+
+static bool
+report_changed(const uint8_t *report, uint8_t report_id, uint16_t len)
+{
+    return report_id != sent_report_id || memcmp(report, sent_report, len) != 0;
+}
+
+// Let the running macro take its next step once the host has been
+// handed every step so far; the step can then go out in the next frame
+static void
+macro_step(void)
+{
+    uint8_t report[NKRO_REPORT_BYTES];
+    uint8_t report_id;
+
+    if (!macro_busy())
+        return;
+
+    uint16_t len = current_report(report, &report_id);
+    if (!report_changed(report, report_id, len))
+        macro_task(hal_time_us());
+}
+
+// Send the current report if it differs from the last one sent, or if
+// the host asked for periodic reports and the idle period has elapsed
+static bool
+send_keyboard_report(void)
+{
+    uint8_t report[NKRO_REPORT_BYTES];
+    uint8_t report_id;
+
+    uint16_t len = current_report(report, &report_id);
+    uint32_t now_us = hal_time_us();
+    uint32_t now_ms = now_us / 1000;
+
+    bool changed = report_changed(report, report_id, len);
+    bool idle_due = idle_ms != 0 && now_ms - sent_ms >= idle_ms;
+
+    // events that cancelled out before reaching the host are not latency samples
+    if (!changed) n_pending = 0;
+    if (!changed && !idle_due) return false;
+
+    if (report_id == 0)
+        hal_hid_keyboard_report(0, report[0], &report[2]);
+    else
+        hal_hid_report(report_id, report, len);
+
+    trace(TRACE_REPORT, report_id, n_pending);
+    memcpy(sent_report, report, len);
+    memset(unsent_press, 0, sizeof(unsent_press));
+    sent_report_id = report_id;
+    sent_ms = now_ms;
+    latency_report_sent(now_us);
+    return true;
+}
+
+static bool
+send_consumer_report(void)
+{
+    uint16_t usage = n_consumer_held ? consumer_held[n_consumer_held - 1] : 0;
+
+    if (usage == consumer_sent) {
+        consumer_unsent = 0;
+        return false;
+    }
+
+    hal_hid_report(REPORT_ID_CONSUMER_CONTROL, &usage, sizeof(usage));
+    trace(TRACE_REPORT, REPORT_ID_CONSUMER_CONTROL, 0);
+    consumer_sent = usage;
+    consumer_unsent = 0;
+    return true;
+}
+
+static bool
+send_mouse_report(void)
+{
+    struct mouse_report report;
+
+    if (!mouse_report(&report, hal_time_us()))
+        return false;
+
+    hal_hid_report(REPORT_ID_MOUSE, &report, sizeof(report));
+    trace(TRACE_REPORT, REPORT_ID_MOUSE, 0);
+    return true;
+}
+
+static bool (*const other_reports[])(void) = { send_consumer_report, send_mouse_report };
+#define N_OTHER_REPORTS (int) (sizeof(other_reports) / sizeof(other_reports[0]))
+
+// The other reports only go out straight after a scan, once per scan,
+// so that the endpoint is free again by the next one and a key change
+// it finds never waits behind them. Sent as soon as the endpoint frees
+// up, at the host's poll, a report every frame would keep the keyboard
+// one poll behind the whole time the pointer moves.
+static bool
+other_report_waits(void)
+{
+    const struct scan_stats *stats = keyboard_scan_stats();
+    uint32_t since_us = (uint32_t) hal_time_us() - stats->done_us;
+
+    if (keyboard_idle())
+        return false;
+    return stats->scans == other_scans || since_us > OTHER_REPORT_WINDOW_US;
+}
+
+// When a report waiting for the next scan can go out; the scan wakes
+// this task anyway when both run on the same core
+static uint64_t
+other_report_us(uint64_t now_us)
+{
+    const struct scan_stats *stats = keyboard_scan_stats();
+    uint32_t since_us = (uint32_t) now_us - stats->done_us;
+    uint32_t next_us = SCAN_INTERVAL_US + stats->last_us;
+
+    return now_us + (since_us < next_us ? next_us - since_us : stats->last_us + 1);
+}
+
+// One report per frame on the shared endpoint. The keyboard goes first
+// whenever its report changed, so it never waits behind the others;
+// consumer control and mouse take turns after it, so a moving pointer
+// cannot hold off a media key or the other way round. In boot protocol
+// the host only takes the keyboard report.
+static void
+send_hid_report(void)
+{
+    if (!hal_hid_ready() || send_keyboard_report() || hal_hid_boot_protocol() ||
+        other_report_waits())
+        return;
+
+    for (int i = 0; i < N_OTHER_REPORTS; ++i) {
+        int other = (next_other + i) % N_OTHER_REPORTS;
+        if (other_reports[other]()) {
+            next_other = (other + 1) % N_OTHER_REPORTS;
+            other_scans = keyboard_scan_stats()->scans;
+            return;
+        }
+    }
+}
+
+// The endpoint is free again; flush anything that changed while the
+// previous report was in flight instead of waiting for the next poll
+void
+hid_report_complete(void)
+{
+    latency_report_complete(hal_time_us());
+    macro_step();
+    // key events still queued may change the keyboard report; leave the
+    // endpoint to report_task(), which runs right after this
+    if (event_queue_depth() && hal_hid_ready())
+        send_keyboard_report();
+    else
+        send_hid_report();
+}
+
+// HID idle rate is in units of 4 ms
+void
+hid_set_idle(uint8_t idle_rate)
+{
+    idle_ms = idle_rate * 4;
+}
+
+// When report_task() next has something to do that no interrupt or
+// key event will wake it for: a macro step or delay, the idle rate, or
+// the next frame of mouse motion
+static uint64_t
+report_next_us(void)
+{
+    uint8_t report[NKRO_REPORT_BYTES];
+    uint8_t report_id;
+    uint64_t now_us = hal_time_us();
+    uint64_t next_us = SCHED_IDLE;
+
+    // a changed report goes out on the endpoint's completion interrupt
+    if (!hal_hid_ready())
+        return SCHED_IDLE;
+
+    uint16_t len = current_report(report, &report_id);
+    if (macro_busy() && !report_changed(report, report_id, len)) {
+        uint32_t wait_us = macro_wait_us(now_us);
+        next_us = now_us + wait_us;
+    }
+
+    if (idle_ms) {
+        uint32_t since_ms = now_us / 1000 - sent_ms;
+        uint64_t idle_us = now_us + (since_ms < idle_ms ? (idle_ms - since_ms) * 1000u : 0);
+        if (idle_us < next_us)
+            next_us = idle_us;
+    }
+
+    if (!hal_hid_boot_protocol()) {
+        uint64_t mouse_us = mouse_next_us();
+        if (mouse_us != SCHED_IDLE && other_report_waits())
+            mouse_us = other_report_us(now_us);
+        if (mouse_us < next_us)
+            next_us = mouse_us;
+    }
+    return next_us;
+}
+
+// A release waits in the queue until the press it undoes has been sent
+static bool
+release_waits(const struct key_event *event)
+{
+    uint16_t usage = event->usage;
+
+    if (event->pressed)
+        return false;
+
+    switch (event->kind) {
+    case KEY_EVENT_USAGE:
+        return usage <= NKRO_USAGE_MAX && (unsent_press[usage >> 3] >> (usage & 7)) & 1;
+    case KEY_EVENT_CONSUMER:
+        return consumer_unsent == usage && !hal_hid_boot_protocol();
+    case KEY_EVENT_MOUSE:
+        return mouse_button_unsent(usage) && !hal_hid_boot_protocol();
+    default:
+        return false;
+    }
+}
+
+// Apply every queued key event and the next macro step, then send the report if it changed
+uint64_t
+report_task(void)
+{
+    struct key_event event;
+
+    while (event_queue_peek(&event)) {
+        uint16_t usage = event.usage;
+
+        if (release_waits(&event))
+            break;
+        event_queue_pop(&event);
+
+        if (event.kind == KEY_EVENT_MACRO) {
+            macro_start(usage);
+            continue;
+        }
+        if (event.kind == KEY_EVENT_CONSUMER) {
+            consumer_usage(usage, event.pressed);
+            continue;
+        }
+        if (event.kind == KEY_EVENT_MOUSE) {
+            mouse_key(usage, event.pressed, hal_time_us());
+            continue;
+        }
+        if (event.pressed && usage <= NKRO_USAGE_MAX && usage_count[usage] == 0)
+            unsent_press[usage >> 3] |= 1 << (usage & 7);
+        report_usage(usage, event.pressed);
+        latency_pending_add(&event);
+    }
+
+    macro_step();
+    send_hid_report();
+    return report_next_us();
+}
@@ -0,0 +1,375 @@
+#include "pico/stdlib.h"
+#include "pico/bootrom.h"
+#include "pico/multicore.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/flash.h"
+#include "hardware/pwm.h"
+#include "hardware/uart.h"
+#include "hardware/sync.h"
+#include "tusb.h"
+
+#include "config.h"
+#include "hal.h"
+#include "led.h"
+#include "usb_descriptors.h"
+
+// The storage region is the last HAL_FLASH_REGION_SIZE bytes of flash
+#define FLASH_REGION_OFFSET (PICO_FLASH_SIZE_BYTES - HAL_FLASH_REGION_SIZE)
+
+//--------------------------------------------------------------------+
+// Matrix I/O
+//--------------------------------------------------------------------+
+void
+hal_matrix_init(const int *columns, int n_cols, const int *rows, int n_rows)
+{
+    for (int i = 0; i < n_rows; ++i) {
+        gpio_init(rows[i]);
+        gpio_set_dir(rows[i], GPIO_IN);
+        gpio_pull_down(rows[i]);
+    }
+
+    for (int i = 0; i < n_cols; ++i) {
+        gpio_init(columns[i]);
+        gpio_set_dir(columns[i], GPIO_OUT);
+        gpio_put(columns[i], 0);
+    }
+}
+
+void
+hal_gpio_put(int pin, bool value)
+{
+    gpio_put(pin, value);
+}
+
+bool
+hal_gpio_get(int pin)
+{
+    return gpio_get(pin);
+}
+
+void
+hal_gpio_set_mask(uint32_t mask)
+{
+    gpio_set_mask(mask);
+}
+
+void
+hal_gpio_clr_mask(uint32_t mask)
+{
+    gpio_clr_mask(mask);
+}
+
+uint32_t
+hal_gpio_get_all(void)
+{
+    return gpio_get_all();
+}
+
+static volatile bool row_woken;
+static uint32_t row_wake_mask;
+
+static void
+row_wake_irq(uint gpio, uint32_t events)
+{
+    (void) events;
+
+    if (row_wake_mask & (1u << gpio)) {
+        gpio_set_irq_enabled(gpio, GPIO_IRQ_EDGE_RISE, false);
+        row_woken = true;
+    }
+}
+
+// The callback is per core, so this arms the interrupt on the core
+// that scans and will sleep
+void
+hal_row_wake_arm(uint32_t mask)
+{
+    static bool callback_set;
+
+    row_woken = false;
+    row_wake_mask = mask;
+    for (uint32_t pins = mask; pins; pins &= pins - 1) {
+        uint pin = __builtin_ctz(pins);
+        gpio_acknowledge_irq(pin, GPIO_IRQ_EDGE_RISE);
+        if (callback_set) {
+            gpio_set_irq_enabled(pin, GPIO_IRQ_EDGE_RISE, true);
+        } else {
+            gpio_set_irq_enabled_with_callback(pin, GPIO_IRQ_EDGE_RISE, true, row_wake_irq);
+            callback_set = true;
+        }
+    }
+
+    // an edge between the acknowledge and the enable above is lost, so
+    // a row already high counts as woken
+    if (hal_gpio_get_all() & mask)
+        row_woken = true;
+}
+
+void
+hal_row_wake_disarm(void)
+{
+    for (uint32_t pins = row_wake_mask; pins; pins &= pins - 1)
+        gpio_set_irq_enabled(__builtin_ctz(pins), GPIO_IRQ_EDGE_RISE, false);
+    row_wake_mask = 0;
+}
+
+bool
+hal_row_wake_fired(void)
+{
+    return row_woken;
+}
+
+//--------------------------------------------------------------------+
+// Clock
+//--------------------------------------------------------------------+
+uint64_t
+hal_time_us(void)
+{
+    return to_us_since_boot(get_absolute_time());
+}
+
+void
+hal_sleep_us(uint32_t us)
+{
+    sleep_us(us);
+}
+
+int
+hal_core_num(void)
+{
+    return get_core_num();
+}
+
+// Taking an interrupt, or a SEV from the other core, sets the event
+// register, so __wfe() falls straight through for anything that
+// happened since the tasks last ran
+void
+hal_wait_until(uint64_t time_us)
+{
+    if (time_us == UINT64_MAX)
+        __wfe();
+    else if (time_us > hal_time_us())
+        best_effort_wfe_or_timeout(from_us_since_boot(time_us));
+}
+
+void
+hal_wake_other_core(void)
+{
+    __sev();
+}
+
+//--------------------------------------------------------------------+
+// HID sink
+//--------------------------------------------------------------------+
+bool
+hal_hid_ready(void)
+{
+    return tud_hid_n_ready(HID_INSTANCE_KEYBOARD);
+}
+
+bool
+hal_hid_boot_protocol(void)
+{
+    return tud_hid_n_get_protocol(HID_INSTANCE_KEYBOARD) == HID_PROTOCOL_BOOT;
+}
+
+bool
+hal_hid_report(uint8_t report_id, const void *report, uint16_t len)
+{
+    return tud_hid_n_report(HID_INSTANCE_KEYBOARD, report_id, report, len);
+}
+
+bool
+hal_hid_keyboard_report(uint8_t report_id, uint8_t modifiers, const uint8_t keycodes[6])
+{
+    return tud_hid_n_keyboard_report(HID_INSTANCE_KEYBOARD, report_id, modifiers, (uint8_t *) keycodes);
+}
+
+void
+hal_reset_bootloader(void)
+{
+    reset_usb_boot(0, 0);
+}
+
+//--------------------------------------------------------------------+
+// Trace output
+//--------------------------------------------------------------------+
+int
+hal_trace_write(const uint8_t *data, int len)
+{
+    int n = 0;
+
+    while (n < len && uart_is_writable(uart_default))
+        uart_putc_raw(uart_default, data[n++]);
+    return n;
+}
+
+//--------------------------------------------------------------------+
+// Raw HID sink
+//--------------------------------------------------------------------+
+bool
+hal_raw_hid_ready(void)
+{
+    return tud_hid_n_ready(HID_INSTANCE_RAW);
+}
+
+bool
+hal_raw_hid_report(const void *report, uint16_t len)
+{
+    return tud_hid_n_report(HID_INSTANCE_RAW, 0, report, len);
+}
+
+//--------------------------------------------------------------------+
+// Indicator LEDs
+//--------------------------------------------------------------------+
+// Each LED gets a slice to itself: the waveform DMA writes 16 bits to
+// the slice's compare register, which the bus replicates into both
+// channel halves. A duty of 0xffff is one past the top, always on.
+#define LED_PWM_TOP 0xfffe
+
+// A slice with no pin on it wraps every LED_STEP_MS to pace the
+// waveforms; its pins stay with SIO, so it is only a timer
+#define LED_STEP_SLICE 7
+#define LED_STEP_DIV   32
+
+#define PWM_SLICE(pin) (((pin) >> 1) & 7)
+
+_Static_assert(PWM_SLICE(LED_PIN) != PWM_SLICE(NUMLOCK_LED_PIN), "indicator LEDs need a PWM slice each");
+_Static_assert(PWM_SLICE(LED_PIN) != LED_STEP_SLICE && PWM_SLICE(NUMLOCK_LED_PIN) != LED_STEP_SLICE,
+               "the LED step slice must be free");
+
+struct hal_led {
+    uint slice;
+    uint channel;
+    int data_chan;      // waveform -> compare register, one entry per step
+    int ctrl_chan;      // rewinds data_chan to the start of the waveform
+    dma_channel_config data_config;
+    const uint16_t *waveform;
+};
+
+static struct hal_led leds[LED_COUNT];
+
+void
+hal_led_init(const int *pins, int n)
+{
+    pwm_config config = pwm_get_default_config();
+    pwm_config_set_clkdiv_int(&config, LED_STEP_DIV);
+    pwm_config_set_wrap(&config, clock_get_hz(clk_sys) / LED_STEP_DIV / 1000 * LED_STEP_MS - 1);
+    pwm_init(LED_STEP_SLICE, &config, true);
+
+    for (int i = 0; i < n; ++i) {
+        struct hal_led *led = &leds[i];
+
+        led->slice = pwm_gpio_to_slice_num(pins[i]);
+        led->channel = pwm_gpio_to_channel(pins[i]);
+        config = pwm_get_default_config();
+        pwm_config_set_wrap(&config, LED_PWM_TOP);
+        pwm_init(led->slice, &config, true);
+        pwm_set_chan_level(led->slice, led->channel, 0);
+        gpio_set_function(pins[i], GPIO_FUNC_PWM);
+
+        led->data_chan = dma_claim_unused_channel(true);
+        led->ctrl_chan = dma_claim_unused_channel(true);
+
+        dma_channel_config c = dma_channel_get_default_config(led->data_chan);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+        channel_config_set_read_increment(&c, true);
+        channel_config_set_write_increment(&c, false);
+        channel_config_set_dreq(&c, DREQ_PWM_WRAP0 + LED_STEP_SLICE);
+        led->data_config = c;
+        dma_channel_configure(led->data_chan, &c, &pwm_hw->slice[led->slice].cc, NULL, 0, false);
+
+        c = dma_channel_get_default_config(led->ctrl_chan);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, false);
+        dma_channel_configure(led->ctrl_chan, &c, &dma_hw->ch[led->data_chan].al3_read_addr_trig,
+                              &led->waveform, 1, false);
+    }
+}
+
+// Unchain first: aborting a chained channel can still fire its chain
+static void
+led_stop(struct hal_led *led)
+{
+    channel_config_set_chain_to(&led->data_config, led->data_chan);
+    dma_channel_set_config(led->data_chan, &led->data_config, false);
+    dma_channel_abort(led->ctrl_chan);
+    dma_channel_abort(led->data_chan);
+}
+
+void
+hal_led_level(int i, uint16_t duty)
+{
+    struct hal_led *led = &leds[i];
+
+    if (led->waveform) {
+        led_stop(led);
+        led->waveform = NULL;
+    }
+    pwm_set_chan_level(led->slice, led->channel, duty);
+}
+
+void
+hal_led_waveform(int i, const uint16_t *duty, int len)
+{
+    struct hal_led *led = &leds[i];
+
+    if (led->waveform)
+        led_stop(led);
+    led->waveform = duty;
+
+    // the transfer count reloads on every trigger, so the control
+    // channel only has to rewind the read address
+    channel_config_set_chain_to(&led->data_config, led->ctrl_chan);
+    dma_channel_set_config(led->data_chan, &led->data_config, false);
+    dma_channel_set_trans_count(led->data_chan, len, false);
+    dma_channel_set_read_addr(led->data_chan, duty, true);
+}
+
+//--------------------------------------------------------------------+
+// Persistent storage
+//--------------------------------------------------------------------+
+const uint8_t *
+hal_flash_region(void)
+{
+    return (const uint8_t *) (XIP_BASE + FLASH_REGION_OFFSET);
+}
+
+// XIP is off while the flash is erased or programmed, so nothing may
+// run from flash meanwhile: not this core's interrupt handlers and not
+// the scan loop on core1
+static uint32_t
+flash_lock(void)
+{
+#if DUAL_CORE
+    multicore_lockout_start_blocking();
+#endif
+    return save_and_disable_interrupts();
+}
+
+static void
+flash_unlock(uint32_t interrupts)
+{
+    restore_interrupts(interrupts);
+#if DUAL_CORE
+    multicore_lockout_end_blocking();
+#endif
+}
+
+void
+hal_flash_erase(uint32_t offset)
+{
+    uint32_t interrupts = flash_lock();
+    flash_range_erase(FLASH_REGION_OFFSET + offset, HAL_FLASH_SECTOR_SIZE);
+    flash_unlock(interrupts);
+}
+
+void
+hal_flash_program(uint32_t offset, const void *data, uint32_t len)
+{
+    uint32_t interrupts = flash_lock();
+    flash_range_program(FLASH_REGION_OFFSET + offset, data, len);
+    flash_unlock(interrupts);
+}
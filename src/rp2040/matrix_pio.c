@@ -0,0 +1,103 @@
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+
+#include "matrix_pio.h"
+#include "matrix_scan.pio.h"
+
+// Both channels move the same number of words, so the pattern ring and
+// the snapshot ring always stay in step slot-for-slot
+#define PIO_SCAN_TRANSFERS 0xfffffff0u
+
+#define PIO_SCAN_PATTERN_BYTES (PIO_SCAN_SLOTS * 4)
+#define PIO_SCAN_RING_BYTES    (PIO_SCAN_RING * PIO_SCAN_SLOTS * 4)
+
+static uint32_t column_patterns[PIO_SCAN_SLOTS] __attribute__((aligned(PIO_SCAN_PATTERN_BYTES)));
+static uint32_t snapshots[PIO_SCAN_RING][PIO_SCAN_SLOTS] __attribute__((aligned(PIO_SCAN_RING_BYTES)));
+
+static PIO scan_pio = pio0;
+static int scan_sm = -1;
+static int tx_chan;
+static int rx_chan;
+
+// Snapshots completed before the last re-arm of the channels
+static uint32_t snapshot_base;
+
+static void
+pio_scan_dma_handler(void)
+{
+    if (!dma_channel_get_irq0_status(rx_chan))
+        return;
+    dma_channel_acknowledge_irq0(rx_chan);
+
+    snapshot_base += PIO_SCAN_TRANSFERS / PIO_SCAN_SLOTS;
+    dma_channel_set_trans_count(tx_chan, PIO_SCAN_TRANSFERS, false);
+    dma_channel_set_trans_count(rx_chan, PIO_SCAN_TRANSFERS, false);
+    dma_start_channel_mask((1u << tx_chan) | (1u << rx_chan));
+}
+
+bool
+matrix_pio_init(uint32_t settle_us)
+{
+    if (!pio_can_add_program(scan_pio, &matrix_scan_program))
+        return false;
+    scan_sm = pio_claim_unused_sm(scan_pio, false);
+    if (scan_sm < 0)
+        return false;
+
+    uint offset = pio_add_program(scan_pio, &matrix_scan_program);
+    matrix_scan_program_init(scan_pio, scan_sm, offset, MATRIX_COLUMN_MASK, settle_us);
+
+    pio_scan_patterns(column_patterns);
+
+    tx_chan = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(tx_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_ring(&c, false, __builtin_ctz(PIO_SCAN_PATTERN_BYTES));
+    channel_config_set_dreq(&c, pio_get_dreq(scan_pio, scan_sm, true));
+    dma_channel_configure(tx_chan, &c, &scan_pio->txf[scan_sm], column_patterns,
+                          PIO_SCAN_TRANSFERS, false);
+
+    rx_chan = dma_claim_unused_channel(true);
+    c = dma_channel_get_default_config(rx_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, __builtin_ctz(PIO_SCAN_RING_BYTES));
+    channel_config_set_dreq(&c, pio_get_dreq(scan_pio, scan_sm, false));
+    dma_channel_configure(rx_chan, &c, snapshots, &scan_pio->rxf[scan_sm],
+                          PIO_SCAN_TRANSFERS, false);
+
+    dma_channel_set_irq0_enabled(rx_chan, true);
+    irq_add_shared_handler(DMA_IRQ_0, pio_scan_dma_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_0, true);
+
+    dma_start_channel_mask((1u << tx_chan) | (1u << rx_chan));
+    pio_sm_set_enabled(scan_pio, scan_sm, true);
+    return true;
+}
+
+uint32_t
+matrix_pio_latest(const uint32_t **snapshot)
+{
+    uint32_t done = PIO_SCAN_TRANSFERS - dma_channel_hw_addr(rx_chan)->transfer_count;
+    uint32_t seq = done / PIO_SCAN_SLOTS;
+
+    // the slot being written is seq % RING, so the newest complete one
+    // is the slot before it
+    *snapshot = snapshots[(seq + PIO_SCAN_RING - 1) % PIO_SCAN_RING];
+    return snapshot_base + seq;
+}
+
+void
+matrix_pio_idle(bool idle)
+{
+    uint32_t columns = idle ? MATRIX_COLUMN_MASK : 0;
+
+    // the column pins belong to the PIO, so drive them through it
+    pio_sm_set_enabled(scan_pio, scan_sm, !idle);
+    pio_sm_set_pins_with_mask(scan_pio, scan_sm, columns, MATRIX_COLUMN_MASK);
+}
@@ -0,0 +1,66 @@
+#include <stddef.h>
+
+#include "hal.h"
+#include "sched.h"
+
+static const struct sched *cores[2];
+
+void
+sched_init(struct sched *s, struct sched_task *tasks, int n_tasks)
+{
+    s->tasks = tasks;
+    s->n_tasks = n_tasks;
+    s->wakes = 0;
+    s->busy_us = 0;
+    for (int i = 0; i < n_tasks; ++i) {
+        tasks[i].next_us = 0;
+        tasks[i].stats = (struct sched_stats) { 0 };
+    }
+    cores[hal_core_num()] = s;
+}
+
+uint64_t
+sched_pass(struct sched *s)
+{
+    uint64_t next_us = SCHED_IDLE;
+
+    s->wakes++;
+    for (int i = 0; i < s->n_tasks; ++i) {
+        struct sched_task *task = &s->tasks[i];
+        struct sched_stats *stats = &task->stats;
+        uint64_t start_us = hal_time_us();
+
+        if (task->next_us != SCHED_IDLE && start_us > task->next_us + task->deadline_us) {
+            uint64_t late_us = start_us - task->next_us;
+            stats->late++;
+            if (late_us > stats->max_late_us)
+                stats->max_late_us = late_us > UINT32_MAX ? UINT32_MAX : late_us;
+        }
+
+        task->next_us = task->run();
+
+        uint32_t elapsed = hal_time_us() - start_us;
+        stats->runs++;
+        stats->total_us += elapsed;
+        if (elapsed > stats->max_us)
+            stats->max_us = elapsed;
+        s->busy_us += elapsed;
+
+        if (task->next_us < next_us)
+            next_us = task->next_us;
+    }
+    return next_us;
+}
+
+void
+sched_run(struct sched *s)
+{
+    for (;;)
+        hal_wait_until(sched_pass(s));
+}
+
+const struct sched *
+sched_core(int core)
+{
+    return cores[core];
+}
@@ -0,0 +1,223 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "config.h"
+#include "debounce.h"
+#include "macro.h"
+#include "store.h"
+#include "tap_hold.h"
+#include "trace.h"
+
+_Static_assert(N_KEYS <= 255 && N_LAYERS <= 255, "matrix shape must fit the store header");
+
+#define STORE_IMAGE_PAGES \
+    ((sizeof(struct store_image) + HAL_FLASH_PAGE_SIZE - 1) / HAL_FLASH_PAGE_SIZE)
+
+static const struct store_settings default_settings = {
+    .debounce_algorithm = DEBOUNCE_ALGORITHM,
+    .tap_hold_mode = TAP_HOLD_MODE,
+    .tapping_term_ms = TAPPING_TERM_MS,
+};
+
+// Newest valid image in flash, or NULL for the compiled defaults
+static const struct store_image *active;
+static int active_sector = -1;
+
+// Bumped whenever the active image changes
+static volatile uint32_t generation;
+
+// RAM copy being edited, padded to whole pages for programming
+static union {
+    struct store_image image;
+    uint8_t bytes[STORE_IMAGE_PAGES * HAL_FLASH_PAGE_SIZE];
+} edit;
+
+static uint32_t
+crc32_update(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *bytes = data;
+
+    while (len--) {
+        crc ^= *bytes++;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return crc;
+}
+
+static uint32_t
+image_crc(const struct store_image *image)
+{
+    struct store_header header = image->header;
+    header.crc = 0;
+
+    uint32_t crc = crc32_update(0xffffffff, &header, sizeof(header));
+    crc = crc32_update(crc, (const uint8_t *) image + sizeof(header), sizeof(*image) - sizeof(header));
+    return ~crc;
+}
+
+// Every macro in use has to end inside macro_code, or running it would
+// read on past the image
+static bool
+image_macros_valid(const struct store_image *image)
+{
+    for (int i = 0; i < STORE_MACROS; ++i) {
+        int offset = image->macro_offset[i];
+        if (offset < STORE_MACRO_BYTES &&
+            macro_code_length(&image->macro_code[offset], STORE_MACRO_BYTES - offset) < 0)
+            return false;
+    }
+    return true;
+}
+
+static bool
+image_valid(const struct store_image *image)
+{
+    const struct store_header *header = &image->header;
+
+    return header->magic == STORE_MAGIC && header->version == STORE_VERSION &&
+           header->n_layers == N_LAYERS && header->n_keys == N_KEYS &&
+           header->crc == image_crc(image) && image_macros_valid(image);
+}
+
+void
+store_init(void)
+{
+    const uint8_t *region = hal_flash_region();
+
+    active = NULL;
+    active_sector = -1;
+
+    for (int sector = 0; sector < HAL_FLASH_SECTORS; ++sector) {
+        const struct store_image *image =
+            (const struct store_image *) (region + sector * HAL_FLASH_SECTOR_SIZE);
+
+        if (!image_valid(image))
+            continue;
+        if (active && (int32_t) (image->header.sequence - active->header.sequence) <= 0)
+            continue;
+        active = image;
+        active_sector = sector;
+    }
+    generation++;
+}
+
+const action_t (*store_keymap(void))[N_KEYS]
+{
+    return active ? active->actions : action_table;
+}
+
+const uint8_t *
+store_macro(int index)
+{
+    if (index < 0)
+        return NULL;
+
+    if (!active)
+        return index < (int) N_MACROS ? macros[index] : NULL;
+
+    if (index >= STORE_MACROS || active->macro_offset[index] >= STORE_MACRO_BYTES)
+        return NULL;
+    return &active->macro_code[active->macro_offset[index]];
+}
+
+const struct store_settings *
+store_settings(void)
+{
+    return active ? &active->settings : &default_settings;
+}
+
+uint32_t
+store_sequence(void)
+{
+    return active ? active->header.sequence : 0;
+}
+
+// Lay the compiled defaults out as an image
+static void
+image_defaults(struct store_image *image)
+{
+    int offset = 0;
+
+    memset(image, 0, sizeof(*image));
+    memcpy(image->actions, action_table, sizeof(image->actions));
+    memset(image->macro_offset, 0xff, sizeof(image->macro_offset));
+
+    for (int i = 0; i < (int) N_MACROS && i < STORE_MACROS; ++i) {
+        int len = macro_code_length(macros[i], STORE_MACRO_BYTES - offset);
+        if (len < 0)
+            break;
+        memcpy(&image->macro_code[offset], macros[i], len);
+        image->macro_offset[i] = offset;
+        offset += len;
+    }
+
+    image->settings = default_settings;
+}
+
+struct store_image *
+store_edit(void)
+{
+    memset(edit.bytes, 0xff, sizeof(edit.bytes));
+    if (active)
+        memcpy(&edit.image, active, sizeof(edit.image));
+    else
+        image_defaults(&edit.image);
+    return &edit.image;
+}
+
+bool
+store_commit(void)
+{
+    int sector = (active_sector + 1) % HAL_FLASH_SECTORS;
+    uint32_t base = sector * HAL_FLASH_SECTOR_SIZE;
+
+    edit.image.header = (struct store_header) {
+        .magic = STORE_MAGIC,
+        .version = STORE_VERSION,
+        .n_layers = N_LAYERS,
+        .n_keys = N_KEYS,
+        .sequence = store_sequence() + 1,
+    };
+    edit.image.header.crc = image_crc(&edit.image);
+
+    // the header page goes last: until it is written the sector holds
+    // no valid image and the active one is untouched
+    hal_flash_erase(base);
+    hal_flash_program(base + HAL_FLASH_PAGE_SIZE, edit.bytes + HAL_FLASH_PAGE_SIZE,
+                      sizeof(edit.bytes) - HAL_FLASH_PAGE_SIZE);
+    hal_flash_program(base, edit.bytes, HAL_FLASH_PAGE_SIZE);
+
+    const struct store_image *image =
+        (const struct store_image *) (hal_flash_region() + base);
+    if (!image_valid(image)) {
+        trace(TRACE_STORE_COMMIT, false, edit.image.header.sequence);
+        return false;
+    }
+    trace(TRACE_STORE_COMMIT, true, edit.image.header.sequence);
+
+    active = image;
+    active_sector = sector;
+    generation++;
+    return true;
+}
+
+void
+store_reset(void)
+{
+    // back on the compiled defaults before any sector is erased, so
+    // nothing reads the active image while it turns to 0xff
+    active = NULL;
+    active_sector = -1;
+    generation++;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (int sector = 0; sector < HAL_FLASH_SECTORS; ++sector)
+        hal_flash_erase(sector * HAL_FLASH_SECTOR_SIZE);
+}
+
+uint32_t
+store_generation(void)
+{
+    return generation;
+}
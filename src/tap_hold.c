@@ -0,0 +1,171 @@
+#include <stddef.h>
+
+#include "action.h"
+#include "config.h"
+#include "event_queue.h"
+#include "layer.h"
+#include "matrix.h"
+#include "tap_hold.h"
+
+static tap_hold_mode_t tap_hold_mode = TAP_HOLD_MODE;
+static uint32_t term_us = TAPPING_TERM_MS * 1000u;
+
+// The undecided tap-hold press, if any
+static bool undecided;
+static struct key_event undecided_press;
+static action_t undecided_action;
+
+// Events that arrived after it, oldest first
+static struct key_event pool[TAP_HOLD_POOL_SIZE];
+static int pool_head;
+static int pool_len;
+
+enum decision {
+    UNDECIDED,
+    TAP,
+    HOLD,
+};
+
+static const struct key_event *
+pool_at(int i)
+{
+    return &pool[(pool_head + i) % TAP_HOLD_POOL_SIZE];
+}
+
+static action_t
+hold_action(action_t action)
+{
+    int hold = (action >> 8) & 0xf;
+
+    switch (ACTION_TAG(action)) {
+    case ACT_TAG_MOD_TAP:
+        return ACTION(ACT_TAG_MOD, hold);
+    case ACT_TAG_RMOD_TAP:
+        return ACTION(ACT_TAG_MOD, hold << 4);
+    default:
+        return ACTION(ACT_TAG_LAYER, LAYER_OP_MOMENTARY << 8 | hold);
+    }
+}
+
+static enum decision
+decide(uint32_t now_us)
+{
+    uint32_t press_us = undecided_press.time_us;
+    matrix_t pressed = { 0 };
+
+    for (int i = 0; i < pool_len; ++i) {
+        const struct key_event *event = pool_at(i);
+
+        if (event->key == undecided_press.key)
+            return event->time_us - press_us < term_us ? TAP : HOLD;
+
+        if (event->pressed) {
+            if (tap_hold_mode == TAP_HOLD_ON_OTHER_KEY)
+                return HOLD;
+            matrix_set_key(&pressed, event->key);
+        } else if (tap_hold_mode == TAP_HOLD_PERMISSIVE && matrix_key(&pressed, event->key)) {
+            return HOLD;
+        }
+    }
+
+    if (pool_len == TAP_HOLD_POOL_SIZE || now_us - press_us >= term_us)
+        return HOLD;
+    return UNDECIDED;
+}
+
+// A key event with nothing undecided: either it starts a tap-hold
+// press, or it is resolved now
+static void
+dispatch(const struct key_event *change)
+{
+    if (change->pressed) {
+        action_t action = layer_action(change->key);
+        if (ACTION_IS_TAP_HOLD(action)) {
+            undecided = true;
+            undecided_press = *change;
+            undecided_action = action;
+            return;
+        }
+    }
+    action_process(change);
+}
+
+// Decide the undecided key as far as the events so far allow, then
+// replay the pool behind it until another tap-hold press stops it
+static void
+resolve(uint32_t now_us)
+{
+    while (undecided) {
+        enum decision decision = decide(now_us);
+        if (decision == UNDECIDED)
+            return;
+
+        undecided = false;
+        action_press(&undecided_press, decision == TAP ?
+                     ACTION(ACT_TAG_KEY, undecided_action & 0xff) :
+                     hold_action(undecided_action));
+
+        while (!undecided && pool_len) {
+            struct key_event event = *pool_at(0);
+            pool_head = (pool_head + 1) % TAP_HOLD_POOL_SIZE;
+            pool_len--;
+            dispatch(&event);
+        }
+    }
+}
+
+void
+tap_hold_init(tap_hold_mode_t mode)
+{
+    tap_hold_mode = mode;
+    undecided = false;
+    pool_head = 0;
+    pool_len = 0;
+}
+
+void
+tap_hold_set_term_ms(uint16_t term_ms)
+{
+    term_us = term_ms * 1000u;
+}
+
+void
+tap_hold_process(const struct key_event *change)
+{
+    if (!undecided) {
+        dispatch(change);
+        return;
+    }
+
+    if (pool_len == TAP_HOLD_POOL_SIZE)
+        resolve(change->time_us);
+    if (!undecided) {
+        dispatch(change);
+        return;
+    }
+
+    pool[(pool_head + pool_len++) % TAP_HOLD_POOL_SIZE] = *change;
+    resolve(change->time_us);
+}
+
+void
+tap_hold_task(uint32_t now_us)
+{
+    if (undecided)
+        resolve(now_us);
+}
+
+const char *
+tap_hold_mode_name(tap_hold_mode_t mode)
+{
+    switch (mode) {
+    case TAP_HOLD_TERM:
+        return "term";
+    case TAP_HOLD_PERMISSIVE:
+        return "permissive";
+    case TAP_HOLD_ON_OTHER_KEY:
+        return "on-other-key";
+    default:
+        return "unknown";
+    }
+}
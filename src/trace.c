@@ -0,0 +1,129 @@
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "event_queue.h"
+#include "hal.h"
+#include "macro.h"
+#include "sched.h"
+#include "trace.h"
+
+_Static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "TRACE_RING_SIZE must be a power of two");
+_Static_assert(sizeof(struct trace_record) == 12, "trace records are packed by hand");
+
+// One single-producer/single-consumer ring per core, indexed like the
+// event queue: head written by the owning core, tail by core0
+struct trace_ring {
+    struct trace_record records[TRACE_RING_SIZE];
+    atomic_uint head;
+    atomic_uint tail;
+    atomic_uint dropped;
+};
+
+static struct trace_ring rings[TRACE_CORES];
+
+// Drops already reported as TRACE_DROPPED, per core
+static unsigned dropped_seen[TRACE_CORES];
+
+// UART frame being sent and how much of it is out
+static uint8_t frame[TRACE_FRAME_LEN];
+static unsigned frame_sent = TRACE_FRAME_LEN;
+
+#if TRACE_ENABLED
+void
+trace(enum trace_event id, uint16_t a, uint32_t b)
+{
+    int core = hal_core_num();
+    struct trace_ring *ring = &rings[core];
+    unsigned h = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned t = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (h - t >= TRACE_RING_SIZE) {
+        atomic_store_explicit(&ring->dropped, atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        return;
+    }
+
+    struct trace_record *record = &ring->records[h & (TRACE_RING_SIZE - 1)];
+    record->time_us = hal_time_us();
+    record->id = id;
+    record->core = core;
+    record->a = a;
+    record->b = b;
+    atomic_store_explicit(&ring->head, h + 1, memory_order_release);
+}
+#endif
+
+static bool
+ring_peek(struct trace_ring *ring, const struct trace_record **record)
+{
+    unsigned t = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned h = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (h == t)
+        return false;
+    *record = &ring->records[t & (TRACE_RING_SIZE - 1)];
+    return true;
+}
+
+bool
+trace_pop(struct trace_record *record)
+{
+    const struct trace_record *oldest = NULL;
+    int core = -1;
+
+    for (int c = 0; c < TRACE_CORES; ++c) {
+        const struct trace_record *r;
+
+        if (ring_peek(&rings[c], &r)) {
+            if (!oldest || (int32_t) (r->time_us - oldest->time_us) < 0) {
+                oldest = r;
+                core = c;
+            }
+            continue;
+        }
+
+        unsigned dropped = atomic_load_explicit(&rings[c].dropped, memory_order_relaxed);
+        if (dropped != dropped_seen[c]) {
+            *record = (struct trace_record) {
+                .time_us = hal_time_us(),
+                .id = TRACE_DROPPED,
+                .core = c,
+                .b = dropped - dropped_seen[c],
+            };
+            dropped_seen[c] = dropped;
+            return true;
+        }
+    }
+
+    if (!oldest)
+        return false;
+
+    *record = *oldest;
+    atomic_store_explicit(&rings[core].tail, atomic_load_explicit(&rings[core].tail, memory_order_relaxed) + 1,
+                          memory_order_release);
+    return true;
+}
+
+// Bounded by the UART FIFO: hal_trace_write() never waits, so this
+// stops as soon as the FIFO is full
+uint64_t
+trace_task(void)
+{
+    // the report side wakes the scheduler again once it has drained
+    if (event_queue_depth() != 0 || macro_busy())
+        return SCHED_IDLE;
+
+    for (;;) {
+        if (frame_sent == TRACE_FRAME_LEN) {
+            struct trace_record record;
+            if (!trace_pop(&record))
+                return SCHED_IDLE;
+            trace_frame_encode(&record, frame);
+            frame_sent = 0;
+        }
+
+        frame_sent += hal_trace_write(&frame[frame_sent], TRACE_FRAME_LEN - frame_sent);
+        if (frame_sent < TRACE_FRAME_LEN)
+            return hal_time_us() + TRACE_UART_RETRY_US;
+    }
+}
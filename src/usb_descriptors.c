@@ -24,6 +24,9 @@
  */
 
 #include "tusb.h"
+#include "config.h"
+#include "latency.h"
+#include "raw_hid.h"
 #include "usb_descriptors.h"
 
 /* A combination of interfaces must have a unique product id, since PC will save device driver after the first plug.
@@ -71,9 +74,52 @@ uint8_t const * tud_descriptor_device_cb(void)
 // HID Report Descriptor
 //--------------------------------------------------------------------+
 
+// Bitmap keyboard report with one bit per usage, used in report protocol
+#define TUD_HID_REPORT_DESC_KEYBOARD_NKRO(...) \
+  HID_USAGE_PAGE ( HID_USAGE_PAGE_DESKTOP                  ) ,\
+  HID_USAGE      ( HID_USAGE_DESKTOP_KEYBOARD              ) ,\
+  HID_COLLECTION ( HID_COLLECTION_APPLICATION              ) ,\
+    /* Report ID if any */\
+    __VA_ARGS__ \
+    HID_USAGE_PAGE ( HID_USAGE_PAGE_KEYBOARD               ) ,\
+      HID_USAGE_MIN    ( 0                                 ) ,\
+      HID_USAGE_MAX    ( NKRO_USAGE_MAX                    ) ,\
+      HID_LOGICAL_MIN  ( 0                                 ) ,\
+      HID_LOGICAL_MAX  ( 1                                 ) ,\
+      HID_REPORT_COUNT ( NKRO_REPORT_BYTES * 8             ) ,\
+      HID_REPORT_SIZE  ( 1                                 ) ,\
+      HID_INPUT        ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
+  HID_COLLECTION_END \
+
+// Vendor feature report carrying the latency histograms (see latency.h)
+#define TUD_HID_REPORT_DESC_LATENCY(...) \
+  HID_USAGE_PAGE_N ( HID_USAGE_PAGE_VENDOR, 2              ) ,\
+  HID_USAGE        ( 0x01                                  ) ,\
+  HID_COLLECTION   ( HID_COLLECTION_APPLICATION            ) ,\
+    /* Report ID if any */\
+    __VA_ARGS__ \
+    HID_USAGE        ( 0x02                                ) ,\
+    HID_LOGICAL_MIN  ( 0x00                                ) ,\
+    HID_LOGICAL_MAX_N( 0xff, 2                             ) ,\
+    HID_REPORT_SIZE  ( 8                                   ) ,\
+    HID_REPORT_COUNT ( LATENCY_REPORT_LEN                  ) ,\
+    HID_FEATURE      ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
+  HID_COLLECTION_END \
+
 uint8_t const desc_hid_report[] =
 {
   TUD_HID_REPORT_DESC_KEYBOARD( HID_REPORT_ID(REPORT_ID_KEYBOARD         )),
+  TUD_HID_REPORT_DESC_KEYBOARD_NKRO( HID_REPORT_ID(REPORT_ID_KEYBOARD_NKRO )),
+  TUD_HID_REPORT_DESC_MOUSE   ( HID_REPORT_ID(REPORT_ID_MOUSE            )),
+  TUD_HID_REPORT_DESC_CONSUMER( HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL )),
+  TUD_HID_REPORT_DESC_LATENCY( HID_REPORT_ID(REPORT_ID_LATENCY             )),
+};
+
+// Vendor-defined 64-byte in/out reports without a report ID, carrying
+// the raw HID protocol (see raw_hid.h)
+uint8_t const desc_raw_hid_report[] =
+{
+  TUD_HID_REPORT_DESC_GENERIC_INOUT( RAW_HID_REPORT_LEN ),
 };
 
 // Invoked when received GET HID REPORT DESCRIPTOR
@@ -81,8 +127,7 @@ uint8_t const desc_hid_report[] =
 // Descriptor contents must exist long enough for transfer to complete
 uint8_t const * tud_hid_descriptor_report_cb(uint8_t itf)
 {
-  (void) itf;
-  return desc_hid_report;
+  return itf == HID_INSTANCE_RAW ? desc_raw_hid_report : desc_hid_report;
 }
 
 //--------------------------------------------------------------------+
@@ -92,12 +137,15 @@ uint8_t const * tud_hid_descriptor_report_cb(uint8_t itf)
 enum
 {
   ITF_NUM_HID,
+  ITF_NUM_RAW_HID,
   ITF_NUM_TOTAL
 };
 
-#define  CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN)
+#define  CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN + TUD_HID_INOUT_DESC_LEN)
 
-#define EPNUM_HID   0x81
+#define EPNUM_HID         0x81
+#define EPNUM_RAW_HID_OUT 0x02
+#define EPNUM_RAW_HID_IN  0x82
 
 uint8_t const desc_configuration[] =
 {
@@ -105,7 +153,11 @@ uint8_t const desc_configuration[] =
   TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
 
   // Interface number, string index, protocol, report descriptor len, EP In address, size & polling interval
-  TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, 5)
+  // Declared as a boot keyboard so BIOSes and other boot hosts can select the 6KRO report
+  TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_KEYBOARD, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, HID_EP_INTERVAL_MS),
+
+  // Interface number, string index, protocol, report descriptor len, EP Out & In address, size & polling interval
+  TUD_HID_INOUT_DESCRIPTOR(ITF_NUM_RAW_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_raw_hid_report), EPNUM_RAW_HID_OUT, EPNUM_RAW_HID_IN, CFG_TUD_HID_EP_BUFSIZE, RAW_HID_EP_INTERVAL_MS)
 };
 
 // Invoked when received GET CONFIGURATION DESCRIPTOR
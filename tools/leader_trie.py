@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""Compile the leader-key sequences in config.h into a double-array trie.
+
+Reads the CONFIG_LEADER_SEQUENCES(X) X-macro from config.h, resolves the
+KEY_* names against usb_hid_keys.h and writes a header with the base,
+check and action arrays used by src/leader.c. Each keystroke is then one
+addition and one compare, however many sequences there are.
+
+usage: leader_trie.py config.h usb_hid_keys.h output.h
+"""
+
+import re
+import sys
+
+
+def read_usages(path):
+    usages = {}
+    for m in re.finditer(r'^#define\s+(KEY_\w+)\s+(0x[0-9a-fA-F]+|\d+)', open(path).read(), re.M):
+        usages[m.group(1)] = int(m.group(2), 0)
+    return usages
+
+
+def read_sequences(path):
+    text = open(path).read().replace('\\\n', ' ')
+    m = re.search(r'^#define\s+CONFIG_LEADER_SEQUENCES\(X\)(.*)$', text, re.M)
+    if not m:
+        sys.exit('%s: CONFIG_LEADER_SEQUENCES(X) not found' % path)
+
+    body = m.group(1)
+    entries = []
+    pos = 0
+    while True:
+        start = body.find('X(', pos)
+        if start < 0:
+            break
+        depth, i = 0, start + 1
+        args, arg_start = [], start + 2
+        while True:
+            c = body[i]
+            if c == '(':
+                depth += 1
+            elif c == ')':
+                depth -= 1
+                if depth == 0:
+                    args.append(body[arg_start:i].strip())
+                    break
+            elif c == ',' and depth == 1:
+                args.append(body[arg_start:i].strip())
+                arg_start = i + 1
+            i += 1
+        entries.append((args[0], args[1:]))
+        pos = i + 1
+    return entries
+
+
+def build_trie(entries, usages):
+    # nodes: list of (children dict symbol -> node, action or None)
+    nodes = [({}, None)]
+    for action, keys in entries:
+        if not keys:
+            sys.exit('leader sequence for %s has no keys' % action)
+        node = 0
+        for key in keys:
+            if key not in usages:
+                sys.exit('unknown usage %s in leader sequence for %s' % (key, action))
+            sym = usages[key]
+            children = nodes[node][0]
+            if sym not in children:
+                children[sym] = len(nodes)
+                nodes.append(({}, None))
+            node = children[sym]
+        if nodes[node][1] is not None:
+            sys.exit('duplicate leader sequence %s' % ' '.join(keys))
+        nodes[node] = (nodes[node][0], action)
+
+    for children, action in nodes:
+        if children and action is not None:
+            sys.exit('leader sequence for %s is a prefix of another one' % action)
+    return nodes
+
+
+def double_array(nodes):
+    # state 0 is the root; every other node gets a slot base[parent] + sym
+    base, check, slot = {}, {}, {0: 0}
+    used = {0}
+    queue = [0]
+    while queue:
+        node = queue.pop(0)
+        children = nodes[node][0]
+        if not children:
+            base[slot[node]] = 0
+            continue
+        b = 1
+        while any(b + sym in used for sym in children):
+            b += 1
+        base[slot[node]] = b
+        for sym, child in sorted(children.items()):
+            slot[child] = b + sym
+            used.add(b + sym)
+            check[b + sym] = slot[node] + 1
+            queue.append(child)
+
+    size = max(used) + 1
+    actions = {slot[n]: nodes[n][1] for n in range(len(nodes)) if nodes[n][1] is not None}
+    return size, base, check, actions
+
+
+def main():
+    config, keys, out = sys.argv[1:4]
+    size, base, check, actions = double_array(build_trie(read_sequences(config), read_usages(keys)))
+
+    lines = [
+        '// Generated by tools/leader_trie.py from CONFIG_LEADER_SEQUENCES in',
+        '// config.h. Do not edit.',
+        '',
+        '#define LEADER_TRIE_SIZE %d' % size,
+        '',
+        '// Next state from s on usage u is t = base[s] + u, valid when',
+        '// check[t] == s + 1, so unused slots (check 0) never match. base is',
+        '// 0 at the end of a sequence.',
+        'static const uint16_t leader_base[LEADER_TRIE_SIZE] = {',
+    ]
+    lines += ['    [%d] = %d,' % (s, b) for s, b in sorted(base.items()) if b or s == 0]
+    lines += ['};', '', 'static const uint16_t leader_check[LEADER_TRIE_SIZE] = {']
+    lines += ['    [%d] = %d,' % (s, c) for s, c in sorted(check.items())] or ['    0,']
+    lines += ['};', '', 'static const action_t leader_action[LEADER_TRIE_SIZE] = {']
+    lines += ['    [%d] = %s,' % (s, a) for s, a in sorted(actions.items())] or ['    0,']
+    lines += ['};', '']
+
+    with open(out, 'w') as f:
+        f.write('\n'.join(lines))
+
+
+if __name__ == '__main__':
+    main()
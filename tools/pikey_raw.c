@@ -0,0 +1,307 @@
+// Command-line client for the raw HID interface over Linux hidraw.
+//
+//   pikey_raw /dev/hidrawN info
+//   pikey_raw /dev/hidrawN read LAYER
+//   pikey_raw /dev/hidrawN write LAYER KEY ACTION [ACTION...]
+//   pikey_raw /dev/hidrawN commit
+//   pikey_raw /dev/hidrawN reset
+//   pikey_raw /dev/hidrawN matrix [INTERVAL_MS]
+//   pikey_raw /dev/hidrawN counters
+//   pikey_raw /dev/hidrawN trace FILE
+//   pikey_raw /dev/hidrawN tasks
+//   pikey_raw /dev/hidrawN settle [save]
+//   pikey_raw /dev/hidrawK latency STAGE [reset]
+//
+// Writes are pending on the device until commit. Actions are the
+// 16-bit values from action.h, in any base strtol accepts. trace saves
+// the pending trace records as UART frames for tools/trace_decode.py.
+// settle save stores the calibrated matrix delays, committing any
+// pending writes with them.
+//
+// latency talks to the keyboard interface's node instead, through the
+// feature report laid out in latency.h. STAGE is debounce, queue, usb
+// or total; reset clears every histogram after this one is read.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/hidraw.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "latency.h"
+#include "raw_client.h"
+#include "usb_descriptors.h"
+
+#define RECV_TIMEOUT_MS 1000
+#define USAGE_ERROR     -100
+
+static int n_cols = 1, n_rows = 1;
+
+static bool
+hidraw_send(void *ctx, const uint8_t *report)
+{
+    uint8_t buffer[1 + RAW_HID_REPORT_LEN] = { 0 };    // report ID 0
+
+    memcpy(&buffer[1], report, RAW_HID_REPORT_LEN);
+    return write(*(int *) ctx, buffer, sizeof(buffer)) == sizeof(buffer);
+}
+
+static bool
+hidraw_recv(void *ctx, uint8_t *report)
+{
+    struct pollfd pfd = { .fd = *(int *) ctx, .events = POLLIN };
+
+    if (poll(&pfd, 1, RECV_TIMEOUT_MS) <= 0)
+        return false;
+    return read(pfd.fd, report, RAW_HID_REPORT_LEN) == RAW_HID_REPORT_LEN;
+}
+
+static void
+print_matrix(void *ctx, const struct raw_hid_matrix *matrix)
+{
+    (void) ctx;
+
+    printf("t=%u scans=%u\n", matrix->time_us, matrix->scans);
+    for (int row = 0; row < n_rows; ++row) {
+        for (int col = 0; col < n_cols; ++col) {
+            int key = col * n_rows + row;
+            putchar(key / 32 < matrix->n_words && (matrix->w[key / 32] >> (key % 32)) & 1 ? '#' : '.');
+        }
+        putchar('\n');
+    }
+    fflush(stdout);
+}
+
+static int
+usage(void)
+{
+    fprintf(stderr, "usage: pikey_raw DEVICE info|read LAYER|write LAYER KEY ACTION...|"
+                    "commit|reset|matrix [INTERVAL_MS]|counters|trace FILE|tasks|settle [save]\n"
+                    "       pikey_raw KEYBOARD_DEVICE latency debounce|queue|usb|total [reset]\n");
+    return USAGE_ERROR;
+}
+
+static const char *const stage_names[LATENCY_STAGES] = { "debounce", "queue", "usb", "total" };
+
+// Select a stage, read its histogram back, then clear them all if asked
+static int
+latency(int fd, int argc, char **argv)
+{
+    uint8_t set[1 + LATENCY_REPORT_LEN] = { REPORT_ID_LATENCY };
+    uint8_t get[1 + LATENCY_REPORT_LEN] = { REPORT_ID_LATENCY };
+    struct latency_report report;
+    int stage;
+
+    if (argc < 1 || argc > 2 || (argc == 2 && strcmp(argv[1], "reset") != 0))
+        return USAGE_ERROR;
+    for (stage = 0; stage < LATENCY_STAGES; ++stage)
+        if (strcmp(argv[0], stage_names[stage]) == 0)
+            break;
+    if (stage == LATENCY_STAGES)
+        return USAGE_ERROR;
+
+    set[1] = stage;
+    if (ioctl(fd, HIDIOCSFEATURE(sizeof(set)), set) < 0 ||
+        ioctl(fd, HIDIOCGFEATURE(sizeof(get)), get) != sizeof(get) || get[0] != REPORT_ID_LATENCY) {
+        fprintf(stderr, "pikey_raw: latency feature report: %s\n", strerror(errno));
+        return 1;
+    }
+    memcpy(&report, &get[1], sizeof(report));
+
+    printf("stage=%s samples=%u max_us=%u\n",
+           report.stage < LATENCY_STAGES ? stage_names[report.stage] : "?",
+           report.samples, report.max_us);
+    for (int i = 0; i < report.n_buckets && i < LATENCY_BUCKETS; ++i)
+        if (report.buckets[i])
+            printf("  %6u us%s %u\n", i ? 1u << i : 0, i == LATENCY_BUCKETS - 1 ? "+" : " ",
+                   report.buckets[i]);
+
+    if (argc == 2) {
+        set[2] = LATENCY_CMD_RESET;
+        if (ioctl(fd, HIDIOCSFEATURE(sizeof(set)), set) < 0) {
+            fprintf(stderr, "pikey_raw: latency reset: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+    return RAW_OK;
+}
+
+static int
+run(struct raw_client *client, const struct raw_hid_hello *hello, int argc, char **argv)
+{
+    const char *command = argv[0];
+    uint32_t sequence = 0;
+
+    if (strcmp(command, "info") == 0) {
+        printf("version=%u layers=%u cols=%u rows=%u keys=%u store_sequence=%u\n",
+               hello->version, hello->n_layers, hello->n_cols, hello->n_rows,
+               hello->n_keys, hello->store_sequence);
+        return RAW_OK;
+    }
+
+    if (strcmp(command, "read") == 0 && argc == 2) {
+        action_t actions[256];
+        int status = raw_client_keymap_read(client, atoi(argv[1]), 0, hello->n_keys, actions);
+
+        for (int row = 0; status == RAW_OK && row < hello->n_rows; ++row) {
+            for (int col = 0; col < hello->n_cols; ++col)
+                printf("%s0x%04x", col ? " " : "", actions[col * hello->n_rows + row]);
+            printf("\n");
+        }
+        return status;
+    }
+
+    if (strcmp(command, "write") == 0 && argc >= 4) {
+        action_t actions[256];
+        int n = 0;
+
+        for (int i = 3; i < argc && n < 256; ++i)
+            actions[n++] = strtol(argv[i], NULL, 0);
+        return raw_client_keymap_write(client, atoi(argv[1]), atoi(argv[2]), n, actions);
+    }
+
+    if (strcmp(command, "commit") == 0) {
+        int status = raw_client_commit(client, &sequence);
+        printf("store_sequence=%u\n", sequence);
+        return status;
+    }
+
+    if (strcmp(command, "reset") == 0) {
+        int status = raw_client_reset(client, &sequence);
+        printf("store_sequence=%u\n", sequence);
+        return status;
+    }
+
+    if (strcmp(command, "matrix") == 0) {
+        struct raw_hid_matrix matrix;
+        int interval_ms = argc > 1 ? atoi(argv[1]) : 0;
+        int status = raw_client_matrix(client, interval_ms, &matrix);
+
+        if (status == RAW_OK)
+            print_matrix(NULL, &matrix);
+
+        // stream until interrupted; timeouts just mean nothing changed
+        client->on_matrix = print_matrix;
+        while (status == RAW_OK && interval_ms)
+            raw_client_poll(client);
+        return status;
+    }
+
+    if (strcmp(command, "counters") == 0) {
+        struct raw_hid_counters counters;
+        int status = raw_client_counters(client, &counters);
+
+        if (status == RAW_OK)
+            printf("scans=%u scan_max_us=%u scan_overruns=%u events=%u events_dropped=%u "
+                   "queue_depth_max=%u latency_samples=%u latency_max_us=%u scans_ghosted=%u\n",
+                   counters.scans, counters.scan_max_us, counters.scan_overruns,
+                   counters.events, counters.events_dropped, counters.queue_depth_max,
+                   counters.latency_samples, counters.latency_max_us, counters.scans_ghosted);
+        return status;
+    }
+
+    if (strcmp(command, "trace") == 0 && argc == 2) {
+        static struct trace_record records[4096];
+        uint8_t frame[TRACE_FRAME_LEN];
+        int count;
+        int status = raw_client_trace(client, records, 4096, &count);
+
+        FILE *out = fopen(argv[1], "wb");
+        if (!out) {
+            fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+            return RAW_CLIENT_ERR_TRANSPORT;
+        }
+        for (int i = 0; i < count; ++i) {
+            trace_frame_encode(&records[i], frame);
+            fwrite(frame, sizeof(frame), 1, out);
+        }
+        fclose(out);
+        printf("records=%d\n", count);
+        return status;
+    }
+
+    if (strcmp(command, "tasks") == 0) {
+        // a core without a scheduler answers RAW_ERR_RANGE
+        for (int core = 0; core < 2; ++core) {
+            struct raw_hid_tasks tasks = { 0 };
+            int status = RAW_OK;
+
+            for (int first = 0; status == RAW_OK && first <= tasks.n_tasks; first += tasks.count) {
+                status = raw_client_tasks(client, core, first, &tasks);
+                if (status != RAW_OK || tasks.count == 0)
+                    break;
+                if (first == 0)
+                    printf("core=%d wakes=%u busy_ms=%u\n", core, tasks.wakes, tasks.busy_ms);
+                for (int i = 0; i < tasks.count; ++i)
+                    printf("  %-8.8s runs=%u late=%u max_us=%u busy_ms=%u\n",
+                           tasks.tasks[i].name, tasks.tasks[i].runs, tasks.tasks[i].late,
+                           tasks.tasks[i].max_us, tasks.tasks[i].busy_ms);
+            }
+            if (status != RAW_OK && status != RAW_ERR_RANGE)
+                return status;
+        }
+        return RAW_OK;
+    }
+
+    if (strcmp(command, "settle") == 0 && (argc == 1 || (argc == 2 && strcmp(argv[1], "save") == 0))) {
+        struct raw_hid_settle settle;
+        int status = raw_client_settle(client, argc == 2, &settle);
+
+        if (status != RAW_OK)
+            return status;
+        printf("scan_us default=%u now=%u calibrations=%u store_sequence=%u\n",
+               settle.default_scan_us, settle.scan_us, settle.calibrations, settle.sequence);
+        for (int col = 0; col < settle.n_cols; ++col)
+            printf("  col %2d drive_us=%u release_us=%u%s\n", col, settle.drive_us[col],
+                   settle.release_us[col], (settle.calibrated >> col) & 1 ? "" : " (default)");
+        return RAW_OK;
+    }
+
+    return usage();
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc < 3) {
+        usage();
+        return 2;
+    }
+
+    int fd = open(argv[1], O_RDWR);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+
+    struct raw_client client = { .send = hidraw_send, .recv = hidraw_recv, .ctx = &fd };
+    struct raw_hid_hello hello;
+    int status;
+
+    // the keyboard interface speaks no raw HID
+    if (strcmp(argv[2], "latency") == 0) {
+        status = latency(fd, argc - 3, argv + 3);
+        close(fd);
+        if (status == USAGE_ERROR)
+            usage();
+        return status == USAGE_ERROR ? 2 : status;
+    }
+
+    status = raw_client_hello(&client, &hello);
+    if (status == RAW_OK) {
+        n_cols = hello.n_cols;
+        n_rows = hello.n_rows;
+        status = run(&client, &hello, argc - 2, argv + 2);
+    }
+
+    close(fd);
+    if (status == USAGE_ERROR)
+        return 2;
+    if (status != RAW_OK)
+        fprintf(stderr, "pikey_raw: %s failed: %d\n", argv[2], status);
+    return status == RAW_OK ? 0 : 1;
+}
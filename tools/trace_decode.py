@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""Decode a binary trace capture into a timeline.
+
+Reads the TRACE_EVENTS(X) X-macro in trace.h for event names and
+argument names, then scans the capture for frames (TRACE_SYNC, a
+12-byte record, XOR check byte) as sent by trace_task() over the UART
+or saved by `pikey_raw DEVICE trace FILE`. Bytes that do not form a
+valid frame are skipped, so a capture may start mid-frame.
+
+usage: trace_decode.py trace.h capture.bin [--summary]
+"""
+
+import re
+import struct
+import sys
+
+TRACE_SYNC = 0xa5
+RECORD = struct.Struct('<IBBHI')
+FRAME_LEN = RECORD.size + 2
+
+
+def read_events(path):
+    text = open(path).read().replace('\\\n', ' ')
+    m = re.search(r'^#define\s+TRACE_EVENTS\(X\)(.*)$', text, re.M)
+    if not m:
+        sys.exit('%s: TRACE_EVENTS(X) not found' % path)
+    return [(name, a, b) for name, a, b in
+            re.findall(r'X\(\s*(\w+)\s*,\s*"([^"]*)"\s*,\s*"([^"]*)"\s*\)', m.group(1))]
+
+
+def frames(data):
+    i, skipped = 0, 0
+    while i + FRAME_LEN <= len(data):
+        if data[i] != TRACE_SYNC:
+            i += 1
+            skipped += 1
+            continue
+        body = data[i + 1:i + 1 + RECORD.size]
+        check = 0
+        for byte in body:
+            check ^= byte
+        if check != data[i + FRAME_LEN - 1]:
+            i += 1
+            skipped += 1
+            continue
+        yield RECORD.unpack(body), skipped
+        skipped = 0
+        i += FRAME_LEN
+
+
+def main():
+    args = [a for a in sys.argv[1:] if not a.startswith('--')]
+    if len(args) != 2:
+        sys.exit(__doc__.strip().splitlines()[-1])
+
+    events = read_events(args[0])
+    data = open(args[1], 'rb').read()
+
+    start = prev = None
+    counts = {}
+    # time_us is 32-bit and wraps after ~71 minutes; unwrap as we go
+    epoch = 0
+    print('%12s %10s %4s  %-14s %s' % ('time_ms', 'delta_us', 'core', 'event', 'args'))
+    for (time_us, event, core, a, b), skipped in frames(data):
+        if skipped:
+            print('%12s %10s %4s  %-14s bytes=%d' % ('', '', '', '(garbage)', skipped))
+        if prev is not None and time_us + epoch < prev - (1 << 31):
+            epoch += 1 << 32
+        t = time_us + epoch
+        if start is None:
+            start = prev = t
+
+        name, a_name, b_name = events[event] if event < len(events) else ('EVENT_%d' % event, 'a', 'b')
+        fields = []
+        if a_name:
+            fields.append('%s=%d' % (a_name, a))
+        if b_name:
+            fields.append('%s=%d' % (b_name, b))
+        print('%12.3f %10d %4d  %-14s %s' % ((t - start) / 1000.0, t - prev, core, name, ' '.join(fields)))
+        counts[name] = counts.get(name, 0) + 1
+        prev = t
+
+    if '--summary' in sys.argv:
+        print()
+        for name, count in sorted(counts.items(), key=lambda kv: -kv[1]):
+            print('%-14s %d' % (name, count))
+
+
+if __name__ == '__main__':
+    main()